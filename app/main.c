@@ -1,100 +1,267 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
 #include <readline/readline.h>
-#include <readline/history.h>
 #include <signal.h>
 #include <pwd.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
 #include "../src/lab.h"
 
-static void explain_waitpid(int status)
+/**
+ * Launch a pipeline (or single command) as a job. A foreground job is
+ * waited for and its status is the status of its last stage, a background
+ * job returns to the prompt straight away.
+ */
+static void run_job(struct shell *sh, const char *line, char ***stages, size_t nstages,
+                    bool background)
 {
-    if (!WIFEXITED(status))
+    pid_t *pids = arena_alloc(&sh->arena, nstages * sizeof(pid_t));
+    struct launch_opts opts = LAUNCH_OPTS_INIT;
+    opts.foreground = !background;
+    size_t launched = launch_pipeline(sh, stages, nstages, &opts, pids);
+    int error = 0;
+    if (launched < nstages)
+        error = launch_error(stages[launched]);
+    if (launched == 0)
     {
-        fprintf(stderr, "Child exited with status %d\n", WEXITSTATUS(status));
+        sh->last_status = error;
+        return;
     }
-
-    if (WIFSIGNALED(status))
+    struct job *job = job_add(&sh->jobs, pids[0], pids, launched, line, background);
+    if (background)
+    {
+        if (sh->shell_is_interactive)
+            printf("[%d] %d\n", job->id, pids[launched - 1]);
+        sh->last_status = error;
+    }
+    else
     {
-        fprintf(stderr, "Child exited via signal %d\n", WTERMSIG(status));
+        int status = job_wait(sh, job);
+        sh->last_status = error ? error : status;
     }
+}
 
-    if (WIFSTOPPED(status))
+/**
+ * Run a pipeline whose last stage is a builtin. The other stages are
+ * launched as a job and the builtin runs in the shell itself with the
+ * pipeline on its standard input, so a builtin like parallel can read a
+ * list from a pipe. The shell keeps the terminal so Ctrl+C reaches the
+ * builtin, which passes it on to the rest of the pipeline.
+ */
+static void run_lastpipe(struct shell *sh, const char *line, char ***stages, size_t nstages)
+{
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0)
     {
-        fprintf(stderr, "Child stopped by %d\n", WSTOPSIG(status));
+        perror("pipe");
+        sh->last_status = 1;
+        return;
     }
+    pid_t *pids = arena_alloc(&sh->arena, nstages * sizeof(pid_t));
+    struct launch_opts opts = LAUNCH_OPTS_INIT;
+    opts.foreground = false;
+    opts.fd_out = fds[1];
+    size_t launched = launch_pipeline(sh, stages, nstages - 1, &opts, pids);
+    close(fds[1]);
+    int error = 0;
+    if (launched < nstages - 1)
+        error = launch_error(stages[launched]);
+    struct job *job = NULL;
+    if (launched > 0)
+        job = job_add(&sh->jobs, pids[0], pids, launched, line, false);
+
+    int saved = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+    dup2(fds[0], STDIN_FILENO);
+    close(fds[0]);
+    sh->events.interrupted = false;
+    do_builtin(sh, stages[nstages - 1]);
+    int status = sh->last_status;
+    // closing our end lets writers that are still going die of SIGPIPE
+    dup2(saved, STDIN_FILENO);
+    close(saved);
 
-    if (WIFCONTINUED(status))
+    if (job != NULL)
     {
-        fprintf(stderr, "Child was resumed by delivery of SIGCONT\n");
+        if (sh->events.interrupted)
+            job_kill(&sh->jobs, job, SIGINT);
+        job_wait(sh, job);
     }
+    sh->last_status = error ? error : status;
 }
 
-int main(int argc, char *argv[])
+/**
+ * Trim, expand history references in (when interactive), parse and run
+ * one line of input, timing each stage for stats. The line is not freed, all
+ * memory used by the command comes from the shell's arena. When last is
+ * set and nothing is pending an external command replaces the shell.
+ */
+static void run_line(struct shell *sh, char *raw, bool last)
 {
-    parse_args(argc, argv);
-    struct shell sh;
-    sh_init(&sh);
-    char *line = (char *)NULL;
-    while ((line = readline(sh.prompt)))
+    int64_t trim_start = time_now_ns();
+    char *line = trim_white_arena(&sh->arena, raw);
+    stats_record(sh->stats, STATS_TRIM, time_now_ns() - trim_start);
+    // do nothing on blank lines don't save history or attempt to exec
+    if (!*line)
+    {
+        arena_reset(&sh->arena);
+        return;
+    }
+    stats_count(sh->stats, STATS_LINES);
+    int64_t started = 0;
+    char cwd[PATH_MAX] = "";
+    char **cmd = NULL;
+    if (sh->shell_is_interactive)
     {
-        // do nothing on blank lines don't save history or attempt to exec
-        line = trim_white(line);
-        if (!*line)
+        // a replayed command may come back already parsed
+        char *expanded = hist_expand(sh, line, &cmd);
+        if (expanded == NULL)
         {
-            free(line);
-            continue;
+            sh->last_status = 1;
+            arena_reset(&sh->arena);
+            return;
         }
-        add_history(line);
-        // check to see if we are launching a built in command
-        char **cmd = cmd_parse(line);
-        if (!do_builtin(&sh, cmd))
+        if (expanded != line)
         {
-            pid_t pid = fork();
-            if (pid == 0)
-            {
-                /*This is the child process*/
-                pid_t child = getpid();
-                setpgid(child, child);
-                tcsetpgrp(sh.shell_terminal, child);
-                signal(SIGINT, SIG_DFL);
-                signal(SIGQUIT, SIG_DFL);
-                signal(SIGTSTP, SIG_DFL);
-                signal(SIGTTIN, SIG_DFL);
-                signal(SIGTTOU, SIG_DFL);
-                execvp(cmd[0], cmd);
-                exit(EXIT_FAILURE);
-            }
-            else if (pid < 0)
-            {
-                // If fork failed we are in trouble!
-                perror("fork return < 0 Process creation failed!");
-                abort();
-            }
+            printf("%s\n", expanded);
+            fflush(stdout);
+            line = expanded;
+        }
+        hist_ring_add(&sh->recent, line);
+        started = hist_now();
+        if (getcwd(cwd, sizeof(cwd)) == NULL)
+            cwd[0] = '\0';
+    }
+    trace_begin(sh->trace, TRACE_COMMAND, 0, line);
+    // time reports this as the shell's parse overhead
+    int64_t parse_start = time_now_ns();
+    if (cmd == NULL)
+        cmd = cmd_parse_arena(&sh->arena, line);
+    bool background = cmd_background(cmd);
+    size_t nstages;
+    char ***stages = *cmd ? pipeline_split(&sh->arena, cmd, &nstages) : NULL;
+    sh->parse_ns = time_now_ns() - parse_start;
+    stats_record(sh->stats, STATS_PARSE, sh->parse_ns);
+    const struct builtin *prefix = stages ? builtin_find(cmd[0]) : NULL;
+    if (stages == NULL)
+    {
+        fprintf(stderr, "syntax error near unexpected token `%s'\n", *cmd ? "|" : "&");
+        sh->last_status = 2;
+    }
+    else if (prefix != NULL && (prefix->flags & BUILTIN_PREFIX))
+    {
+        // time takes the whole line, pipes included
+        do_builtin(sh, cmd);
+    }
+    else if (nstages > 1 && !background && is_builtin(stages[nstages - 1][0]))
+    {
+        run_lastpipe(sh, line, stages, nstages);
+    }
+    // check to see if we are launching a built in command
+    else if (nstages > 1 || !do_builtin(sh, cmd))
+    {
+        // nothing runs after the last command so skip fork and waitpid
+        if (nstages == 1 && !background && last && sh_can_exec_last(sh))
+            exec_cmd(sh, cmd);
+        run_job(sh, line, stages, nstages, background);
+    }
+    // the record goes in once the status and duration are known
+    if (sh->shell_is_interactive)
+    {
+        // builtin output shows up before the next prompt
+        sh_flush(sh);
+        hist_append(&sh->history, line, cwd, started, hist_now() - started, sh->last_status);
+    }
+    if (sh->last_status != 0)
+        stats_count(sh->stats, STATS_FAILURES);
+    trace_end(sh->trace, TRACE_COMMAND, 0, sh->last_status);
+    jobs_notify(sh);
+    arena_reset(&sh->arena);
+}
+
+/* The shell line handlers run in, readline callbacks take no argument */
+static struct shell *line_shell;
+
+/* When the prompt went up, the read stage lasts until the line is in */
+static int64_t prompt_shown;
 
-            /*
-            This is in the parent put the child process into its own
-            process group and give it control of the terminal
-            to avoid a race condition
-            */
-            // printf("shell:%d , child%d\n",sh.shell_pgid, pid);
-            setpgid(pid, pid);
-            tcsetpgrp(sh.shell_terminal, pid);
-            int status;
-            int rval = waitpid(pid, &status, 0);
-            if (rval == -1)
+/**
+ * Called by readline with each complete line, or NULL at end of input.
+ */
+static void on_line(char *raw)
+{
+    struct shell *sh = line_shell;
+    if (raw == NULL)
+    {
+        sh->events.quit = true;
+        return;
+    }
+    stats_record(sh->stats, STATS_READ, time_now_ns() - prompt_shown);
+    // the terminal belongs to the command until we are back at the prompt
+    event_prompt(sh, false);
+    run_line(sh, raw, false);
+    free(raw);
+    event_prompt(sh, true);
+    prompt_shown = time_now_ns();
+}
+
+int main(int argc, char *argv[])
+{
+    struct shell sh = {0};
+    parse_args(&sh, argc, argv);
+    sh_init(&sh);
+
+    if (sh.shell_is_interactive)
+    {
+        // readline's callback interface lets the event loop read the
+        // terminal while it also watches children, signals and timers
+        line_shell = &sh;
+        rl_callback_handler_install(sh.prompt, on_line);
+        event_prompt(&sh, true);
+        prompt_shown = time_now_ns();
+        while (!sh.events.quit)
+        {
+            if (event_wait(&sh, -1) < 0)
             {
-                fprintf(stderr, "Wait pid failed with -1\n");
-		        explain_waitpid(status);
+                perror("event_wait");
+                break;
             }
-            cmd_free(cmd);
-            // get control of the shell
-            tcsetpgrp(sh.shell_terminal, sh.shell_pgid);
         }
+        rl_callback_handler_remove();
+    }
+    else
+    {
+        // -c, scripts and piped input skip readline and history entirely
+        struct line_reader in;
+        int rval;
+        if (sh.command)
+            rval = reader_open_string(&in, sh.command);
+        else if (sh.script)
+            rval = reader_open_file(&in, sh.script);
+        else
+            rval = reader_open_fd(&in, STDIN_FILENO);
+        if (rval != 0)
+        {
+            fprintf(stderr, "%s: %s\n", sh.script ? sh.script : argv[0], strerror(errno));
+            sh_destroy(&sh);
+            return 127;
+        }
+        char *raw;
+        int64_t read_start = time_now_ns();
+        while ((raw = reader_next(&in)))
+        {
+            stats_record(sh.stats, STATS_READ, time_now_ns() - read_start);
+            run_line(&sh, raw, reader_at_end(&in));
+            read_start = time_now_ns();
+        }
+        reader_close(&in);
     }
+    int status = sh.last_status;
     sh_destroy(&sh);
+    return status;
 }
@@ -0,0 +1,524 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../src/lab.h"
+
+/**
+ * @brief Returns a monotonic timestamp in seconds.
+ */
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Launches /bin/true n times with the given engine and reports the
+ * number of launches per second.
+ */
+static void bench_launch_engine(struct shell *sh, enum launch_engine engine,
+                                const char *name, long n)
+{
+    char **cmd = cmd_parse("/bin/true");
+    sh->launch = engine;
+    double start = now();
+    for (long i = 0; i < n; i++)
+    {
+        pid_t pid = launch_cmd(sh, cmd);
+        if (pid < 0)
+        {
+            perror("launch_cmd");
+            exit(EXIT_FAILURE);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    double elapsed = now() - start;
+    printf("launch %-6s %8ld launches %10.0f launches/sec\n", name, n, n / elapsed);
+    cmd_free(cmd);
+}
+
+/**
+ * @brief Compare fork and posix_spawn launch rates. The optional heap size
+ * (in MB) is allocated and touched first to model a shell whose image has
+ * grown, for example with a long readline history.
+ */
+static void bench_launch(int argc, char **argv)
+{
+    long n = argc > 0 ? atol(argv[0]) : 2000;
+    long mb = argc > 1 ? atol(argv[1]) : 64;
+    struct shell sh;
+
+    char *heap = malloc(mb << 20);
+    if (heap == NULL)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memset(heap, 1, mb << 20);
+    printf("launch: shell heap %ld MB\n", mb);
+
+    sh_init(&sh);
+    bench_launch_engine(&sh, LAUNCH_FORK, "fork", n);
+    bench_launch_engine(&sh, LAUNCH_SPAWN, "spawn", n);
+    sh_destroy(&sh);
+    free(heap);
+}
+
+/**
+ * @brief The original strtok based parser with linear +64 growth, kept as
+ * the baseline for the parse benchmark.
+ */
+static char **legacy_cmd_parse(char const *line)
+{
+    int bufsize = 64;
+    int position = 0;
+    char **tokens = malloc(bufsize * sizeof(char *));
+    char *line_copy = strdup(line);
+    char *token = strtok(line_copy, " \t\r\n\a");
+    while (token != NULL)
+    {
+        tokens[position++] = token;
+        if (position >= bufsize)
+        {
+            bufsize += 64;
+            tokens = realloc(tokens, bufsize * sizeof(char *));
+        }
+        token = strtok(NULL, " \t\r\n\a");
+    }
+    tokens[position] = NULL;
+    return tokens;
+}
+
+static void legacy_cmd_free(char **tokens)
+{
+    free(tokens[0]);
+    free(tokens);
+}
+
+/**
+ * @brief Builds a line of roughly mb megabytes that looks like a long list
+ * of file names, the caller must free it.
+ */
+static char *make_line(long mb)
+{
+    size_t size = (size_t)mb << 20;
+    char *line = malloc(size + 64);
+    size_t len = 0;
+    for (long i = 0; len < size; i++)
+    {
+        len += sprintf(line + len, "./src/dir%ld/file-%ld.c ", i % 97, i);
+    }
+    return line;
+}
+
+/**
+ * @brief Reports parse throughput in MB/s over lines of the given size for
+ * cmd_parse and the legacy strtok parser.
+ */
+static void bench_parse(int argc, char **argv)
+{
+    long mb = argc > 0 ? atol(argv[0]) : 1;
+    long iters = argc > 1 ? atol(argv[1]) : 50;
+    char *line = make_line(mb);
+    double total = (double)strlen(line) * iters / (1 << 20);
+
+    double start = now();
+    for (long i = 0; i < iters; i++)
+    {
+        cmd_free(cmd_parse(line));
+    }
+    double elapsed = now() - start;
+    printf("parse  cmd_parse  %ld MB x %ld %10.1f MB/s\n", mb, iters, total / elapsed);
+
+    start = now();
+    for (long i = 0; i < iters; i++)
+    {
+        legacy_cmd_free(legacy_cmd_parse(line));
+    }
+    elapsed = now() - start;
+    printf("parse  legacy     %ld MB x %ld %10.1f MB/s\n", mb, iters, total / elapsed);
+    free(line);
+}
+
+/**
+ * @brief Compares the scan kernels: token counting, trimming a line padded
+ * with whitespace, and a full cmd_parse, all in MB/s.
+ */
+static void bench_scan(int argc, char **argv)
+{
+    static const char *names[] = {"scalar", "sse2", "avx2"};
+    long mb = argc > 0 ? atol(argv[0]) : 1;
+    long iters = argc > 1 ? atol(argv[1]) : 50;
+    char *line = make_line(mb);
+    size_t len = strlen(line);
+    double total = (double)len * iters / (1 << 20);
+
+    // Whitespace only line for the trim kernels, the worst case for them
+    char *blank = malloc(len + 1);
+    memset(blank, ' ', len);
+    blank[len] = '\0';
+
+    for (int k = SCAN_SCALAR; k <= SCAN_AVX2; k++)
+    {
+        if (scan_set_kernel(k) != 0)
+        {
+            printf("scan   %-6s unsupported\n", names[k]);
+            continue;
+        }
+        size_t sink = 0;
+        double start = now();
+        for (long i = 0; i < iters; i++)
+        {
+            sink += scan_count_tokens(line, len);
+        }
+        double count = total / (now() - start);
+
+        start = now();
+        for (long i = 0; i < iters; i++)
+        {
+            sink += scan_skip(blank, len, SCAN_SPACE) + scan_rskip(blank, len, SCAN_SPACE);
+        }
+        double trim = 2 * total / (now() - start);
+
+        start = now();
+        for (long i = 0; i < iters; i++)
+        {
+            cmd_free(cmd_parse(line));
+        }
+        double parse = total / (now() - start);
+        printf("scan   %-6s count %8.1f MB/s  trim %8.1f MB/s  parse %8.1f MB/s (%zu)\n",
+               names[k], count, trim, parse, sink);
+    }
+    scan_set_kernel(scan_best_kernel());
+    free(blank);
+    free(line);
+}
+
+/**
+ * @brief Pushes gb GB through head | cat | wc with the given pipe size (0 for
+ * the kernel default) and reports the throughput. The count printed by wc
+ * goes to /dev/null.
+ */
+static void bench_pipe_size(struct shell *sh, int pipe_size, const char *gb)
+{
+    char bytes[32];
+    snprintf(bytes, sizeof(bytes), "%ldG", atol(gb));
+    char *head[] = {"head", "-c", bytes, "/dev/zero", NULL};
+    char *cat[] = {"cat", NULL};
+    char *wc[] = {"wc", "-c", NULL};
+    char **stages[] = {head, cat, wc};
+    pid_t pids[3];
+
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    close(null);
+
+    struct launch_opts opts = LAUNCH_OPTS_INIT;
+    sh->pipe_size = pipe_size;
+    double start = now();
+    size_t n = launch_pipeline(sh, stages, 3, &opts, pids);
+    for (size_t i = 0; i < n; i++)
+    {
+        waitpid(pids[i], NULL, 0);
+    }
+    double elapsed = now() - start;
+
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    if (n < 3)
+    {
+        perror("launch_pipeline");
+        exit(EXIT_FAILURE);
+    }
+    printf("pipe   %8d bytes %4ld GB %10.1f MB/s\n", pipe_size, atol(gb),
+           (atol(gb) << 10) / elapsed);
+}
+
+/**
+ * @brief Measure the throughput of a three stage pipeline with default
+ * pipes and with pipes enlarged by F_SETPIPE_SZ.
+ */
+static void bench_pipe(int argc, char **argv)
+{
+    const char *gb = argc > 0 ? argv[0] : "4";
+    int size = argc > 1 ? atoi(argv[1]) : 1 << 20;
+    struct shell sh = {0};
+
+    sh_init(&sh);
+    bench_pipe_size(&sh, 0, gb);
+    bench_pipe_size(&sh, size, gb);
+    sh_destroy(&sh);
+}
+
+/**
+ * @brief Starts a child that reads a pipe until end of file and throws
+ * the data away, standing in for the reader of history's output.
+ * @return The write end of the pipe.
+ */
+static int drain_start(pid_t *pid)
+{
+    int fds[2];
+    if (pipe(fds) != 0 || (*pid = fork()) < 0)
+    {
+        perror("drain");
+        exit(EXIT_FAILURE);
+    }
+    if (*pid == 0)
+    {
+        static char buf[1 << 16];
+        close(fds[1]);
+        while (read(fds[0], buf, sizeof(buf)) > 0)
+        {
+        }
+        _exit(0);
+    }
+    close(fds[0]);
+    return fds[1];
+}
+
+/**
+ * @brief Lists every entry into a pipe with an fprintf per entry on a
+ * stream with the given buffering, as history did before it had a writer.
+ * @return The number of bytes written.
+ */
+static size_t bench_history_stdio(struct hist_store *h, int mode, const char *name)
+{
+    pid_t pid;
+    FILE *out = fdopen(drain_start(&pid), "w");
+    setvbuf(out, NULL, mode, BUFSIZ);
+    size_t count = hist_refresh(h);
+    size_t bytes = 0;
+
+    double start = now();
+    for (size_t i = 0; i < count; i++)
+    {
+        struct hist_entry e;
+        if (hist_get(h, i, &e))
+        {
+            bytes += fprintf(out, "%5zu  %s\n", i + 1, e.cmd);
+        }
+    }
+    fclose(out);
+    waitpid(pid, NULL, 0);
+    double elapsed = now() - start;
+    printf("history %-14s %8zu entries %10.0f entries/sec %8.1f MB/s\n", name, count,
+           count / elapsed, bytes / elapsed / (1 << 20));
+    return bytes;
+}
+
+/**
+ * @brief Runs the history builtin with its output on a pipe.
+ */
+static void bench_history_cmd(struct shell *sh, char **argv, const char *name, size_t bytes)
+{
+    pid_t pid;
+    int fd = drain_start(&pid);
+    size_t count = hist_refresh(&sh->history);
+
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+    double start = now();
+    int status = history_cmd(sh, argv);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    waitpid(pid, NULL, 0);
+    double elapsed = now() - start;
+    if (status != 0)
+    {
+        fprintf(stderr, "history: exit %d\n", status);
+        exit(EXIT_FAILURE);
+    }
+    printf("history %-14s %8zu entries %10.0f entries/sec %8.1f MB/s\n", name, count,
+           count / elapsed, bytes / elapsed / (1 << 20));
+}
+
+/**
+ * @brief Fills a temporary history file with n entries and dumps it into
+ * a pipe: with fprintf on a line buffered stream (stdout on a terminal),
+ * on a fully buffered one, and through the history builtin's writer.
+ */
+static void bench_history(int argc, char **argv)
+{
+    long n = argc > 0 ? atol(argv[0]) : 1000000;
+    char path[] = "/tmp/bench-lab-XXXXXX";
+    struct shell sh = {0};
+
+    close(mkstemp(path));
+    if (hist_open(&sh.history, path) != 0)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    char cmd[128];
+    for (long i = 0; i < n; i++)
+    {
+        const char *fmt = i % 3 ? "make -C src/module%ld check" : "git commit -m 'fix %ld'";
+        snprintf(cmd, sizeof(cmd), fmt, i % 1000);
+        hist_append(&sh.history, cmd, "/home/user/src", i, 0, 0);
+    }
+
+    bench_history_stdio(&sh.history, _IOLBF, "fprintf line");
+    size_t bytes = bench_history_stdio(&sh.history, _IOFBF, "fprintf full");
+    char *list[] = {"history", NULL};
+    bench_history_cmd(&sh, list, "writer", bytes);
+    hist_close(&sh.history);
+    unlink(path);
+}
+
+/**
+ * @brief Finds a builtin by comparing name with each one in turn, the way
+ * do_builtin did before it had a table.
+ */
+static const struct builtin *builtin_chain(const struct builtin *list, size_t count,
+                                           const char *name)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (strcmp(list[i].name, name) == 0)
+        {
+            return &list[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Returns the average nanoseconds per lookup of names, iters
+ * times each, with the chain or, if t is set, the table.
+ */
+static double bench_lookup(const struct builtin *list, size_t count,
+                           const struct builtin_table *t, char **names, long iters)
+{
+    size_t found = 0;
+    long n = 0;
+    double start = now();
+    for (long k = 0; k < iters; k++)
+    {
+        for (char **name = names; *name; name++, n++)
+        {
+            found += (t ? builtin_table_find(t, *name) : builtin_chain(list, count, *name)) != NULL;
+        }
+    }
+    double elapsed = now() - start;
+    if (found == 0 && list[0].name == NULL)
+    {
+        printf("unreachable\n"); // Keeps the lookups from being optimized out
+    }
+    return elapsed * 1e9 / n;
+}
+
+/**
+ * @brief Compares dispatch through a strcmp chain with the perfect hash
+ * table, for builtin names and for external commands, with the shell's
+ * own builtins and with the list padded out to total builtins.
+ */
+static void bench_builtins(int argc, char **argv)
+{
+#define BENCH_BUILTIN(name, run, flags) {name, run, flags},
+    static const struct builtin shell[] = {SHELL_BUILTINS(BENCH_BUILTIN)};
+    size_t nshell = sizeof(shell) / sizeof(shell[0]);
+    long iters = argc > 0 ? atol(argv[0]) : 1000000;
+    size_t total = argc > 1 ? (size_t)atol(argv[1]) : 64;
+    static char *external[] = {"ls", "git", "make", "grep", "cat", "/usr/bin/env",
+                               "./configure", "python3", NULL};
+
+    if (total < nshell)
+    {
+        total = nshell;
+    }
+    struct builtin *list = calloc(total, sizeof(*list));
+    char **names = calloc(total + 1, sizeof(*names));
+    for (size_t i = 0; i < total; i++)
+    {
+        if (i < nshell)
+        {
+            list[i] = shell[i];
+            names[i] = strdup(shell[i].name);
+        }
+        else
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "builtin%zu", i);
+            list[i].name = names[i] = strdup(name);
+        }
+    }
+
+    size_t sizes[] = {nshell, total};
+    for (size_t s = 0; s < 2; s++)
+    {
+        struct builtin_table t;
+        builtin_table_build(&t, list, sizes[s]);
+        char *saved = names[sizes[s]];
+        names[sizes[s]] = NULL;
+        printf("builtins %3zu registered  chain hit %6.1f ns miss %6.1f ns  "
+               "hash hit %6.1f ns miss %6.1f ns\n",
+               sizes[s], bench_lookup(list, sizes[s], NULL, names, iters / sizes[s]),
+               bench_lookup(list, sizes[s], NULL, external, iters / 8),
+               bench_lookup(list, sizes[s], &t, names, iters / sizes[s]),
+               bench_lookup(list, sizes[s], &t, external, iters / 8));
+        names[sizes[s]] = saved;
+        builtin_table_destroy(&t);
+    }
+    for (size_t i = 0; i < total; i++)
+    {
+        free(names[i]);
+    }
+    free(names);
+    free(list);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s launch [count] [heap-mb]\n"
+                        "       %s parse [line-mb] [iterations]\n"
+                        "       %s scan [line-mb] [iterations]\n"
+                        "       %s pipe [gb] [pipe-bytes]\n"
+                        "       %s history [entries]\n"
+                        "       %s builtins [lookups] [builtins]\n",
+                *argv, *argv, *argv, *argv, *argv, *argv);
+        return 1;
+    }
+    if (strcmp(argv[1], "launch") == 0)
+    {
+        bench_launch(argc - 2, argv + 2);
+        return 0;
+    }
+    if (strcmp(argv[1], "parse") == 0)
+    {
+        bench_parse(argc - 2, argv + 2);
+        return 0;
+    }
+    if (strcmp(argv[1], "scan") == 0)
+    {
+        bench_scan(argc - 2, argv + 2);
+        return 0;
+    }
+    if (strcmp(argv[1], "pipe") == 0)
+    {
+        bench_pipe(argc - 2, argv + 2);
+        return 0;
+    }
+    if (strcmp(argv[1], "history") == 0)
+    {
+        bench_history(argc - 2, argv + 2);
+        return 0;
+    }
+    if (strcmp(argv[1], "builtins") == 0)
+    {
+        bench_builtins(argc - 2, argv + 2);
+        return 0;
+    }
+    fprintf(stderr, "%s: unknown benchmark %s\n", *argv, argv[1]);
+    return 1;
+}
@@ -0,0 +1,68 @@
+#!/bin/sh
+# Runs a script of echo, printf, pwd, true, false, test and [ through the
+# shell twice: as builtins, and by absolute path so every line forks and
+# execs like it did before they were built in. Reports loop iterations
+# per second for each.
+#
+# usage: bench/utils.sh [shell] [iterations]
+
+shell=${1:-./myprogram}
+iterations=${2:-100000}
+# Forking is a few hundred times slower, keep that run short.
+forked=$((iterations / 100))
+[ "$forked" -lt 100 ] && forked=100
+
+script=$(mktemp) || exit 1
+trap 'rm -f "$script"' EXIT
+
+# Full path of a utility outside the shell.
+path_of() {
+    for dir in /usr/bin /bin; do
+        if [ -x "$dir/$1" ]; then
+            echo "$dir/$1"
+            return
+        fi
+    done
+    echo "utils.sh: no $1 in /usr/bin or /bin" >&2
+    exit 1
+}
+
+# Writes the loop body n times, running each utility as $2 names it.
+generate() {
+    name=$2
+    awk -v n="$1" -v u_echo="$($name echo)" -v u_printf="$($name printf)" \
+        -v u_pwd="$($name pwd)" -v u_true="$($name true)" -v u_false="$($name false)" \
+        -v u_test="$($name test)" -v u_bracket="$($name [)" '
+        BEGIN {
+            for (i = 0; i < n; i++) {
+                print u_echo, "iteration", i
+                print u_printf, "%s-%05d\\n", "item", i
+                print u_pwd
+                print u_true
+                print u_false
+                print u_test, "-d", "/tmp", "-a", i, "-ge", 0
+                print u_bracket, "x" i, "=", "x" i, "]"
+            }
+        }' > "$script"
+}
+
+# The bare name of a utility, which the shell runs as a builtin.
+name_of() {
+    echo "$1"
+}
+
+# Runs the script and prints iterations per second.
+measure() {
+    start=$(date +%s%N)
+    "$shell" "$script" > /dev/null
+    end=$(date +%s%N)
+    awk -v label="$1" -v n="$2" -v ns=$((end - start)) 'BEGIN {
+        printf "%-10s %8d iterations %8.3f s %12.0f iterations/s\n",
+            label, n, ns / 1e9, n / (ns / 1e9)
+    }'
+}
+
+generate "$forked" path_of
+measure forked "$forked"
+generate "$iterations" name_of
+measure builtin "$iterations"
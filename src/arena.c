@@ -0,0 +1,152 @@
+#include "lab.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+
+/* Every allocation is aligned for any type. */
+#define ARENA_ALIGN (sizeof(max_align_t))
+
+/* Smallest chunk the arena will ask malloc for. */
+#define ARENA_MIN_CHUNK 4096
+
+/**
+ * @brief One block of memory obtained from malloc. Chunks are chained so a
+ * command that outgrows the current chunk does not move earlier allocations.
+ */
+struct arena_chunk {
+    struct arena_chunk *prev;
+    size_t size;
+    max_align_t data[];
+};
+
+/**
+ * @brief Rounds n up to the next power of two that is at least
+ * ARENA_MIN_CHUNK.
+ */
+static size_t arena_round(size_t n) {
+    size_t size = ARENA_MIN_CHUNK;
+    while (size < n) {
+        size *= 2;
+    }
+    return size;
+}
+
+/**
+ * @brief Starts a new chunk with room for at least size bytes.
+ * @return 0 on success, -1 if malloc failed.
+ */
+static int arena_grow(struct arena *a, size_t size) {
+    size = arena_round(size);
+    struct arena_chunk *c = malloc(sizeof(*c) + size);
+    if (c == NULL) {
+        return -1;
+    }
+    c->prev = a->chunk;
+    c->size = size;
+    a->chunk = c;
+    a->used = 0;
+    a->mallocs++;
+    return 0;
+}
+
+/**
+ * @brief Frees every chunk.
+ */
+static void arena_free_chunks(struct arena *a) {
+    struct arena_chunk *c = a->chunk;
+    while (c != NULL) {
+        struct arena_chunk *prev = c->prev;
+        free(c);
+        c = prev;
+    }
+    a->chunk = NULL;
+    a->used = 0;
+}
+
+/**
+ * @brief Initializes an arena with a first chunk of at least size bytes. A
+ * zeroed arena is also valid, its first allocation creates the chunk.
+ *
+ * @param a The arena.
+ * @param size The initial capacity in bytes, 0 for the default.
+ */
+void arena_init(struct arena *a, size_t size) {
+    memset(a, 0, sizeof(*a));
+    if (size > 0) {
+        arena_grow(a, size);
+    }
+}
+
+/**
+ * @brief Allocates size bytes from the arena by bumping a pointer. The
+ * memory stays valid until the next arena_reset.
+ *
+ * @param a The arena.
+ * @param size The number of bytes to allocate.
+ * @return The memory, aligned for any type. Exits the shell if the system
+ * is out of memory, like cmd_parse always has.
+ */
+void *arena_alloc(struct arena *a, size_t size) {
+    size_t need = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    if (a->chunk == NULL || a->chunk->size - a->used < need) {
+        if (arena_grow(a, need) != 0) {
+            fprintf(stderr, "arena_alloc: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    void *p = (char *)a->chunk->data + a->used;
+    a->used += need;
+    a->total += need;
+    a->allocs++;
+    return p;
+}
+
+/**
+ * @brief Copies a string into the arena.
+ *
+ * @param a The arena.
+ * @param s The string to copy.
+ * @return The copy, valid until the next arena_reset.
+ */
+char *arena_strdup(struct arena *a, const char *s) {
+    size_t len = strlen(s);
+    char *copy = arena_alloc(a, len + 1);
+    memcpy(copy, s, len + 1);
+    return copy;
+}
+
+/**
+ * @brief Releases everything allocated since the last reset.
+ *
+ * If the last command needed more than one chunk they are replaced by a
+ * single chunk large enough for the high water mark, so once the arena
+ * has seen the largest command the read-parse-exec cycle never calls
+ * malloc again.
+ *
+ * @param a The arena.
+ */
+void arena_reset(struct arena *a) {
+    if (a->total > a->high) {
+        a->high = a->total;
+    }
+    if (a->chunk != NULL && a->chunk->prev != NULL) {
+        arena_free_chunks(a);
+        arena_grow(a, a->high);
+    }
+    a->used = 0;
+    a->total = 0;
+    a->resets++;
+}
+
+/**
+ * @brief Frees all memory owned by the arena. The counters are kept so they
+ * can still be inspected.
+ *
+ * @param a The arena.
+ */
+void arena_destroy(struct arena *a) {
+    arena_free_chunks(a);
+    a->total = 0;
+}
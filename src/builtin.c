@@ -0,0 +1,105 @@
+#include "lab.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+/* Seeds tried at one table size before it is doubled. */
+#define BUILTIN_SEEDS 4096
+
+/**
+ * @brief Seeded 64-bit FNV-1a hash of a command name, with the high bits
+ * folded down since the table only uses the low ones.
+ */
+static uint64_t builtin_hash(const char *s, uint64_t seed) {
+    uint64_t h = 14695981039346656037ULL ^ (seed * 0x9E3779B97F4A7C15ULL);
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+    return h ^ (h >> 32);
+}
+
+/**
+ * @brief Tries to place every builtin in a slot of its own with one seed.
+ * @return true if no two names collided.
+ */
+static bool builtin_place(struct builtin_table *t, uint64_t seed) {
+    memset(t->slots, 0, (t->mask + 1) * sizeof(*t->slots));
+    for (size_t i = 0; i < t->count; i++) {
+        uint16_t *slot = &t->slots[builtin_hash(t->list[i].name, seed) & t->mask];
+        if (*slot != 0) {
+            return false;
+        }
+        *slot = (uint16_t)(i + 1);
+    }
+    t->seed = seed;
+    return true;
+}
+
+/**
+ * @brief Builds a perfect hash table for a list of builtins.
+ *
+ * The list is fixed when the shell is compiled, so instead of handling
+ * collisions at every lookup the seed of the hash is searched for one
+ * that sends every name to a slot of its own. With a table eight times
+ * the size of the list a few seeds usually do, and the search runs once
+ * when the first command is looked up. A lookup is then one hash and one
+ * strcmp, for a builtin and for the far more common external command.
+ *
+ * @param t The table.
+ * @param list The builtins, which must outlive the table.
+ * @param count How many, at most 65535.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int builtin_table_build(struct builtin_table *t, const struct builtin *list, size_t count) {
+    size_t size = 16;
+    while (size < 8 * count) {
+        size *= 2;
+    }
+    t->list = list;
+    t->count = count;
+    t->slots = NULL;
+    for (;; size *= 2) {
+        uint16_t *slots = realloc(t->slots, size * sizeof(*slots));
+        if (slots == NULL) {
+            builtin_table_destroy(t);
+            return -1;
+        }
+        t->slots = slots;
+        t->mask = size - 1;
+        for (uint64_t seed = 0; seed < BUILTIN_SEEDS; seed++) {
+            if (builtin_place(t, seed)) {
+                return 0;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Looks a command name up in a builtin table.
+ *
+ * @param t The table.
+ * @param name The command name.
+ * @return The builtin, or NULL if name is not one.
+ */
+const struct builtin *builtin_table_find(const struct builtin_table *t, const char *name) {
+    if (t->slots == NULL) {
+        return NULL;
+    }
+    uint16_t slot = t->slots[builtin_hash(name, t->seed) & t->mask];
+    if (slot == 0 || strcmp(t->list[slot - 1].name, name) != 0) {
+        return NULL;
+    }
+    return &t->list[slot - 1];
+}
+
+/**
+ * @brief Frees a builtin table.
+ *
+ * @param t The table.
+ */
+void builtin_table_destroy(struct builtin_table *t) {
+    free(t->slots);
+    t->slots = NULL;
+}
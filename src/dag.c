@@ -0,0 +1,577 @@
+#define _GNU_SOURCE
+#include "lab.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+
+/**
+ * @brief Where a task is in its life.
+ */
+enum dag_state {
+    DAG_WAITING, // Prerequisites unfinished, or one of them failed.
+    DAG_READY,   // In the ready heap.
+    DAG_RUNNING,
+    DAG_DONE,
+    DAG_FAILED,
+};
+
+/**
+ * @brief One task of the graph: a command, the tasks it needs and the
+ * tasks that need it. Strings and arrays live in the graph's arena.
+ * error is the status of a pipeline stage that could not be launched.
+ */
+struct dag_task {
+    const char *name;
+    char **argv;
+    char **deps;
+    size_t ndeps;
+    size_t *succ;
+    size_t nsucc;
+    size_t waiting;
+    double cost;
+    double priority;
+    enum dag_state state;
+    struct job *job;
+    double start;
+    int error;
+    int status;
+};
+
+/**
+ * @brief A parsed task graph and the state of running it.
+ */
+struct dag {
+    struct shell *sh;
+    struct arena arena;
+    struct dag_task *tasks;
+    size_t ntasks;
+    size_t cap;
+    size_t *index;
+    size_t index_size;
+    size_t *heap;
+    size_t nheap;
+    size_t *running;
+    size_t nrunning;
+    size_t slots;
+    size_t failed;
+    bool keep_going;
+    bool quiet;
+    bool stop;
+    int fd_in;
+};
+
+/**
+ * @brief Returns a monotonic timestamp in seconds.
+ */
+static double dag_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief 64-bit FNV-1a hash of a task name.
+ */
+static size_t dag_hash(const char *s) {
+    uint64_t h = 14695981039346656037ULL;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+    return (size_t)h;
+}
+
+/**
+ * @brief Finds the index slot for name. The slot holds SIZE_MAX if no task
+ * has that name.
+ */
+static size_t *dag_slot(struct dag *d, const char *name) {
+    size_t mask = d->index_size - 1;
+    size_t i = dag_hash(name) & mask;
+    while (d->index[i] != SIZE_MAX && strcmp(d->tasks[d->index[i]].name, name) != 0) {
+        i = (i + 1) & mask;
+    }
+    return &d->index[i];
+}
+
+/**
+ * @brief Parses one line of the description into a new task.
+ *
+ * A line is "name[@cost] [prerequisites...] : command [args...]". Blank
+ * lines and lines starting with # are ignored.
+ *
+ * @return 0 on success, -1 on a syntax error.
+ */
+static int dag_parse_line(struct dag *d, const char *line, size_t lineno) {
+    char **tok = cmd_parse_arena(&d->arena, line);
+    if (tok[0] == NULL || tok[0][0] == '#') {
+        return 0;
+    }
+
+    size_t colon = 1;
+    while (tok[colon] != NULL && strcmp(tok[colon], ":") != 0) {
+        colon++;
+    }
+    if (tok[colon] == NULL || tok[colon + 1] == NULL) {
+        fprintf(stderr, "dag: line %zu: expected name [deps...] : command\n", lineno);
+        return -1;
+    }
+    tok[colon] = NULL;
+
+    if (d->ntasks == d->cap) {
+        size_t cap = d->cap ? d->cap * 2 : 16;
+        struct dag_task *tasks = realloc(d->tasks, cap * sizeof(*tasks));
+        if (tasks == NULL) {
+            fprintf(stderr, "dag: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        d->tasks = tasks;
+        d->cap = cap;
+    }
+    struct dag_task *t = &d->tasks[d->ntasks++];
+    memset(t, 0, sizeof(*t));
+    t->name = tok[0];
+    t->cost = 1;
+    char *at = strchr(tok[0], '@');
+    if (at != NULL) {
+        *at = '\0';
+        t->cost = strtod(at + 1, NULL);
+        if (t->cost <= 0) {
+            fprintf(stderr, "dag: line %zu: bad cost for %s\n", lineno, t->name);
+            return -1;
+        }
+    }
+    t->deps = &tok[1];
+    t->ndeps = colon - 1;
+    t->argv = &tok[colon + 1];
+    return 0;
+}
+
+/**
+ * @brief Resolves prerequisite names into successor lists, counts what
+ * every task waits for and gives each task its priority: its own cost
+ * plus the longest chain of costs that depends on it. Running the task
+ * with the longest remaining chain first keeps the critical path moving.
+ *
+ * @return 0 on success, -1 on a duplicate or unknown task or a cycle.
+ */
+static int dag_link(struct dag *d) {
+    size_t n = d->ntasks;
+    size_t edges = 0;
+
+    d->index_size = 16;
+    while (d->index_size < 2 * n) {
+        d->index_size *= 2;
+    }
+    d->index = arena_alloc(&d->arena, d->index_size * sizeof(size_t));
+    memset(d->index, 0xff, d->index_size * sizeof(size_t));
+    for (size_t i = 0; i < n; i++) {
+        size_t *slot = dag_slot(d, d->tasks[i].name);
+        if (*slot != SIZE_MAX) {
+            fprintf(stderr, "dag: %s: defined twice\n", d->tasks[i].name);
+            return -1;
+        }
+        *slot = i;
+    }
+
+    // Count successors first so they all fit in one block.
+    size_t *nsucc = arena_alloc(&d->arena, (n + 1) * sizeof(size_t));
+    memset(nsucc, 0, (n + 1) * sizeof(size_t));
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = 0; j < d->tasks[i].ndeps; j++) {
+            size_t dep = *dag_slot(d, d->tasks[i].deps[j]);
+            if (dep == SIZE_MAX) {
+                fprintf(stderr, "dag: %s: unknown prerequisite %s\n", d->tasks[i].name,
+                        d->tasks[i].deps[j]);
+                return -1;
+            }
+            nsucc[dep]++;
+            edges++;
+        }
+    }
+    size_t *succ = arena_alloc(&d->arena, (edges + 1) * sizeof(size_t));
+    for (size_t i = 0; i < n; i++) {
+        d->tasks[i].succ = succ;
+        succ += nsucc[i];
+    }
+    for (size_t i = 0; i < n; i++) {
+        d->tasks[i].waiting = d->tasks[i].ndeps;
+        for (size_t j = 0; j < d->tasks[i].ndeps; j++) {
+            struct dag_task *dep = &d->tasks[*dag_slot(d, d->tasks[i].deps[j])];
+            dep->succ[dep->nsucc++] = i;
+        }
+    }
+
+    // Kahn's algorithm gives a topological order, tasks left out of it are
+    // on a cycle. nsucc is reused as the queue.
+    size_t *order = nsucc;
+    size_t head = 0, tail = 0;
+    size_t *pending = arena_alloc(&d->arena, (n + 1) * sizeof(size_t));
+    for (size_t i = 0; i < n; i++) {
+        pending[i] = d->tasks[i].waiting;
+        if (pending[i] == 0) {
+            order[tail++] = i;
+        }
+    }
+    while (head < tail) {
+        struct dag_task *t = &d->tasks[order[head++]];
+        for (size_t j = 0; j < t->nsucc; j++) {
+            if (--pending[t->succ[j]] == 0) {
+                order[tail++] = t->succ[j];
+            }
+        }
+    }
+    if (tail < n) {
+        for (size_t i = 0; i < n; i++) {
+            if (pending[i] > 0) {
+                fprintf(stderr, "dag: %s: dependency cycle\n", d->tasks[i].name);
+                break;
+            }
+        }
+        return -1;
+    }
+
+    // Successors come later in the order, so walking it backwards sees
+    // every successor's priority before the task's own.
+    for (size_t k = n; k-- > 0;) {
+        struct dag_task *t = &d->tasks[order[k]];
+        double longest = 0;
+        for (size_t j = 0; j < t->nsucc; j++) {
+            if (d->tasks[t->succ[j]].priority > longest) {
+                longest = d->tasks[t->succ[j]].priority;
+            }
+        }
+        t->priority = t->cost + longest;
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns true if task a should run before task b. Ties go to the
+ * task listed first.
+ */
+static bool dag_before(struct dag *d, size_t a, size_t b) {
+    if (d->tasks[a].priority != d->tasks[b].priority) {
+        return d->tasks[a].priority > d->tasks[b].priority;
+    }
+    return a < b;
+}
+
+/**
+ * @brief Adds a task to the max heap of ready tasks.
+ */
+static void dag_push(struct dag *d, size_t task) {
+    size_t i = d->nheap++;
+    while (i > 0 && dag_before(d, task, d->heap[(i - 1) / 2])) {
+        d->heap[i] = d->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    d->heap[i] = task;
+    d->tasks[task].state = DAG_READY;
+}
+
+/**
+ * @brief Removes the ready task with the highest priority from the heap.
+ */
+static size_t dag_pop(struct dag *d) {
+    size_t top = d->heap[0];
+    size_t last = d->heap[--d->nheap];
+    size_t i = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= d->nheap) {
+            break;
+        }
+        if (child + 1 < d->nheap && dag_before(d, d->heap[child + 1], d->heap[child])) {
+            child++;
+        }
+        if (!dag_before(d, d->heap[child], last)) {
+            break;
+        }
+        d->heap[i] = d->heap[child];
+        i = child;
+    }
+    if (d->nheap > 0) {
+        d->heap[i] = last;
+    }
+    return top;
+}
+
+/**
+ * @brief Records the end of a task, then releases the tasks waiting on it
+ * or, if it failed, stops the run unless keep_going is set.
+ */
+static void dag_finish(struct dag *d, size_t task, int status) {
+    struct dag_task *t = &d->tasks[task];
+    t->status = status;
+    t->state = status == 0 ? DAG_DONE : DAG_FAILED;
+    if (!d->quiet) {
+        fprintf(stderr, "dag: %s exit %d %.3fs\n", t->name, status, dag_now() - t->start);
+    }
+    if (status != 0) {
+        d->failed++;
+        d->stop = d->stop || !d->keep_going;
+        return; // Everything after it stays waiting and is skipped.
+    }
+    for (size_t j = 0; j < t->nsucc; j++) {
+        if (--d->tasks[t->succ[j]].waiting == 0) {
+            dag_push(d, t->succ[j]);
+        }
+    }
+}
+
+/**
+ * @brief Launches a task. The command may be a pipeline, it runs in a
+ * process group of its own and never takes the terminal.
+ */
+static void dag_launch(struct dag *d, size_t task) {
+    struct dag_task *t = &d->tasks[task];
+    struct launch_opts opts = LAUNCH_OPTS_INIT;
+    opts.foreground = false;
+    opts.fd_in = d->fd_in;
+
+    t->start = dag_now();
+    t->state = DAG_RUNNING;
+    size_t nstages;
+    char ***stages = pipeline_split(&d->arena, t->argv, &nstages);
+    if (stages == NULL) {
+        fprintf(stderr, "dag: %s: syntax error near `|'\n", t->name);
+        dag_finish(d, task, 2);
+        return;
+    }
+    pid_t *pids = arena_alloc(&d->arena, nstages * sizeof(pid_t));
+    size_t launched = launch_pipeline(d->sh, stages, nstages, &opts, pids);
+    if (launched < nstages) {
+        bool missing = errno == ENOENT && strchr(stages[launched][0], '/') == NULL;
+        fprintf(stderr, "dag: %s: %s: %s\n", t->name, stages[launched][0],
+                missing ? "command not found" : strerror(errno));
+        t->error = missing ? 127 : 126;
+        if (launched == 0) {
+            dag_finish(d, task, t->error);
+            return;
+        }
+    }
+    t->job = job_add(&d->sh->jobs, pids[0], pids, launched, t->name, false);
+    d->running[d->nrunning++] = task;
+}
+
+/**
+ * @brief Moves finished tasks out of the job table.
+ */
+static void dag_collect(struct dag *d) {
+    for (size_t i = 0; i < d->nrunning;) {
+        struct dag_task *t = &d->tasks[d->running[i]];
+        if (t->job->state != JOB_DONE) {
+            i++;
+            continue;
+        }
+        // A stage that never started fails the task whatever the rest did.
+        int status = t->error ? t->error : t->job->status;
+        job_remove(&d->sh->jobs, t->job);
+        t->job = NULL;
+        size_t task = d->running[i];
+        d->running[i] = d->running[--d->nrunning];
+        dag_finish(d, task, status);
+    }
+}
+
+/**
+ * @brief Runs the graph with at most d->slots tasks at a time.
+ * @return false if the run was interrupted.
+ */
+static bool dag_run(struct dag *d) {
+    d->heap = arena_alloc(&d->arena, (d->ntasks + 1) * sizeof(size_t));
+    d->running = arena_alloc(&d->arena, (d->slots + 1) * sizeof(size_t));
+    for (size_t i = 0; i < d->ntasks; i++) {
+        if (d->tasks[i].waiting == 0) {
+            dag_push(d, i);
+        }
+    }
+
+    d->sh->events.interrupted = false;
+    for (;;) {
+        while (!d->stop && d->nheap > 0 && d->nrunning < d->slots) {
+            dag_launch(d, dag_pop(d));
+        }
+        if (d->nrunning == 0) {
+            if (d->stop || d->nheap == 0) {
+                return true;
+            }
+            continue; // Only tasks that failed to launch ran.
+        }
+        if (jobs_block(d->sh) != 0 || d->sh->events.interrupted) {
+            break;
+        }
+        dag_collect(d);
+    }
+
+    // Interrupted, terminate what is running and wait for it.
+    d->stop = true;
+    for (size_t i = 0; i < d->nrunning; i++) {
+        job_kill(&d->sh->jobs, d->tasks[d->running[i]].job, SIGTERM);
+    }
+    d->sh->events.interrupted = false;
+    while (d->nrunning > 0 && jobs_block(d->sh) == 0) {
+        dag_collect(d);
+    }
+    return false;
+}
+
+/**
+ * @brief Prints the tasks in the order they would be started on one slot
+ * with their priorities, followed by the critical path.
+ */
+static void dag_plan(struct dag *d) {
+    d->heap = arena_alloc(&d->arena, (d->ntasks + 1) * sizeof(size_t));
+    for (size_t i = 0; i < d->ntasks; i++) {
+        if (d->tasks[i].waiting == 0) {
+            dag_push(d, i);
+        }
+    }
+    while (d->nheap > 0) {
+        struct dag_task *t = &d->tasks[dag_pop(d)];
+        printf("%-16s %8.2f ", t->name, t->priority);
+        for (char **arg = t->argv; *arg; arg++) {
+            printf(" %s", *arg);
+        }
+        printf("\n");
+        for (size_t j = 0; j < t->nsucc; j++) {
+            if (--d->tasks[t->succ[j]].waiting == 0) {
+                dag_push(d, t->succ[j]);
+            }
+        }
+    }
+
+    // The critical path starts at the root with the highest priority and
+    // follows the successor with the highest priority.
+    struct dag_task *t = NULL;
+    for (size_t i = 0; i < d->ntasks; i++) {
+        if (d->tasks[i].ndeps == 0 && (t == NULL || d->tasks[i].priority > t->priority)) {
+            t = &d->tasks[i];
+        }
+    }
+    if (t != NULL) {
+        printf("critical path %.2f:", t->priority);
+    }
+    while (t != NULL) {
+        printf(" %s", t->name);
+        struct dag_task *next = NULL;
+        for (size_t j = 0; j < t->nsucc; j++) {
+            struct dag_task *s = &d->tasks[t->succ[j]];
+            if (next == NULL || s->priority > next->priority) {
+                next = s;
+            }
+        }
+        t = next;
+    }
+    printf("\n");
+}
+
+/**
+ * @brief The dag built in command.
+ *
+ * dag [-j N] [-k] [-n] [-q] [file]
+ *
+ * Reads a task graph from file, or standard input, one task per line:
+ *
+ *     name[@cost] [prerequisites...] : command [args...]
+ *
+ * and runs every task once all of its prerequisites have succeeded, with
+ * at most N tasks at a time, the number of online CPUs by default. When
+ * more tasks are ready than there are free slots the one heading the
+ * longest chain of remaining work goes first. A task's cost is 1 unless
+ * given and only matters relative to the others. A command may be a
+ * pipeline.
+ *
+ * By default the first failure stops new tasks from starting and the ones
+ * already running are waited for. -k keeps going with every task that
+ * does not depend on a failed one. -n prints the plan without running
+ * anything, -q only reports the summary.
+ *
+ * @param sh A pointer to the shell structure.
+ * @param argv The command and its arguments, argv[0] is "dag".
+ * @return 0 if every task succeeded, 1 if any failed or was skipped, 2 on
+ * a usage or graph error and 130 if interrupted.
+ */
+int dag_cmd(struct shell *sh, char **argv) {
+    struct dag d;
+    struct line_reader in;
+    bool plan = false;
+    int i = 1;
+
+    memset(&d, 0, sizeof(d));
+    d.sh = sh;
+    d.fd_in = -1;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    d.slots = cpus > 0 ? (size_t)cpus : 1;
+    for (; argv[i] != NULL && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-k") == 0) {
+            d.keep_going = true;
+        } else if (strcmp(argv[i], "-n") == 0) {
+            plan = true;
+        } else if (strcmp(argv[i], "-q") == 0) {
+            d.quiet = true;
+        } else if (strncmp(argv[i], "-j", 2) == 0) {
+            const char *n = argv[i][2] ? argv[i] + 2 : argv[++i];
+            if (n == NULL || atoi(n) <= 0) {
+                break;
+            }
+            d.slots = (size_t)atoi(n);
+        } else {
+            break;
+        }
+    }
+    if (argv[i] != NULL && (argv[i][0] == '-' || argv[i + 1] != NULL)) {
+        fprintf(stderr, "dag: usage: dag [-j N] [-k] [-n] [-q] [file]\n");
+        return 2;
+    }
+
+    const char *file = argv[i];
+    if ((file ? reader_open_file(&in, file) : reader_open_fd(&in, STDIN_FILENO)) != 0) {
+        fprintf(stderr, "dag: %s: %s\n", file ? file : "stdin", strerror(errno));
+        return 2;
+    }
+    arena_init(&d.arena, 0);
+    int rval = 0;
+    char *line;
+    for (size_t lineno = 1; rval == 0 && (line = reader_next(&in)) != NULL; lineno++) {
+        rval = dag_parse_line(&d, line, lineno);
+    }
+    reader_close(&in);
+    if (rval == 0 && dag_link(&d) != 0) {
+        rval = -1;
+    }
+
+    if (rval != 0) {
+        rval = 2;
+    } else if (plan) {
+        dag_plan(&d);
+        fflush(stdout);
+    } else {
+        // Tasks must not read the graph they come from.
+        if (file == NULL) {
+            d.fd_in = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        }
+        fflush(stdout);
+        double start = dag_now();
+        bool finished = dag_run(&d);
+        size_t done = 0;
+        for (size_t k = 0; k < d.ntasks; k++) {
+            done += d.tasks[k].state == DAG_DONE;
+        }
+        size_t skipped = d.ntasks - done - d.failed;
+        fprintf(stderr, "dag: %zu tasks, %zu failed, %zu skipped, %.3fs wall\n", d.ntasks,
+                d.failed, skipped, dag_now() - start);
+        rval = !finished ? 128 + SIGINT : done < d.ntasks ? 1 : 0;
+        if (d.fd_in >= 0) {
+            close(d.fd_in);
+        }
+    }
+    free(d.tasks);
+    arena_destroy(&d.arena);
+    return rval;
+}
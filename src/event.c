@@ -0,0 +1,267 @@
+#define _GNU_SOURCE
+#include "lab.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/pidfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <readline/readline.h>
+
+/* Most events handled per epoll_wait call. */
+#define EVENT_BATCH 64
+
+/**
+ * @brief Packs an event kind and an optional pid into epoll data.
+ */
+static uint64_t event_data(enum event_kind kind, pid_t pid) {
+    return (uint64_t)kind << 32 | (uint32_t)pid;
+}
+
+/**
+ * @brief Adds fd to the epoll set.
+ * @return 0 on success, -1 with errno set on failure.
+ */
+static int event_add(int epfd, int fd, uint32_t events, enum event_kind kind) {
+    struct epoll_event ev = {.events = events, .data.u64 = event_data(kind, 0)};
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/**
+ * @brief Checks if this kernel can hand out pidfds.
+ */
+static bool event_has_pidfd(void) {
+    int fd = pidfd_open(getpid(), 0);
+    if (fd < 0) {
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+/**
+ * @brief Creates the event loop.
+ *
+ * Every source is a file descriptor, so the only place the shell ever
+ * waits is epoll_wait. SIGINT and SIGWINCH are blocked and read from a
+ * signalfd, readline is told not to catch signals itself, so no signal
+ * handler runs in the middle of readline or job table updates.
+ *
+ * @param sh A pointer to the shell structure.
+ * @return 0 on success, -1 with errno set on failure.
+ */
+int event_init(struct shell *sh) {
+    struct event_loop *ev = &sh->events;
+
+    memset(ev, 0, sizeof(*ev));
+    ev->sigfd = -1;
+    ev->timerfd = -1;
+    ev->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (ev->epfd < 0) {
+        return -1;
+    }
+
+    // Children exit through their pidfds from now on.
+    if (sh->jobs.sigfd >= 0) {
+        event_add(ev->epfd, sh->jobs.sigfd, EPOLLIN, EVENT_SIGCHLD);
+        if (event_has_pidfd()) {
+            sh->jobs.epfd = ev->epfd;
+        }
+    }
+
+    // MY_TMOUT logs an idle interactive shell out after that many seconds.
+    const char *tmout = getenv("MY_TMOUT");
+    ev->idle_timeout = tmout ? atoi(tmout) : 0;
+
+    if (sh->shell_is_interactive) {
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGINT);
+        sigaddset(&mask, SIGWINCH);
+        sigprocmask(SIG_BLOCK, &mask, NULL);
+        // A signal that is ignored is never queued, SIGINT must have its
+        // default action to reach the signalfd. It is blocked so the
+        // default action never runs.
+        signal(SIGINT, SIG_DFL);
+        ev->sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (ev->sigfd >= 0) {
+            event_add(ev->epfd, ev->sigfd, EPOLLIN, EVENT_SIGNAL);
+        }
+        rl_catch_signals = 0;
+        rl_catch_sigwinch = 0;
+
+        ev->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (ev->timerfd >= 0) {
+            event_add(ev->epfd, ev->timerfd, EPOLLIN, EVENT_TIMER);
+        }
+        // The terminal starts disabled, event_prompt turns it on.
+        event_add(ev->epfd, sh->shell_terminal, 0, EVENT_TERMINAL);
+    }
+    return 0;
+}
+
+/**
+ * @brief Closes the event loop. Children keep their pidfds until they are
+ * reaped or the job table is destroyed.
+ *
+ * @param sh A pointer to the shell structure.
+ */
+void event_destroy(struct shell *sh) {
+    struct event_loop *ev = &sh->events;
+
+    if (ev->epfd <= 0) {
+        return; // Never initialized.
+    }
+    if (sh->jobs.epfd == ev->epfd) {
+        sh->jobs.epfd = -1;
+    }
+    if (ev->sigfd >= 0) {
+        close(ev->sigfd);
+    }
+    if (ev->timerfd >= 0) {
+        close(ev->timerfd);
+    }
+    close(ev->epfd);
+    ev->epfd = -1;
+    ev->sigfd = -1;
+    ev->timerfd = -1;
+}
+
+/**
+ * @brief Turns terminal input and the idle timer on when the prompt is
+ * shown and off while a command runs. The terminal must be off while a
+ * foreground job owns it, otherwise its input would wake the shell.
+ *
+ * @param sh A pointer to the shell structure.
+ * @param on true when the prompt is shown.
+ */
+void event_prompt(struct shell *sh, bool on) {
+    struct event_loop *ev = &sh->events;
+
+    if (ev->epfd <= 0 || !sh->shell_is_interactive || ev->at_prompt == on) {
+        return;
+    }
+    ev->at_prompt = on;
+    struct epoll_event e = {.events = on ? EPOLLIN : 0,
+                            .data.u64 = event_data(EVENT_TERMINAL, 0)};
+    epoll_ctl(ev->epfd, EPOLL_CTL_MOD, sh->shell_terminal, &e);
+
+    if (ev->timerfd >= 0 && ev->idle_timeout > 0) {
+        struct itimerspec its = {0};
+        its.it_value.tv_sec = on ? ev->idle_timeout : 0;
+        timerfd_settime(ev->timerfd, 0, &its, NULL);
+    }
+}
+
+/**
+ * @brief Handles SIGINT and SIGWINCH. An interrupt at the prompt throws the
+ * line away, anywhere else it asks the running builtin to stop.
+ */
+static void event_signal(struct shell *sh) {
+    struct event_loop *ev = &sh->events;
+    struct signalfd_siginfo info;
+
+    while (read(ev->sigfd, &info, sizeof(info)) == sizeof(info)) {
+        ev->signal_events++;
+        if (info.ssi_signo == SIGWINCH) {
+            if (ev->at_prompt) {
+                rl_resize_terminal();
+            } else {
+                rl_reset_screen_size();
+            }
+        } else if (info.ssi_signo == SIGINT) {
+            sh->last_status = 128 + SIGINT;
+            if (ev->at_prompt) {
+                isearch_abort();
+                hist_nav_abort();
+                rl_free_line_state();
+                rl_callback_sigcleanup();
+                printf("\n");
+                rl_on_new_line();
+                rl_replace_line("", 0);
+                rl_redisplay();
+            } else {
+                ev->interrupted = true;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Handles the idle timer, which only runs at the prompt.
+ */
+static void event_timer(struct shell *sh) {
+    struct event_loop *ev = &sh->events;
+    uint64_t expirations;
+
+    if (read(ev->timerfd, &expirations, sizeof(expirations)) <= 0 || !ev->at_prompt) {
+        return;
+    }
+    ev->timer_events++;
+    ev->timed_out = true;
+    ev->quit = true;
+    rl_clear_visible_line();
+    fprintf(stderr, "timed out waiting for input: auto-logout\n");
+}
+
+/**
+ * @brief Waits for events and dispatches them.
+ *
+ * A readable pidfd means that process exited and it is reaped by pid, so
+ * the shell never scans its children to find out which one finished.
+ * Finished background jobs are reported straight away when the prompt is
+ * showing and the prompt is drawn again below the report.
+ *
+ * @param sh A pointer to the shell structure.
+ * @param timeout Milliseconds to wait, -1 blocks and 0 polls.
+ * @return The number of events dispatched, -1 on error.
+ */
+int event_wait(struct shell *sh, int timeout) {
+    struct event_loop *ev = &sh->events;
+    struct epoll_event events[EVENT_BATCH];
+
+    int n = epoll_wait(ev->epfd, events, EVENT_BATCH, timeout);
+    if (n < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    ev->wakeups++;
+    for (int i = 0; i < n; i++) {
+        enum event_kind kind = (enum event_kind)(events[i].data.u64 >> 32);
+        pid_t pid = (pid_t)(uint32_t)events[i].data.u64;
+        switch (kind) {
+        case EVENT_TERMINAL:
+            if (ev->at_prompt) {
+                ev->tty_events++;
+                rl_callback_read_char();
+            }
+            break;
+        case EVENT_CHILD:
+            ev->child_events++;
+            job_reap_pid(&sh->jobs, pid);
+            break;
+        case EVENT_SIGCHLD:
+            jobs_reap(&sh->jobs);
+            break;
+        case EVENT_SIGNAL:
+            event_signal(sh);
+            break;
+        case EVENT_TIMER:
+            event_timer(sh);
+            break;
+        }
+    }
+
+    if (ev->at_prompt && sh->jobs.done_head != NULL && !ev->quit) {
+        // Keep terminal input out of the nested poll in jobs_notify.
+        ev->at_prompt = false;
+        rl_clear_visible_line();
+        jobs_notify(sh);
+        rl_on_new_line();
+        rl_redisplay();
+        ev->at_prompt = true;
+    }
+    return n;
+}
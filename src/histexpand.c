@@ -0,0 +1,189 @@
+#define _GNU_SOURCE
+#include "lab.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+/**
+ * @brief The line being expanded, built up in the shell's arena. A buffer
+ * that fills up is left behind for one twice its size, which the arena
+ * gets back with everything else when the line is done.
+ */
+struct expansion {
+    struct arena *arena;
+    char *buf;
+    size_t len;
+    size_t cap;
+};
+
+/**
+ * @brief Appends n bytes of s to the expansion.
+ */
+static void expansion_add(struct expansion *x, const char *s, size_t n) {
+    if (x->len + n + 1 > x->cap) {
+        size_t cap = x->cap ? x->cap : 256;
+        while (x->len + n + 1 > cap) {
+            cap *= 2;
+        }
+        char *buf = arena_alloc(x->arena, cap);
+        if (x->len > 0) {
+            memcpy(buf, x->buf, x->len);
+        }
+        x->buf = buf;
+        x->cap = cap;
+    }
+    memcpy(x->buf + x->len, s, n);
+    x->len += n;
+    x->buf[x->len] = '\0';
+}
+
+/**
+ * @brief Finds the nth live entry back from the newest one in the ring.
+ * @return The command with its position in pos, or NULL.
+ */
+static const char *ring_back(struct hist_ring *r, size_t n, size_t *pos) {
+    for (size_t i = r->count; n > 0 && i-- > 0;) {
+        const char *line = hist_ring_get(r, i);
+        if (line != NULL && --n == 0) {
+            *pos = i;
+            return line;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Finds the latest command starting with the len bytes at prefix,
+ * in the ring first and then, for older commands, in the history file
+ * through its trigram index.
+ * @return The command, with its ring position in pos if it came from the
+ * ring, or NULL.
+ */
+static const char *hist_find_prefix(struct shell *sh, const char *prefix, size_t len,
+                                    size_t *pos) {
+    struct hist_ring *r = &sh->recent;
+    for (size_t i = r->count; i-- > 0;) {
+        const char *line = hist_ring_get(r, i);
+        if (line != NULL && strncmp(line, prefix, len) == 0) {
+            *pos = i;
+            return line;
+        }
+    }
+    if (sh->history.path == NULL) {
+        return NULL;
+    }
+    char *q = arena_alloc(&sh->arena, len + 1);
+    memcpy(q, prefix, len);
+    q[len] = '\0';
+    size_t before = SIZE_MAX, id;
+    while (hist_search(&sh->history, q, before, &id, 1) == 1) {
+        struct hist_entry e;
+        before = id;
+        if (hist_get(&sh->history, id, &e) && strncmp(e.cmd, q, len) == 0) {
+            return e.cmd;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Resolves the event designator after a '!'.
+ *
+ * @param sh The shell.
+ * @param s The designator, just past the '!'.
+ * @param len Set to the length of the designator.
+ * @param pos Set to the ring position of the entry, SIZE_MAX if it is not
+ * from the ring.
+ * @return The command, or NULL if there is no such event.
+ */
+static const char *hist_event(struct shell *sh, const char *s, size_t *len, size_t *pos) {
+    char *end;
+
+    *pos = SIZE_MAX;
+    if (*s == '!') {
+        *len = 1;
+        return ring_back(&sh->recent, 1, pos);
+    }
+    if (*s == '-' && isdigit((unsigned char)s[1])) {
+        size_t n = strtoul(s + 1, &end, 10);
+        *len = end - s;
+        return ring_back(&sh->recent, n, pos);
+    }
+    if (isdigit((unsigned char)*s)) {
+        size_t n = strtoul(s, &end, 10);
+        *len = end - s;
+        if (n == 0) {
+            return NULL;
+        }
+        // Numbered the way history lists them.
+        if (sh->history.path != NULL) {
+            struct hist_entry e;
+            hist_refresh(&sh->history);
+            return hist_get(&sh->history, n - 1, &e) ? e.cmd : NULL;
+        }
+        const char *line = hist_ring_get(&sh->recent, n - 1);
+        if (line != NULL) {
+            *pos = n - 1;
+        }
+        return line;
+    }
+    *len = strcspn(s, " \t");
+    return hist_find_prefix(sh, s, *len, pos);
+}
+
+/**
+ * @brief Expands history references in a line.
+ *
+ * A '!' starts a reference unless it is followed by a blank, '=', '(' or
+ * the end of the line. "!!" is the previous command, "!n" entry n as
+ * history numbers them, "!-n" the nth previous command and "!prefix" the
+ * latest command starting with prefix. Relative references and prefixes
+ * look at the history ring, prefixes then fall back to the history file.
+ *
+ * When the whole line is one reference to a ring entry, which is how a
+ * command is usually replayed, the entry's cached parse is handed back in
+ * argv so the command runs without being tokenized again.
+ *
+ * @param sh The shell.
+ * @param line A trimmed line.
+ * @param argv Set to the parsed line for a whole line reference to the
+ * ring, NULL otherwise.
+ * @return line itself if it holds no references, the expansion from the
+ * shell's arena, or NULL after printing an error if a reference has no
+ * event.
+ */
+char *hist_expand(struct shell *sh, char *line, char ***argv) {
+    struct expansion x = {&sh->arena, NULL, 0, 0};
+    const char *s = line;
+    const char *bang;
+    bool expanded = false;
+
+    *argv = NULL;
+    while ((bang = strchr(s, '!')) != NULL) {
+        if (strchr(" \t=(", bang[1]) != NULL) { // Also matches the NUL.
+            expansion_add(&x, s, bang + 1 - s);
+            s = bang + 1;
+            continue;
+        }
+        size_t len, pos;
+        const char *cmd = hist_event(sh, bang + 1, &len, &pos);
+        if (cmd == NULL) {
+            fprintf(stderr, "%.*s: event not found\n", (int)len + 1, bang);
+            return NULL;
+        }
+        if (bang == line && bang[len + 1] == '\0' && pos != SIZE_MAX) {
+            *argv = hist_ring_argv(&sh->recent, pos, &sh->arena);
+            return arena_strdup(&sh->arena, cmd);
+        }
+        expansion_add(&x, s, bang - s);
+        expansion_add(&x, cmd, strlen(cmd));
+        s = bang + 1 + len;
+        expanded = true;
+    }
+    if (!expanded) {
+        return line;
+    }
+    expansion_add(&x, s, strlen(s));
+    return x.buf;
+}
@@ -0,0 +1,264 @@
+#define _GNU_SOURCE
+#include "lab.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+/* Initial number of trigram slots, must be a power of two. */
+#define TRI_MIN 4096
+
+/**
+ * @brief Packs the three bytes at s into a trigram key. Commands never
+ * contain NUL, so a key is never 0, which marks an empty slot.
+ */
+static uint32_t tri_key(const char *s) {
+    const unsigned char *u = (const unsigned char *)s;
+    return (uint32_t)u[0] << 16 | (uint32_t)u[1] << 8 | u[2];
+}
+
+/**
+ * @brief Spreads a trigram key over the table with a golden ratio
+ * multiply, folding the high bits in so the low bits used as the index
+ * depend on every byte.
+ */
+static size_t tri_hash(uint32_t key) {
+    uint64_t h = key * 0x9E3779B97F4A7C15ULL;
+    return (size_t)(h ^ (h >> 29));
+}
+
+/**
+ * @brief Finds the slot for key, either the one holding it or the empty
+ * slot where it would go.
+ */
+static struct tri_list *tri_slot(struct tri_index *idx, uint32_t key) {
+    size_t mask = idx->size - 1;
+    size_t i = tri_hash(key) & mask;
+    while (idx->table[i].key != 0 && idx->table[i].key != key) {
+        i = (i + 1) & mask;
+    }
+    return &idx->table[i];
+}
+
+/**
+ * @brief Doubles the table (or creates it) and moves every list over.
+ * @return 0 on success, -1 if the allocation failed.
+ */
+static int tri_grow(struct tri_index *idx) {
+    size_t old_size = idx->size;
+    struct tri_list *old = idx->table;
+    size_t size = old_size ? old_size * 2 : TRI_MIN;
+
+    struct tri_list *table = calloc(size, sizeof(*table));
+    if (table == NULL) {
+        return -1;
+    }
+    idx->table = table;
+    idx->size = size;
+    for (size_t i = 0; i < old_size; i++) {
+        if (old[i].key != 0) {
+            *tri_slot(idx, old[i].key) = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+/**
+ * @brief Records that entry id contains the trigram key. Entries are added
+ * in increasing order so every list stays sorted, and an entry holding
+ * the same trigram twice only goes in once.
+ * @return 0 on success, -1 if an allocation failed.
+ */
+static int tri_add(struct tri_index *idx, uint32_t key, uint32_t id) {
+    if (idx->size == 0 && tri_grow(idx) != 0) {
+        return -1;
+    }
+    struct tri_list *list = tri_slot(idx, key);
+    if (list->key == 0) {
+        // Keep the load under one half so probes stay short.
+        if ((idx->used + 1) * 2 > idx->size) {
+            if (tri_grow(idx) != 0) {
+                return -1;
+            }
+            list = tri_slot(idx, key);
+        }
+        list->key = key;
+        idx->used++;
+    }
+    if (list->count > 0 && list->ids[list->count - 1] == id) {
+        return 0;
+    }
+    if (list->count == list->cap) {
+        uint32_t cap = list->cap ? list->cap * 2 : 4;
+        uint32_t *ids = realloc(list->ids, cap * sizeof(*ids));
+        if (ids == NULL) {
+            return -1;
+        }
+        list->ids = ids;
+        list->cap = cap;
+    }
+    list->ids[list->count++] = id;
+    return 0;
+}
+
+/**
+ * @brief Frees the trigram index of a history file.
+ *
+ * @param idx The index.
+ */
+void hist_index_destroy(struct tri_index *idx) {
+    for (size_t i = 0; i < idx->size; i++) {
+        free(idx->table[i].ids);
+    }
+    free(idx->table);
+    memset(idx, 0, sizeof(*idx));
+}
+
+/**
+ * @brief Adds the entries appended since the last update to the trigram
+ * index. The index is only ever extended, so keeping it current costs
+ * time proportional to the new commands, not the whole history.
+ *
+ * @param h The store.
+ * @return The number of entries.
+ */
+size_t hist_index_update(struct hist_store *h) {
+    struct tri_index *idx = &h->index;
+    size_t count = hist_refresh(h);
+
+    for (; idx->indexed < count; idx->indexed++) {
+        struct hist_entry e;
+        if (!hist_get(h, idx->indexed, &e)) {
+            continue;
+        }
+        for (size_t i = 0; i + 3 <= e.cmd_len; i++) {
+            if (tri_add(idx, tri_key(e.cmd + i), (uint32_t)idx->indexed) != 0) {
+                return idx->indexed; // Out of memory, search what we have.
+            }
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Moves the end of a posting list's window down to just past the
+ * largest id not above target, galloping back from the current end so a
+ * long skip costs a logarithmic number of probes.
+ *
+ * @param list The posting list.
+ * @param end The window end, updated.
+ * @param target The id to look for.
+ * @return The largest id not above target, or UINT32_MAX if there is none.
+ */
+static uint32_t tri_seek(const struct tri_list *list, size_t *end, uint32_t target) {
+    size_t hi = *end;
+    size_t step = 1;
+    while (step <= hi && list->ids[hi - step] > target) {
+        step *= 2;
+    }
+    // The answer lies in [lo, hi - step / 2).
+    size_t lo = step <= hi ? hi - step : 0;
+    hi -= step / 2;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (list->ids[mid] <= target) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *end = lo;
+    return lo > 0 ? list->ids[lo - 1] : UINT32_MAX;
+}
+
+/**
+ * @brief Checks if entry id's command contains q.
+ */
+static bool hist_matches(struct hist_store *h, size_t id, const char *q, size_t qlen) {
+    struct hist_entry e;
+    return hist_get(h, id, &e) && memmem(e.cmd, e.cmd_len, q, qlen) != NULL;
+}
+
+/**
+ * @brief Finds history entries containing q, newest first.
+ *
+ * A query of three or more bytes only looks at entries holding every one
+ * of its trigrams, found by intersecting their posting lists from the
+ * newest end with galloping seeks, so the cost depends on how rare the
+ * query is rather than on the size of the history. Each candidate is then
+ * confirmed with memmem since holding the trigrams does not mean holding
+ * the string. Shorter queries scan the entries.
+ *
+ * @param h The store, its index is brought up to date first.
+ * @param q The string to look for.
+ * @param before Only entries numbered below this are searched.
+ * @param ids Receives the matching entries, newest first.
+ * @param max The size of ids.
+ * @return The number of matches stored in ids.
+ */
+size_t hist_search(struct hist_store *h, const char *q, size_t before, size_t *ids,
+                   size_t max) {
+    size_t qlen = strlen(q);
+    size_t found = 0;
+
+    hist_index_update(h);
+    if (before > h->index.indexed) {
+        before = h->index.indexed;
+    }
+    if (qlen < 3 || h->index.size == 0) {
+        for (size_t id = before; id-- > 0 && found < max;) {
+            if (hist_matches(h, id, q, qlen)) {
+                ids[found++] = id;
+            }
+        }
+        return found;
+    }
+
+    size_t nlists = qlen - 2;
+    struct tri_list **lists = malloc(nlists * sizeof(*lists));
+    if (lists == NULL) {
+        return 0;
+    }
+    size_t *ends = malloc(nlists * sizeof(*ends));
+    if (ends == NULL) {
+        free(lists);
+        return 0;
+    }
+    for (size_t i = 0; i < nlists; i++) {
+        lists[i] = tri_slot(&h->index, tri_key(q + i));
+        ends[i] = lists[i]->count;
+        if (lists[i]->key == 0) {
+            before = 0; // Some trigram appears nowhere.
+        }
+    }
+
+    // Walk the lists down together. Whichever list has no id at the
+    // candidate names the next candidate below it, so long runs of ids
+    // missing from the rarest list are skipped in one seek.
+    size_t agree = 0;
+    uint32_t cand = before > 0 ? (uint32_t)(before - 1) : 0;
+    for (size_t i = 0; before > 0 && found < max; i = (i + 1) % nlists) {
+        uint32_t id = tri_seek(lists[i], &ends[i], cand);
+        if (id == UINT32_MAX) {
+            break;
+        }
+        if (id < cand) {
+            cand = id;
+            agree = 0;
+        }
+        if (++agree == nlists) {
+            if (hist_matches(h, cand, q, qlen)) {
+                ids[found++] = cand;
+            }
+            if (cand == 0) {
+                break;
+            }
+            cand--;
+            agree = 0;
+        }
+    }
+    free(ends);
+    free(lists);
+    return found;
+}
@@ -0,0 +1,622 @@
+#define _GNU_SOURCE
+#include "lab.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Marks the start of every record, "HST1" read as a little endian word. */
+#define HIST_MAGIC 0x31545348u
+
+/* Records start on and are padded to this boundary. */
+#define HIST_ALIGN 8
+
+/* Default history file under $HOME. */
+#define HIST_FILE ".deeshell_history"
+
+/* Commands kept in the history ring for the arrow keys, MY_HISTSIZE. */
+#define HIST_SIZE 1000
+
+/**
+ * @brief The fixed part of a history record. It is followed by the working
+ * directory and the command, each NUL terminated, padding up to
+ * HIST_ALIGN and finally a copy of size in the last four bytes so the file
+ * can be walked backwards from its end.
+ */
+struct hist_record {
+    uint32_t magic;
+    uint32_t size;
+    int64_t time;
+    int64_t duration;
+    int32_t status;
+    uint32_t cwd_len;
+    uint32_t cmd_len;
+    uint32_t flags; // Reserved, 0 for now. Keeps the size a multiple of 8.
+};
+
+#define HIST_HEADER sizeof(struct hist_record)
+
+/**
+ * @brief Returns the wall clock time in microseconds since the epoch.
+ */
+int64_t hist_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Checks the record at p and fills in e.
+ *
+ * @param p The start of the record.
+ * @param avail The number of mapped bytes from p onwards.
+ * @param e Receives the fields, may be NULL.
+ * @return The size of the record, 0 if p does not hold a valid record or
+ * the record is not complete yet.
+ */
+static size_t hist_decode(const char *p, size_t avail, struct hist_entry *e) {
+    struct hist_record rec;
+    uint32_t trailer;
+
+    if (avail < HIST_HEADER) {
+        return 0;
+    }
+    memcpy(&rec, p, HIST_HEADER);
+    if (rec.magic != HIST_MAGIC || rec.size % HIST_ALIGN != 0 || rec.size > avail ||
+        HIST_HEADER + (size_t)rec.cwd_len + rec.cmd_len + 2 + sizeof(trailer) > rec.size) {
+        return 0;
+    }
+    memcpy(&trailer, p + rec.size - sizeof(trailer), sizeof(trailer));
+    if (trailer != rec.size) {
+        return 0;
+    }
+    if (e != NULL) {
+        e->time = rec.time;
+        e->duration = rec.duration;
+        e->status = rec.status;
+        e->cwd = p + HIST_HEADER;
+        e->cmd = e->cwd + rec.cwd_len + 1;
+        e->cmd_len = rec.cmd_len;
+    }
+    return rec.size;
+}
+
+/**
+ * @brief Maps the whole file again if it has grown, by our own appends or
+ * another shell's.
+ * @return 0 on success, -1 with errno set on failure.
+ */
+static int hist_remap(struct hist_store *h) {
+    struct stat st;
+    if (fstat(h->fd, &st) != 0) {
+        return -1;
+    }
+    if ((size_t)st.st_size <= h->map_size) {
+        return 0;
+    }
+    void *map;
+    if (h->map != NULL) {
+        map = mremap((void *)h->map, h->map_size, st.st_size, MREMAP_MAYMOVE);
+    } else {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, h->fd, 0);
+    }
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    h->map = map;
+    h->map_size = st.st_size;
+    return 0;
+}
+
+/**
+ * @brief Opens the history file, creating it if needed, and maps it.
+ *
+ * Nothing is read yet, entries are only indexed the first time one is
+ * looked up by number, so opening a file of a million entries costs the
+ * same as opening an empty one.
+ *
+ * @param h The store.
+ * @param path The history file.
+ * @return 0 on success, -1 with errno set on failure.
+ */
+int hist_open(struct hist_store *h, const char *path) {
+    memset(h, 0, sizeof(*h));
+    h->fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (h->fd < 0) {
+        return -1;
+    }
+    if (hist_remap(h) != 0) {
+        int err = errno;
+        close(h->fd);
+        errno = err;
+        return -1;
+    }
+    h->path = strdup(path);
+    return 0;
+}
+
+/**
+ * @brief Unmaps and closes the history file and frees the index.
+ *
+ * @param h The store, does nothing if it was never opened.
+ */
+void hist_close(struct hist_store *h) {
+    if (h->path == NULL) {
+        return;
+    }
+    if (h->map != NULL) {
+        munmap((void *)h->map, h->map_size);
+    }
+    close(h->fd);
+    hist_index_destroy(&h->index);
+    free(h->offsets);
+    free(h->path);
+    memset(h, 0, sizeof(*h));
+    h->fd = -1;
+}
+
+/**
+ * @brief Appends one command to the history file.
+ *
+ * The record is built in memory and written with a single write() on an
+ * O_APPEND descriptor, so records from shells sharing the file never
+ * interleave and the file can be read while it is being written.
+ *
+ * @param h The store.
+ * @param cmd The command line.
+ * @param cwd The directory it ran in.
+ * @param time When it started, microseconds since the epoch.
+ * @param duration How long it ran in microseconds.
+ * @param status Its exit status.
+ * @return 0 on success, -1 with errno set on failure.
+ */
+int hist_append(struct hist_store *h, const char *cmd, const char *cwd, int64_t time,
+                int64_t duration, int status) {
+    char small[512];
+    struct hist_record rec;
+
+    if (h->path == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+    rec.magic = HIST_MAGIC;
+    rec.time = time;
+    rec.duration = duration;
+    rec.status = status;
+    rec.cwd_len = strlen(cwd);
+    rec.cmd_len = strlen(cmd);
+    rec.flags = 0;
+    size_t size = HIST_HEADER + rec.cwd_len + rec.cmd_len + 2 + sizeof(uint32_t);
+    size = (size + HIST_ALIGN - 1) & ~(size_t)(HIST_ALIGN - 1);
+    rec.size = size;
+
+    char *buf = size <= sizeof(small) ? small : malloc(size);
+    if (buf == NULL) {
+        return -1;
+    }
+    memset(buf, 0, size);
+    memcpy(buf, &rec, HIST_HEADER);
+    memcpy(buf + HIST_HEADER, cwd, rec.cwd_len + 1);
+    memcpy(buf + HIST_HEADER + rec.cwd_len + 1, cmd, rec.cmd_len + 1);
+    memcpy(buf + size - sizeof(uint32_t), &rec.size, sizeof(uint32_t));
+    ssize_t n = write(h->fd, buf, size);
+    int err = errno;
+    if (buf != small) {
+        free(buf);
+    }
+    if (n != (ssize_t)size) {
+        errno = n < 0 ? err : EIO;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Brings the index up to date with the file. Only the part of the
+ * file not indexed yet is scanned. A damaged record is skipped by looking
+ * for the next valid record byte by byte, a record that is still being written is left
+ * for the next refresh.
+ *
+ * @param h The store.
+ * @return The number of entries.
+ */
+size_t hist_refresh(struct hist_store *h) {
+    if (h->path == NULL || hist_remap(h) != 0) {
+        return h->count;
+    }
+    while (h->scanned + HIST_HEADER <= h->map_size) {
+        size_t avail = h->map_size - h->scanned;
+        size_t size = hist_decode(h->map + h->scanned, avail, NULL);
+        if (size == 0) {
+            struct hist_record rec;
+            memcpy(&rec, h->map + h->scanned, HIST_HEADER);
+            if (rec.magic == HIST_MAGIC && rec.size > avail && rec.size % HIST_ALIGN == 0) {
+                break; // Not all of it has arrived yet.
+            }
+            h->scanned++; // A torn write can leave any number of bytes.
+            continue;
+        }
+        if (h->count == h->cap) {
+            size_t cap = h->cap ? h->cap * 2 : 1024;
+            size_t *offsets = realloc(h->offsets, cap * sizeof(*offsets));
+            if (offsets == NULL) {
+                break;
+            }
+            h->offsets = offsets;
+            h->cap = cap;
+        }
+        h->offsets[h->count++] = h->scanned;
+        h->scanned += size;
+    }
+    return h->count;
+}
+
+/**
+ * @brief Looks up an entry by number. The strings point into the mapping
+ * and stay valid until the next hist_refresh.
+ *
+ * @param h The store.
+ * @param n The entry, counting from 0 for the oldest.
+ * @param e Receives the entry.
+ * @return true if the entry exists.
+ */
+bool hist_get(struct hist_store *h, size_t n, struct hist_entry *e) {
+    if (n >= h->count) {
+        return false;
+    }
+    size_t off = h->offsets[n];
+    return hist_decode(h->map + off, h->map_size - off, e) != 0;
+}
+
+/**
+ * @brief Puts the most recent commands in the history ring so the arrow
+ * keys reach back into earlier sessions. The file is walked backwards
+ * through the size copies at the end of each record, so only the records
+ * loaded are touched and the index is not built.
+ *
+ * @param h The store.
+ * @param r The ring, filled up to its size.
+ */
+static void hist_load_recent(struct hist_store *h, struct hist_ring *r) {
+    size_t start = h->map_size;
+    size_t n = 0;
+    while (n < r->cap && start >= HIST_HEADER + sizeof(uint32_t)) {
+        uint32_t size;
+        memcpy(&size, h->map + start - sizeof(size), sizeof(size));
+        if (size > start || hist_decode(h->map + start - size, size, NULL) != size) {
+            break;
+        }
+        start -= size;
+        n++;
+    }
+    while (start < h->map_size) {
+        struct hist_entry e;
+        size_t size = hist_decode(h->map + start, h->map_size - start, &e);
+        if (size == 0) {
+            break;
+        }
+        hist_ring_add(r, e.cmd);
+        start += size;
+    }
+}
+
+/**
+ * @brief Reads MY_HISTCONTROL, a colon separated list in the style of
+ * bash's HISTCONTROL. erasedups wins over ignoredups.
+ */
+static enum hist_dups hist_control(void) {
+    const char *control = getenv("MY_HISTCONTROL");
+    enum hist_dups dups = HIST_DUPS_KEEP;
+    while (control != NULL && *control != '\0') {
+        size_t len = strcspn(control, ":");
+        if (len == 9 && strncmp(control, "erasedups", len) == 0) {
+            dups = HIST_DUPS_ERASE;
+        } else if (len == 10 && dups == HIST_DUPS_KEEP &&
+                   (strncmp(control, "ignoredups", len) == 0 ||
+                    strncmp(control, "ignoreboth", len) == 0)) {
+            dups = HIST_DUPS_IGNORE;
+        }
+        control += len + (control[len] == ':');
+    }
+    return dups;
+}
+
+/**
+ * @brief Sets up the history of an interactive shell.
+ *
+ * The arrow keys walk a ring of the latest MY_HISTSIZE commands, 1000 by
+ * default, with duplicates handled as MY_HISTCONTROL says. The history
+ * file is MY_HISTFILE, or ~/.deeshell_history when it is not set. An
+ * empty MY_HISTFILE turns the history file off. The ring starts out with
+ * the latest commands of the file and Ctrl+R searches the whole file
+ * through its trigram index.
+ *
+ * @param sh A pointer to the shell structure.
+ * @return 0 on success or if the history file is off, -1 with errno set
+ * if it could not be opened.
+ */
+int hist_init(struct shell *sh) {
+    const char *size = getenv("MY_HISTSIZE");
+    const char *file = getenv("MY_HISTFILE");
+    char *path = NULL;
+
+    sh->history.fd = -1;
+    if (hist_ring_init(&sh->recent, size ? strtoul(size, NULL, 10) : HIST_SIZE,
+                       hist_control()) != 0) {
+        return -1;
+    }
+    hist_nav_init(&sh->recent);
+    if (file == NULL) {
+        const char *home = getenv("HOME");
+        if (home != NULL && asprintf(&path, "%s/%s", home, HIST_FILE) >= 0) {
+            file = path;
+        }
+    }
+    int rval = 0;
+    if (file != NULL && *file != '\0') {
+        rval = hist_open(&sh->history, file);
+        if (rval == 0) {
+            hist_load_recent(&sh->history, &sh->recent);
+        }
+    }
+    isearch_init(sh->history.path ? &sh->history : NULL, &sh->recent);
+    free(path);
+    return rval;
+}
+
+/**
+ * @brief Which entries history lists and how. Entries are numbered from
+ * 0 here and from 1 on output.
+ */
+struct hist_listing {
+    struct writer *w;
+    size_t first; // First entry in the range.
+    size_t end;   // One past the last entry in the range.
+    size_t last;  // Only the last this many, 0 for all.
+    bool lng;
+    bool nul;
+};
+
+/**
+ * @brief Parses a -r range, "start:end" counted from 1 and inclusive.
+ * Either side may be left out to run from the first or to the last entry
+ * and a single number selects just that entry.
+ * @return true if spec is a valid range.
+ */
+static bool hist_parse_range(const char *spec, size_t *first, size_t *end) {
+    char *rest;
+
+    *first = 0;
+    *end = SIZE_MAX;
+    if (*spec != ':') {
+        unsigned long n = strtoul(spec, &rest, 10);
+        if (rest == spec || n == 0) {
+            return false;
+        }
+        *first = n - 1;
+        if (*rest == '\0') {
+            *end = n;
+            return true;
+        }
+        spec = rest;
+    }
+    if (*spec++ != ':') {
+        return false;
+    }
+    if (*spec != '\0') {
+        unsigned long n = strtoul(spec, &rest, 10);
+        if (rest == spec || *rest != '\0') {
+            return false;
+        }
+        *end = n;
+    }
+    return *first < *end;
+}
+
+/**
+ * @brief Queues one history entry for output. The command and directory
+ * are queued straight from the mapping, only the number and the -l
+ * fields are formatted.
+ */
+static void hist_emit(struct hist_listing *l, size_t n, const struct hist_entry *e) {
+    struct writer *w = l->w;
+
+    if (l->nul) {
+        writer_put(w, e->cmd, e->cmd_len + 1); // The record keeps the NUL.
+        return;
+    }
+    writer_num(w, n, 5);
+    writer_copy(w, "  ", 2);
+    if (l->lng) {
+        char fields[96];
+        time_t secs = e->time / 1000000;
+        struct tm tm;
+        size_t len = strftime(fields, sizeof(fields), "%Y-%m-%d %H:%M:%S",
+                              localtime_r(&secs, &tm));
+        len += snprintf(fields + len, sizeof(fields) - len, " %9.3fs %3d  ", e->duration / 1e6,
+                        e->status);
+        writer_copy(w, fields, len);
+        writer_put(w, e->cwd, strlen(e->cwd));
+        writer_copy(w, "  ", 2);
+    }
+    writer_put(w, e->cmd, e->cmd_len);
+    writer_copy(w, "\n", 1);
+}
+
+/**
+ * @brief Lists the entries of the range, or the last l->last of them.
+ */
+static void hist_list_range(struct hist_store *h, struct hist_listing *l) {
+    size_t count = hist_refresh(h);
+    size_t end = l->end < count ? l->end : count;
+    size_t first = l->first;
+
+    if (l->last > 0 && end > l->last && end - l->last > first) {
+        first = end - l->last;
+    }
+    for (size_t i = first; i < end; i++) {
+        struct hist_entry e;
+        if (hist_get(h, i, &e)) {
+            hist_emit(l, i + 1, &e);
+        }
+    }
+}
+
+/**
+ * @brief Lists the entries of the range containing q, oldest first, or
+ * the last l->last of them. Matches come from the trigram index newest
+ * first in batches.
+ * @return 0 if anything matched, 1 otherwise.
+ */
+static int hist_list_matches(struct hist_store *h, struct hist_listing *l, const char *q) {
+    size_t *ids = NULL;
+    size_t n = 0, cap = 0;
+    size_t before = l->end;
+    size_t want = l->last > 0 ? l->last : SIZE_MAX;
+
+    while (n < want) {
+        if (n + 1024 > cap) {
+            cap = cap ? cap * 2 : 4096;
+            size_t *grown = realloc(ids, cap * sizeof(*ids));
+            if (grown == NULL) {
+                break;
+            }
+            ids = grown;
+        }
+        size_t found = hist_search(h, q, before, ids + n, 1024);
+        // Only keep matches inside the range.
+        size_t kept = 0;
+        while (kept < found && ids[n + kept] >= l->first) {
+            kept++;
+        }
+        n += kept;
+        if (kept < 1024) {
+            break;
+        }
+        before = ids[n - 1];
+    }
+    if (n > want) {
+        n = want;
+    }
+    for (size_t i = n; i-- > 0;) {
+        struct hist_entry e;
+        if (hist_get(h, ids[i], &e)) {
+            hist_emit(l, ids[i] + 1, &e);
+        }
+    }
+    free(ids);
+    return n > 0 ? 0 : 1;
+}
+
+/**
+ * @brief Lists the history ring, used when there is no history file.
+ * Entries are numbered by their position in the ring.
+ */
+static void hist_list_ring(struct hist_ring *r, struct hist_listing *l, const char *q) {
+    size_t end = l->end < r->count ? l->end : r->count;
+    size_t first = l->first;
+    if (l->last > 0) {
+        // Walk back to the l->last'th match from the end.
+        size_t matched = 0;
+        for (size_t i = end; i-- > first;) {
+            const char *line = hist_ring_get(r, i);
+            if (line != NULL && (q == NULL || strstr(line, q) != NULL) &&
+                ++matched == l->last) {
+                first = i;
+                break;
+            }
+        }
+    }
+    for (size_t i = first; i < end; i++) {
+        const char *line = hist_ring_get(r, i);
+        if (line == NULL || (q != NULL && strstr(line, q) == NULL)) {
+            continue;
+        }
+        if (l->nul) {
+            writer_put(l->w, line, strlen(line) + 1);
+            continue;
+        }
+        writer_num(l->w, i + 1, 5);
+        writer_copy(l->w, "  ", 2);
+        writer_put(l->w, line, strlen(line));
+        writer_copy(l->w, "\n", 1);
+    }
+}
+
+/**
+ * @brief The history built in command.
+ *
+ * history [-l] [-0] [-s string] [-r start:end] [N]
+ *
+ * Lists every command in the history file, from all sessions, numbered
+ * from 1. -l adds when each command started, how long it ran, its exit
+ * status and the directory it ran in. -s only lists the commands that
+ * contain string, found through the trigram index. -r limits the listing
+ * to the entries from start to end and N to the last N of what would be
+ * listed. -0 prints just the commands, each ending in a NUL byte, for
+ * xargs -0 and the like. Without a history file the history ring is
+ * listed.
+ *
+ * Output is queued straight from the mapping of the history file and
+ * written with writev in large batches, so listing a million entries
+ * into a pipe takes a few hundred system calls rather than a stdio call
+ * per field.
+ *
+ * @param sh A pointer to the shell structure.
+ * @param argv The command and its arguments, argv[0] is "history".
+ * @return 0 on success, 1 if -s found nothing or the output could not be
+ * written, 2 on a usage error.
+ */
+int history_cmd(struct shell *sh, char **argv) {
+    struct hist_store *h = &sh->history;
+    struct hist_listing l = {NULL, 0, SIZE_MAX, 0, false, false};
+    const char *search = NULL;
+
+    for (int i = 1; argv[i] != NULL; i++) {
+        char *rest;
+        if (strcmp(argv[i], "-l") == 0) {
+            l.lng = true;
+        } else if (strcmp(argv[i], "-0") == 0) {
+            l.nul = true;
+        } else if (strcmp(argv[i], "-s") == 0 && argv[i + 1] != NULL) {
+            search = argv[++i];
+        } else if (strcmp(argv[i], "-r") == 0 && argv[i + 1] != NULL &&
+                   hist_parse_range(argv[i + 1], &l.first, &l.end)) {
+            i++;
+        } else if (argv[i][0] != '-' && (l.last = strtoul(argv[i], &rest, 10)) > 0 &&
+                   *rest == '\0') {
+            continue;
+        } else {
+            fprintf(stderr, "history: usage: history [-l] [-0] [-s string] "
+                            "[-r start:end] [N]\n");
+            return 2;
+        }
+    }
+
+    l.w = malloc(sizeof(*l.w));
+    if (l.w == NULL) {
+        fprintf(stderr, "history: %s\n", strerror(errno));
+        return 1;
+    }
+    fflush(stdout);
+    writer_init(l.w, STDOUT_FILENO);
+    int rval = 0;
+    if (h->path == NULL) {
+        hist_list_ring(&sh->recent, &l, search);
+    } else if (search != NULL) {
+        rval = hist_list_matches(h, &l, search);
+    } else {
+        hist_list_range(h, &l);
+    }
+    if (writer_flush(l.w) != 0) {
+        fprintf(stderr, "history: write error: %s\n", strerror(errno));
+        rval = 1;
+    }
+    free(l.w);
+    return rval;
+}
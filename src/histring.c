@@ -0,0 +1,470 @@
+#define _GNU_SOURCE
+#include "lab.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <readline/readline.h>
+
+/**
+ * @brief 64-bit FNV-1a hash of a line.
+ */
+static uint64_t ring_hash(const char *s) {
+    uint64_t h = 14695981039346656037ULL;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/**
+ * @brief Returns the slot of the entry at position i, counted from the
+ * oldest.
+ */
+static size_t ring_slot(const struct hist_ring *r, size_t i) {
+    size_t slot = r->head + i;
+    return slot < r->cap ? slot : slot - r->cap;
+}
+
+/**
+ * @brief The parsed argv of a ring entry in one block: the pointers
+ * followed by the strings they point to.
+ */
+struct ring_argv {
+    size_t size; // Bytes from argv on.
+    char *argv[];
+};
+
+/**
+ * @brief Packs a parsed argv into one allocation.
+ * @return The block, or NULL if memory could not be allocated.
+ */
+static struct ring_argv *ring_pack(char **argv) {
+    size_t argc = 0, bytes = 0;
+    for (; argv[argc] != NULL; argc++) {
+        bytes += strlen(argv[argc]) + 1;
+    }
+    size_t size = (argc + 1) * sizeof(char *) + bytes;
+    struct ring_argv *p = malloc(sizeof(*p) + size);
+    if (p == NULL) {
+        return NULL;
+    }
+    p->size = size;
+    char *str = (char *)&p->argv[argc + 1];
+    for (size_t k = 0; k < argc; k++) {
+        size_t len = strlen(argv[k]) + 1;
+        p->argv[k] = memcpy(str, argv[k], len);
+        str += len;
+    }
+    p->argv[argc] = NULL;
+    return p;
+}
+
+/**
+ * @brief Copies a packed argv into the arena with one memcpy, then points
+ * the copied pointers at the copied strings. Callers may change the copy,
+ * cmd_background does.
+ */
+static char **ring_unpack(const struct ring_argv *p, struct arena *a) {
+    char **argv = arena_alloc(a, p->size);
+    memcpy(argv, p->argv, p->size);
+    for (size_t k = 0; argv[k] != NULL; k++) {
+        argv[k] = (char *)argv + (p->argv[k] - (char *)p->argv);
+    }
+    return argv;
+}
+
+/**
+ * @brief Finds the set cell holding the live entry equal to line, or the
+ * empty cell where it would go. Cells hold a slot number plus one so 0
+ * can mark an empty cell.
+ */
+static uint32_t *ring_find(struct hist_ring *r, const char *line, uint64_t hash) {
+    size_t mask = r->set_size - 1;
+    size_t i = hash & mask;
+    while (r->set[i] != 0) {
+        size_t slot = r->set[i] - 1;
+        if (r->hashes[slot] == hash && strcmp(r->lines[slot], line) == 0) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    return &r->set[i];
+}
+
+/**
+ * @brief Removes a slot from the set. Later cells of the probe run are
+ * shifted back into the gap when that keeps them reachable, so the table
+ * never needs tombstones and lookups stay short however many entries come
+ * and go.
+ */
+static void ring_forget(struct hist_ring *r, size_t slot) {
+    size_t mask = r->set_size - 1;
+    size_t i = r->hashes[slot] & mask;
+    while (r->set[i] != slot + 1) {
+        i = (i + 1) & mask;
+    }
+    for (size_t j = (i + 1) & mask; r->set[j] != 0; j = (j + 1) & mask) {
+        size_t home = r->hashes[r->set[j] - 1] & mask;
+        // The cell at j may move to i unless its home lies in (i, j].
+        bool reachable = i <= j ? (home > i && home <= j) : (home > i || home <= j);
+        if (!reachable) {
+            r->set[i] = r->set[j];
+            i = j;
+        }
+    }
+    r->set[i] = 0;
+}
+
+/**
+ * @brief Closes the holes left by erased duplicates, moving the live
+ * entries to the front of the ring in order and rebuilding the set.
+ */
+static void ring_compact(struct hist_ring *r) {
+    char **lines = malloc(r->cap * sizeof(*lines));
+    uint64_t *hashes = malloc(r->cap * sizeof(*hashes));
+    struct ring_argv **parsed = malloc(r->cap * sizeof(*parsed));
+    if (lines == NULL || hashes == NULL || parsed == NULL) {
+        free(lines);
+        free(hashes);
+        free(parsed);
+        return; // The holes just stay a little longer.
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < r->count; i++) {
+        size_t slot = ring_slot(r, i);
+        if (r->lines[slot] != NULL) {
+            lines[n] = r->lines[slot];
+            parsed[n] = r->parsed[slot];
+            hashes[n++] = r->hashes[slot];
+        }
+    }
+    memcpy(r->lines, lines, n * sizeof(*lines));
+    memcpy(r->hashes, hashes, n * sizeof(*hashes));
+    memcpy(r->parsed, parsed, n * sizeof(*parsed));
+    memset(r->lines + n, 0, (r->cap - n) * sizeof(*lines));
+    memset(r->parsed + n, 0, (r->cap - n) * sizeof(*parsed));
+    free(lines);
+    free(hashes);
+    free(parsed);
+    r->head = 0;
+    r->count = n;
+    r->holes = 0;
+    memset(r->set, 0, r->set_size * sizeof(*r->set));
+    for (size_t slot = 0; slot < n; slot++) {
+        *ring_find(r, r->lines[slot], r->hashes[slot]) = (uint32_t)slot + 1;
+    }
+}
+
+/**
+ * @brief Sets up an empty ring of the most recent commands.
+ *
+ * @param r The ring.
+ * @param cap The most entries kept, 0 keeps none.
+ * @param dups What happens to a command that is already in the ring.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int hist_ring_init(struct hist_ring *r, size_t cap, enum hist_dups dups) {
+    memset(r, 0, sizeof(*r));
+    r->dups = dups;
+    if (cap == 0) {
+        return 0;
+    }
+    r->lines = calloc(cap, sizeof(*r->lines));
+    r->hashes = malloc(cap * sizeof(*r->hashes));
+    r->parsed = calloc(cap, sizeof(*r->parsed));
+    if (r->lines == NULL || r->hashes == NULL || r->parsed == NULL) {
+        hist_ring_destroy(r);
+        return -1;
+    }
+    r->cap = cap;
+    if (dups == HIST_DUPS_ERASE) {
+        // At most half full so probe runs stay short.
+        r->set_size = 16;
+        while (r->set_size < 2 * cap) {
+            r->set_size *= 2;
+        }
+        r->set = calloc(r->set_size, sizeof(*r->set));
+        if (r->set == NULL) {
+            hist_ring_destroy(r);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Frees every entry of the ring.
+ *
+ * @param r The ring.
+ */
+void hist_ring_destroy(struct hist_ring *r) {
+    for (size_t i = 0; r->lines != NULL && i < r->cap; i++) {
+        free(r->lines[i]);
+        free(r->parsed[i]);
+    }
+    free(r->lines);
+    free(r->parsed);
+    free(r->hashes);
+    free(r->set);
+    memset(r, 0, sizeof(*r));
+}
+
+/**
+ * @brief Adds a command as the newest entry.
+ *
+ * Once the ring is full the oldest entry is dropped to make room, so
+ * memory stays flat however long the shell runs. A command that repeats
+ * the newest entry takes over its cached parse. With HIST_DUPS_IGNORE a
+ * command equal to the newest entry is not added again. With
+ * HIST_DUPS_ERASE the earlier copy, wherever it is, is found through the
+ * hash set and removed, leaving a hole that is skipped until enough holes
+ * pile up to be worth compacting. Every case costs O(1), amortized over
+ * the compactions.
+ *
+ * @param r The ring.
+ * @param line The command, copied.
+ * @return true if the command was added.
+ */
+bool hist_ring_add(struct hist_ring *r, const char *line) {
+    if (r->cap == 0) {
+        return false;
+    }
+    uint64_t hash = ring_hash(line);
+    struct ring_argv *parsed = NULL;
+    if (r->count > 0) {
+        size_t newest = ring_slot(r, r->count - 1);
+        if (r->lines[newest] != NULL && r->hashes[newest] == hash &&
+            strcmp(r->lines[newest], line) == 0) {
+            if (r->dups == HIST_DUPS_IGNORE) {
+                return false;
+            }
+            // A replayed command keeps its parse.
+            parsed = r->parsed[newest];
+            r->parsed[newest] = NULL;
+        }
+    }
+    char *copy = strdup(line);
+    if (copy == NULL) {
+        free(parsed);
+        return false;
+    }
+    if (r->set != NULL) {
+        uint32_t *cell = ring_find(r, line, hash);
+        if (*cell != 0) {
+            size_t slot = *cell - 1;
+            ring_forget(r, slot);
+            if (parsed == NULL) {
+                parsed = r->parsed[slot];
+            }
+            free(r->lines[slot]);
+            r->lines[slot] = NULL;
+            r->parsed[slot] = NULL;
+            r->holes++;
+        }
+        if (r->holes > 16 && r->holes * 2 > r->count) {
+            ring_compact(r);
+        }
+    }
+    if (r->count == r->cap) {
+        if (r->lines[r->head] == NULL) {
+            r->holes--;
+        } else if (r->set != NULL) {
+            ring_forget(r, r->head);
+        }
+        free(r->lines[r->head]);
+        free(r->parsed[r->head]);
+        r->lines[r->head] = NULL;
+        r->parsed[r->head] = NULL;
+        r->head = ring_slot(r, 1);
+        r->count--;
+    }
+    size_t slot = ring_slot(r, r->count++);
+    r->lines[slot] = copy;
+    r->hashes[slot] = hash;
+    r->parsed[slot] = parsed;
+    if (r->set != NULL) {
+        *ring_find(r, copy, hash) = (uint32_t)slot + 1;
+    }
+    return true;
+}
+
+/**
+ * @brief Looks up an entry by position.
+ *
+ * @param r The ring.
+ * @param i The position, 0 is the oldest entry.
+ * @return The command, or NULL if i is past the newest entry or the entry
+ * was erased as a duplicate.
+ */
+const char *hist_ring_get(const struct hist_ring *r, size_t i) {
+    return i < r->count ? r->lines[ring_slot(r, i)] : NULL;
+}
+
+/**
+ * @brief Parses a ring entry.
+ *
+ * The first call parses the entry with cmd_parse_arena and keeps a packed
+ * copy. Later calls, the common case when one command is replayed over
+ * and over, copy that block into the arena without looking at the line.
+ * The parse moves with the command when it is added again.
+ *
+ * @param r The ring.
+ * @param i The position of a live entry.
+ * @param a The arena the argv comes from.
+ * @return The argv, valid until the next arena_reset.
+ */
+char **hist_ring_argv(struct hist_ring *r, size_t i, struct arena *a) {
+    size_t slot = ring_slot(r, i);
+    if (r->parsed[slot] != NULL) {
+        return ring_unpack(r->parsed[slot], a);
+    }
+    char **argv = cmd_parse_arena(a, r->lines[slot]);
+    r->parsed[slot] = ring_pack(argv);
+    return argv;
+}
+
+/**
+ * @brief Where the arrow keys are in the ring. The up and down handlers
+ * get no argument to carry it in, so it is file state shared by both.
+ */
+static struct {
+    struct hist_ring *ring;
+    size_t back; // Entries back from the newest, 0 is the line being typed.
+    char *saved; // The line being typed, kept while moving through history.
+} nav;
+
+/**
+ * @brief Returns the entry back positions from the newest one.
+ */
+static const char *nav_entry(size_t back) {
+    return hist_ring_get(nav.ring, nav.ring->count - back);
+}
+
+/**
+ * @brief Moves count live entries older, or newer for a negative count,
+ * and shows the entry reached. Moving newer than the newest entry gives
+ * back the line that was being typed.
+ */
+static int nav_move(int count) {
+    size_t back = nav.back;
+    for (; count > 0; count--) {
+        size_t older = back + 1;
+        while (older <= nav.ring->count && nav_entry(older) == NULL) {
+            older++;
+        }
+        if (older > nav.ring->count) {
+            break;
+        }
+        back = older;
+    }
+    for (; count < 0 && back > 0; count++) {
+        do {
+            back--;
+        } while (back > 0 && nav_entry(back) == NULL);
+    }
+    if (back == nav.back) {
+        rl_ding();
+        return 0;
+    }
+    if (nav.back == 0) {
+        free(nav.saved);
+        nav.saved = strdup(rl_line_buffer);
+    }
+    nav.back = back;
+    const char *line = back > 0 ? nav_entry(back) : nav.saved;
+    rl_replace_line(line ? line : "", 1);
+    rl_point = rl_end;
+    return 0;
+}
+
+/**
+ * @brief Replaces previous-history.
+ */
+static int nav_prev(int count, int key) {
+    UNUSED(key);
+    return nav_move(count);
+}
+
+/**
+ * @brief Replaces next-history.
+ */
+static int nav_next(int count, int key) {
+    UNUSED(key);
+    return nav_move(-count);
+}
+
+/**
+ * @brief Replaces beginning-of-history.
+ */
+static int nav_first(int count, int key) {
+    UNUSED(count);
+    UNUSED(key);
+    return nav_move(INT32_MAX);
+}
+
+/**
+ * @brief Replaces end-of-history.
+ */
+static int nav_last(int count, int key) {
+    UNUSED(count);
+    UNUSED(key);
+    return nav_move(INT32_MIN + 1);
+}
+
+/**
+ * @brief Starts every new line at the bottom of the history, readline's
+ * startup hook.
+ */
+static int nav_start(void) {
+    hist_nav_abort();
+    return 0;
+}
+
+/**
+ * @brief Moves every key bound to one of readline's history functions,
+ * in any of the standard keymaps, over to ours.
+ */
+static void nav_rebind(rl_command_func_t *from, rl_command_func_t *to) {
+    Keymap maps[] = {emacs_standard_keymap, vi_movement_keymap, vi_insertion_keymap};
+    for (size_t m = 0; m < sizeof(maps) / sizeof(maps[0]); m++) {
+        char **seqs = rl_invoking_keyseqs_in_map(from, maps[m]);
+        for (size_t i = 0; seqs != NULL && seqs[i] != NULL; i++) {
+            rl_bind_keyseq_in_map(seqs[i], to, maps[m]);
+            free(seqs[i]);
+        }
+        free(seqs);
+    }
+}
+
+/**
+ * @brief Makes the arrow keys walk the ring instead of readline's history.
+ *
+ * Readline's history list grows without bound and can only drop an entry
+ * by shifting every later one down. The ring keeps a fixed number of
+ * commands and drops duplicates in constant time, so it takes over every
+ * key readline binds to moving through history, including ones added by
+ * inputrc, which is why readline is initialized first.
+ *
+ * @param r The ring.
+ */
+void hist_nav_init(struct hist_ring *r) {
+    nav.ring = r;
+    rl_initialize();
+    nav_rebind(rl_get_previous_history, nav_prev);
+    nav_rebind(rl_get_next_history, nav_next);
+    nav_rebind(rl_beginning_of_history, nav_first);
+    nav_rebind(rl_end_of_history, nav_last);
+    rl_startup_hook = nav_start;
+}
+
+/**
+ * @brief Forgets the position in history and the line that was being
+ * typed, used when a line is accepted or thrown away with Ctrl+C.
+ */
+void hist_nav_abort(void) {
+    nav.back = 0;
+    free(nav.saved);
+    nav.saved = NULL;
+}
@@ -0,0 +1,232 @@
+#include "lab.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Size of each read() when input comes from a pipe or terminal. */
+#define READER_CHUNK (64 * 1024)
+
+/**
+ * @brief Reads input from a string, used for -c.
+ *
+ * @param r The reader.
+ * @param s The commands, copied so they can be split in place.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int reader_open_string(struct line_reader *r, const char *s) {
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+    r->buf = strdup(s);
+    if (r->buf == NULL) {
+        return -1;
+    }
+    r->len = strlen(s);
+    r->cap = r->len + 1;
+    r->eof = true;
+    return 0;
+}
+
+/**
+ * @brief Reads input from a file descriptor the commands share, stdin.
+ *
+ * A regular file is mapped privately so lines can be terminated in place
+ * without any read() calls, and the descriptor's offset is kept just past
+ * the line being run. Anything else (a pipe for example) is read a byte
+ * at a time so nothing past the current line is taken from the commands,
+ * the same as other shells do. reader_open_file turns both off for a
+ * script the shell opened itself.
+ *
+ * @param r The reader.
+ * @param fd The descriptor, it is not closed by reader_close.
+ * @return 0 on success, -1 with errno set on failure.
+ */
+int reader_open_fd(struct line_reader *r, int fd) {
+    struct stat st;
+
+    memset(r, 0, sizeof(*r));
+    r->fd = fd;
+    r->shared = true;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        off_t offset = lseek(fd, 0, SEEK_CUR);
+        void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            r->buf = map;
+            r->len = st.st_size;
+            r->cap = st.st_size;
+            r->pos = offset > 0 && offset <= st.st_size ? (size_t)offset : 0;
+            r->scan = r->pos;
+            r->mapped = true;
+            r->eof = true;
+            return 0;
+        }
+    }
+
+    r->buf = malloc(READER_CHUNK);
+    if (r->buf == NULL) {
+        return -1;
+    }
+    r->cap = READER_CHUNK;
+    return 0;
+}
+
+/**
+ * @brief Opens a script file for reading.
+ *
+ * @param r The reader.
+ * @param path The script.
+ * @return 0 on success, -1 with errno set on failure.
+ */
+int reader_open_file(struct line_reader *r, const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    if (reader_open_fd(r, fd) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    // A mapping does not need the descriptor any more.
+    if (r->mapped) {
+        close(fd);
+        r->fd = -1;
+    }
+    r->owns_fd = true;
+    r->shared = false; // Commands never see this descriptor.
+    return 0;
+}
+
+/**
+ * @brief Reads more input after the unread part of the buffer, a single
+ * byte when the descriptor is shared so the read stops at the newline.
+ * @return The number of bytes read, 0 at end of input, -1 on error.
+ */
+static ssize_t reader_fill(struct line_reader *r) {
+    // Move the partial line to the front so the buffer only grows when a
+    // single line is longer than it.
+    if (r->pos > 0) {
+        memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+        r->len -= r->pos;
+        r->scan -= r->pos;
+        r->pos = 0;
+    }
+    if (r->cap - r->len < READER_CHUNK / 2) {
+        char *tmp = realloc(r->buf, r->cap * 2);
+        if (tmp == NULL) {
+            return -1;
+        }
+        r->buf = tmp;
+        r->cap *= 2;
+    }
+
+    size_t want = r->shared ? 1 : r->cap - r->len - 1;
+    ssize_t n;
+    do {
+        n = read(r->fd, r->buf + r->len, want);
+    } while (n < 0 && errno == EINTR);
+    if (n > 0) {
+        r->len += n;
+    }
+    return n;
+}
+
+/**
+ * @brief Lines up a shared mapped file with its descriptor. Before a line
+ * is looked for, whatever the last command read from it is skipped. After,
+ * the offset is left where the next line starts for the command about to
+ * run.
+ */
+static void reader_sync(struct line_reader *r, bool before) {
+    if (!r->mapped || !r->shared) {
+        return;
+    }
+    if (before) {
+        off_t off = lseek(r->fd, 0, SEEK_CUR);
+        if (off >= 0 && (size_t)off > r->pos) {
+            r->pos = r->scan = (size_t)off < r->len ? (size_t)off : r->len;
+        }
+    } else {
+        lseek(r->fd, (off_t)r->pos, SEEK_SET);
+    }
+}
+
+/**
+ * @brief Returns the next line of input without its newline.
+ *
+ * The line is terminated in place inside the reader's buffer and stays
+ * valid until the next call.
+ *
+ * @param r The reader.
+ * @return The line, or NULL at the end of input.
+ */
+char *reader_next(struct line_reader *r) {
+    reader_sync(r, true);
+    for (;;) {
+        char *nl = memchr(r->buf + r->scan, '\n', r->len - r->scan);
+        if (nl != NULL) {
+            char *line = r->buf + r->pos;
+            *nl = '\0';
+            r->pos = r->scan = (size_t)(nl - r->buf) + 1;
+            reader_sync(r, false);
+            return line;
+        }
+        r->scan = r->len;
+        if (r->eof || reader_fill(r) <= 0) {
+            break;
+        }
+    }
+    r->eof = true;
+
+    // The last line has no newline.
+    if (r->pos >= r->len) {
+        return NULL;
+    }
+    char *line = r->buf + r->pos;
+    size_t len = r->len - r->pos;
+    r->pos = r->scan = r->len;
+    reader_sync(r, false);
+    if (!r->mapped) {
+        line[len] = '\0'; // Buffers always keep a spare byte.
+        return line;
+    }
+    // A mapping has no spare byte when the file fills its last page.
+    free(r->tail);
+    r->tail = strndup(line, len);
+    return r->tail;
+}
+
+/**
+ * @brief Checks if every line has been returned. Only exact for strings and
+ * mapped files, a pipe may still produce more input.
+ *
+ * @param r The reader.
+ * @return true if there is no more input.
+ */
+bool reader_at_end(struct line_reader *r) {
+    return r->eof && r->pos >= r->len;
+}
+
+/**
+ * @brief Releases the buffer or mapping and closes the descriptor if the
+ * reader opened it.
+ *
+ * @param r The reader.
+ */
+void reader_close(struct line_reader *r) {
+    if (r->mapped) {
+        munmap(r->buf, r->cap);
+    } else {
+        free(r->buf);
+    }
+    free(r->tail);
+    if (r->owns_fd && r->fd >= 0) {
+        close(r->fd);
+    }
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
@@ -0,0 +1,204 @@
+#define _GNU_SOURCE
+#include "lab.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <readline/readline.h>
+
+/* Longest search string, longer input is ignored. */
+#define ISEARCH_MAX 256
+
+/**
+ * @brief The state of a reverse-i-search, kept between keystrokes. Its
+ * key handlers are installed in a keymap of their own for the length of
+ * the search and only get a count and a key, so they all reach it here.
+ */
+static struct {
+    struct hist_store *store;
+    struct hist_ring *ring;
+    Keymap keymap;
+    Keymap saved_keymap;
+    char *saved_line;
+    int saved_point;
+    char query[ISEARCH_MAX];
+    size_t len;
+    size_t match;
+    bool failed;
+    bool active;
+} isearch;
+
+/**
+ * @brief Shows the search prompt in place of the shell prompt.
+ */
+static void isearch_show(void) {
+    rl_message("(%sreverse-i-search)`%s': ", isearch.failed ? "failed " : "", isearch.query);
+}
+
+/**
+ * @brief Returns the number of entries searched, those of the history
+ * file or, without one, of the ring.
+ */
+static size_t isearch_count(void) {
+    return isearch.store ? hist_refresh(isearch.store) : isearch.ring->count;
+}
+
+/**
+ * @brief Finds the newest entry below before that contains the query.
+ * The history file is searched through its index, the ring, which is
+ * small, by looking at every entry.
+ * @return The entry's command with its number in id, or NULL if none.
+ */
+static const char *isearch_next(size_t before, size_t *id) {
+    if (isearch.store == NULL) {
+        for (size_t i = before < isearch.ring->count ? before : isearch.ring->count; i-- > 0;) {
+            const char *line = hist_ring_get(isearch.ring, i);
+            if (line != NULL && strstr(line, isearch.query) != NULL) {
+                *id = i;
+                return line;
+            }
+        }
+        return NULL;
+    }
+    struct hist_entry e;
+    while (hist_search(isearch.store, isearch.query, before, id, 1) == 1) {
+        before = *id;
+        if (hist_get(isearch.store, *id, &e)) {
+            return e.cmd;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Finds the newest entry below before that contains the query and
+ * puts it on the line with the cursor on the match. With skip_same an
+ * entry identical to the line already showing is passed over. The line
+ * is left alone when nothing matches. An empty query shows the line the
+ * search started from.
+ */
+static void isearch_find(size_t before, bool skip_same) {
+    const char *cmd;
+    size_t id;
+
+    isearch.failed = false;
+    if (isearch.len == 0) {
+        isearch.match = isearch_count();
+        rl_replace_line(isearch.saved_line, 0);
+        rl_point = isearch.saved_point;
+        return;
+    }
+    while ((cmd = isearch_next(before, &id)) != NULL) {
+        before = id;
+        if (skip_same && strcmp(cmd, rl_line_buffer) == 0) {
+            continue;
+        }
+        isearch.match = id;
+        rl_replace_line(cmd, 0);
+        rl_point = (int)(strstr(cmd, isearch.query) - cmd);
+        return;
+    }
+    isearch.failed = true;
+}
+
+/**
+ * @brief Leaves search mode with the line as it is.
+ */
+static void isearch_end(void) {
+    isearch.active = false;
+    rl_set_keymap(isearch.saved_keymap);
+    free(isearch.saved_line);
+    isearch.saved_line = NULL;
+    rl_clear_message();
+}
+
+/**
+ * @brief Handles every key typed while searching.
+ *
+ * Printable keys extend the search and backspace shortens it, Ctrl+R moves
+ * on to the next older match, Ctrl+G gives up and puts the original line
+ * back, Enter runs the line shown and any other key ends the search and
+ * then does what it normally does.
+ */
+static int isearch_key(int count, int key) {
+    UNUSED(count);
+    if (key == CTRL('R')) {
+        isearch_find(isearch.match, true);
+    } else if (key == CTRL('G')) {
+        rl_replace_line(isearch.saved_line, 0);
+        rl_point = isearch.saved_point;
+        isearch_end();
+        return 0;
+    } else if (key == '\r' || key == '\n') {
+        isearch_end();
+        return rl_newline(1, key);
+    } else if (key == RUBOUT || key == CTRL('H')) {
+        if (isearch.len > 0) {
+            isearch.query[--isearch.len] = '\0';
+        }
+        isearch_find(SIZE_MAX, false);
+    } else if ((key >= ' ' && key < RUBOUT) || key > RUBOUT) {
+        if (isearch.len + 1 < ISEARCH_MAX) {
+            isearch.query[isearch.len++] = (char)key;
+            isearch.query[isearch.len] = '\0';
+        }
+        // The match showing may still hold the longer string.
+        isearch_find(isearch.match + 1, false);
+    } else {
+        isearch_end();
+        rl_execute_next(key);
+        return 0;
+    }
+    isearch_show();
+    return 0;
+}
+
+/**
+ * @brief Starts a reverse-i-search, bound to Ctrl+R.
+ */
+static int isearch_start(int count, int key) {
+    UNUSED(count);
+    UNUSED(key);
+    isearch.active = true;
+    isearch.saved_line = strdup(rl_line_buffer);
+    isearch.saved_point = rl_point;
+    isearch.saved_keymap = rl_get_keymap();
+    isearch.query[0] = '\0';
+    isearch.len = 0;
+    isearch.failed = false;
+    isearch.match = isearch_count();
+    rl_set_keymap(isearch.keymap);
+    isearch_show();
+    return 0;
+}
+
+/**
+ * @brief Binds Ctrl+R to a reverse-i-search over the history file.
+ *
+ * Readline's own search walks its history list one entry at a time and
+ * only sees what was loaded into it. This one asks the trigram index of
+ * the history file, so every session's commands are searched and each
+ * key costs about the same no matter how long the history is. Without a
+ * history file the history ring is searched, readline's list is not kept.
+ *
+ * @param store The history file to search, or NULL.
+ * @param ring The history ring, searched when there is no history file.
+ */
+void isearch_init(struct hist_store *store, struct hist_ring *ring) {
+    isearch.store = store;
+    isearch.ring = ring;
+    isearch.keymap = rl_make_bare_keymap();
+    for (int key = 0; key < KEYMAP_SIZE; key++) {
+        rl_bind_key_in_map(key, isearch_key, isearch.keymap);
+    }
+    rl_add_defun("indexed-reverse-search-history", isearch_start, CTRL('R'));
+}
+
+/**
+ * @brief Drops out of a search in progress, used when Ctrl+C clears the
+ * line.
+ */
+void isearch_abort(void) {
+    if (isearch.active) {
+        isearch_end();
+    }
+}
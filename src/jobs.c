@@ -0,0 +1,948 @@
+#define _GNU_SOURCE
+#include "lab.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/pidfd.h>
+#include <sys/signalfd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+/* Initial number of pid slots, must be a power of two. */
+#define JOB_PIDS_MIN 64
+
+/* The wait status of a continued child, the value WIFCONTINUED tests for. */
+#define JOB_CONTINUED 0xffff
+
+/**
+ * @brief Spreads pids, which are mostly sequential, over the pid index.
+ */
+static size_t pid_hash(pid_t pid) {
+    uint64_t h = (uint64_t)(uint32_t)pid * 0x9E3779B97F4A7C15ULL;
+    return (size_t)(h ^ (h >> 32));
+}
+
+/**
+ * @brief Converts a waitpid status into a shell exit status, 128 + signal
+ * number for processes killed by a signal.
+ */
+static int wait_status(int status) {
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    }
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return EXIT_FAILURE;
+}
+
+/**
+ * @brief Finds the slot for pid. The returned slot either holds pid or is
+ * the empty slot where pid would be inserted.
+ */
+static struct job_slot *pid_slot(struct job_table *t, pid_t pid) {
+    size_t mask = t->pid_size - 1;
+    size_t i = pid_hash(pid) & mask;
+    while (t->pids[i].pid != 0 && t->pids[i].pid != pid) {
+        i = (i + 1) & mask;
+    }
+    return &t->pids[i];
+}
+
+/**
+ * @brief Doubles the pid index and rehashes every entry.
+ * @return 0 on success, -1 if the allocation failed.
+ */
+static int pid_grow(struct job_table *t) {
+    size_t old_size = t->pid_size;
+    struct job_slot *old = t->pids;
+    size_t size = old_size ? old_size * 2 : JOB_PIDS_MIN;
+
+    struct job_slot *pids = calloc(size, sizeof(*pids));
+    if (pids == NULL) {
+        return -1;
+    }
+    t->pids = pids;
+    t->pid_size = size;
+    for (size_t i = 0; i < old_size; i++) {
+        if (old[i].pid != 0) {
+            *pid_slot(t, old[i].pid) = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+/**
+ * @brief Removes pid from the pid index with backward shift deletion so no
+ * tombstones build up as thousands of children come and go.
+ */
+static void pid_remove(struct job_table *t, pid_t pid) {
+    struct job_slot *slot = pid_slot(t, pid);
+    if (slot->pid == 0) {
+        return;
+    }
+
+    size_t mask = t->pid_size - 1;
+    size_t hole = (size_t)(slot - t->pids);
+    size_t i = (hole + 1) & mask;
+    while (t->pids[i].pid != 0) {
+        size_t home = pid_hash(t->pids[i].pid) & mask;
+        // Move the entry back if the hole lies between its home and its slot.
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            t->pids[hole] = t->pids[i];
+            hole = i;
+        }
+        i = (i + 1) & mask;
+    }
+    memset(&t->pids[hole], 0, sizeof(t->pids[hole]));
+    t->pid_count--;
+}
+
+/**
+ * @brief Closes the pidfd of a process, which also takes it out of the
+ * epoll set.
+ */
+static void proc_close(struct job_table *t, struct job_proc *p) {
+    if (p->pidfd >= 0) {
+        close(p->pidfd);
+        p->pidfd = -1;
+    } else if (t->unwatched > 0) {
+        t->unwatched--;
+    }
+}
+
+/**
+ * @brief Initializes an empty job table.
+ *
+ * SIGCHLD is blocked and routed to a signalfd. Children are then only
+ * reaped when the shell reads the signalfd, never from inside a signal
+ * handler, and a SIGCHLD that arrives while the shell is busy stays
+ * pending instead of being lost.
+ *
+ * @param t The job table.
+ */
+void jobs_init(struct job_table *t) {
+    sigset_t mask;
+
+    memset(t, 0, sizeof(*t));
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &t->old_mask);
+    t->sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    t->epfd = -1;
+    if (pid_grow(t) != 0) {
+        fprintf(stderr, "jobs_init: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Frees every job and restores the signal mask. Jobs that are still
+ * running are not signalled.
+ *
+ * @param t The job table.
+ */
+void jobs_destroy(struct job_table *t) {
+    if (t->pids == NULL) {
+        return; // Never initialized.
+    }
+    // Every live process is in the pid index exactly once, a job can go
+    // once the last of its processes has been seen.
+    for (size_t i = 0; i < t->pid_size; i++) {
+        struct job *j = t->pids[i].job;
+        if (t->pids[i].pid == 0) {
+            continue;
+        }
+        proc_close(t, &j->procs[t->pids[i].proc]);
+        if (--j->nlive == 0) {
+            free(j);
+        }
+    }
+    while (t->done_head != NULL) {
+        struct job *j = t->done_head;
+        t->done_head = j->next;
+        free(j);
+    }
+    if (t->sigfd >= 0) {
+        close(t->sigfd);
+    }
+    sigprocmask(SIG_SETMASK, &t->old_mask, NULL);
+    free(t->pids);
+    free(t->jobs);
+    memset(t, 0, sizeof(*t));
+    t->sigfd = -1;
+}
+
+/**
+ * @brief Gives a background job the next id, one more than the highest id
+ * in use like other shells.
+ * @return 0 on success, -1 if the allocation failed.
+ */
+static int job_assign_id(struct job_table *t, struct job *j) {
+    if (t->max_id == t->cap) {
+        int cap = t->cap ? t->cap * 2 : 16;
+        struct job **jobs = realloc(t->jobs, cap * sizeof(*jobs));
+        if (jobs == NULL) {
+            return -1;
+        }
+        t->jobs = jobs;
+        t->cap = cap;
+    }
+    j->id = ++t->max_id;
+    t->jobs[j->id - 1] = j;
+    return 0;
+}
+
+/**
+ * @brief Starts tracking a newly launched job.
+ *
+ * The job, its processes and its command line are one allocation. Every
+ * pid goes into the pid index so job_update finds the job in O(1), and
+ * when the table has an epoll set every process gets a pidfd in it.
+ *
+ * @param t The job table.
+ * @param pgid The process group of the job.
+ * @param pids The processes of the job, in pipeline order.
+ * @param n The number of processes.
+ * @param cmd The command line, copied into the job.
+ * @param background true if the shell does not wait for the job.
+ * @return The job. Exits the shell if the system is out of memory.
+ */
+struct job *job_add(struct job_table *t, pid_t pgid, const pid_t *pids, size_t n,
+                    const char *cmd, bool background) {
+    size_t len = strlen(cmd);
+    struct job *j = malloc(sizeof(*j) + n * sizeof(j->procs[0]) + len + 1);
+    if (j == NULL) {
+        fprintf(stderr, "job_add: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(j, 0, sizeof(*j));
+    j->pgid = pgid;
+    j->state = JOB_RUNNING;
+    j->background = background;
+    j->nprocs = n;
+    j->nlive = n;
+    j->cmd = (char *)&j->procs[n];
+    memcpy(j->cmd, cmd, len + 1);
+
+    // Keep the load below 50% so probes stay short.
+    while ((t->pid_count + n) * 2 > t->pid_size) {
+        if (pid_grow(t) != 0) {
+            fprintf(stderr, "job_add: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        j->procs[i].pid = pids[i];
+        j->procs[i].status = 0;
+        j->procs[i].pidfd = -1;
+        j->procs[i].done = false;
+        j->procs[i].stopped = false;
+        if (t->epfd >= 0) {
+            // The pidfd becomes readable when the process exits, even if it
+            // already has. Without one the process is reaped on SIGCHLD.
+            struct epoll_event ev = {.events = EPOLLIN,
+                                     .data.u64 = (uint64_t)EVENT_CHILD << 32 | (uint32_t)pids[i]};
+            j->procs[i].pidfd = pidfd_open(pids[i], 0);
+            if (j->procs[i].pidfd >= 0 &&
+                epoll_ctl(t->epfd, EPOLL_CTL_ADD, j->procs[i].pidfd, &ev) != 0) {
+                close(j->procs[i].pidfd);
+                j->procs[i].pidfd = -1;
+            }
+            if (j->procs[i].pidfd < 0) {
+                t->unwatched++; // Out of descriptors, reap it on SIGCHLD.
+            }
+        }
+        struct job_slot *slot = pid_slot(t, pids[i]);
+        slot->pid = pids[i];
+        slot->job = j;
+        slot->proc = i;
+        t->pid_count++;
+    }
+    if (background) {
+        if (job_assign_id(t, j) != 0) {
+            fprintf(stderr, "job_add: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        t->current = j;
+    }
+    t->count++;
+    t->running++;
+    return j;
+}
+
+/**
+ * @brief Finds the job a process belongs to.
+ *
+ * @param t The job table.
+ * @param pid The process.
+ * @return The job, or NULL if the process is not running under the shell.
+ */
+struct job *job_find_pid(struct job_table *t, pid_t pid) {
+    if (pid <= 0) {
+        return NULL;
+    }
+    return pid_slot(t, pid)->job;
+}
+
+/**
+ * @brief Finds a background job by id.
+ *
+ * @param t The job table.
+ * @param id The job id.
+ * @return The job, or NULL if there is none.
+ */
+struct job *job_get(struct job_table *t, int id) {
+    if (id < 1 || id > t->max_id) {
+        return NULL;
+    }
+    return t->jobs[id - 1];
+}
+
+/**
+ * @brief Prints a job the way jobs lists it, for example
+ * "[2]+  Stopped                 vi notes". The current job is marked + and
+ * long adds the pid of every process.
+ */
+static void job_print(struct job_table *t, struct job *j, bool long_format) {
+    char state[32];
+    const struct job_proc *last = &j->procs[j->nprocs - 1];
+
+    if (j->state == JOB_RUNNING) {
+        snprintf(state, sizeof(state), "Running");
+    } else if (j->state == JOB_STOPPED) {
+        snprintf(state, sizeof(state), "Stopped");
+    } else if (WIFSIGNALED(last->status)) {
+        snprintf(state, sizeof(state), "%s", strsignal(WTERMSIG(last->status)));
+    } else if (j->status == 0) {
+        snprintf(state, sizeof(state), "Done");
+    } else {
+        snprintf(state, sizeof(state), "Exit %d", j->status);
+    }
+    printf("[%d]%c ", j->id, j == t->current ? '+' : ' ');
+    if (long_format) {
+        for (size_t i = 0; i < j->nprocs; i++) {
+            printf("%d ", j->procs[i].pid);
+        }
+    }
+    printf(" %-24s%s\n", state, j->cmd);
+}
+
+/**
+ * @brief Stops tracking a job and frees it.
+ *
+ * @param t The job table.
+ * @param j The job.
+ */
+void job_remove(struct job_table *t, struct job *j) {
+    for (size_t i = 0; i < j->nprocs; i++) {
+        if (!j->procs[i].done) {
+            pid_remove(t, j->procs[i].pid);
+            proc_close(t, &j->procs[i]);
+        }
+    }
+    if (j->state == JOB_RUNNING) {
+        t->running--;
+    }
+    if (j->id > 0) {
+        t->jobs[j->id - 1] = NULL;
+        // Ids are reused once the jobs above them are gone.
+        while (t->max_id > 0 && t->jobs[t->max_id - 1] == NULL) {
+            t->max_id--;
+        }
+    }
+    if (t->current == j) {
+        t->current = t->max_id > 0 ? t->jobs[t->max_id - 1] : NULL;
+    }
+    // Unlink it from the done list.
+    struct job **link = &t->done_head;
+    struct job *prev = NULL;
+    while (*link != NULL && *link != j) {
+        prev = *link;
+        link = &(*link)->next;
+    }
+    if (*link == j) {
+        *link = j->next;
+        if (t->done_tail == j) {
+            t->done_tail = prev;
+        }
+    }
+    t->count--;
+    free(j);
+}
+
+/**
+ * @brief Records a status reported by waitpid.
+ *
+ * A job is stopped once every process that is still alive has stopped and
+ * runs again as soon as one of them continues. A finished process leaves
+ * the pid index straight away so a recycled pid can never be mistaken for
+ * it. The job's status is the status of its last process. A background
+ * job whose processes have all finished is queued for jobs_notify.
+ *
+ * @param t The job table.
+ * @param pid The process.
+ * @param status The waitpid status.
+ * @return The job, or NULL if pid is not tracked.
+ */
+struct job *job_update(struct job_table *t, pid_t pid, int status) {
+    struct job_slot *slot = pid_slot(t, pid);
+    struct job *j = slot->job;
+    if (slot->pid == 0) {
+        return NULL;
+    }
+    struct job_proc *p = &j->procs[slot->proc];
+
+    if (WIFCONTINUED(status)) {
+        if (p->stopped) {
+            p->stopped = false;
+            j->nstopped--;
+        }
+        if (j->state == JOB_STOPPED) {
+            j->state = JOB_RUNNING;
+            t->running++;
+        }
+        return j;
+    }
+    if (WIFSTOPPED(status)) {
+        if (!p->stopped) {
+            p->stopped = true;
+            j->nstopped++;
+        }
+        p->status = status;
+    } else {
+        if (p->stopped) {
+            p->stopped = false;
+            j->nstopped--;
+        }
+        pid_remove(t, pid);
+        proc_close(t, p);
+        p->status = status;
+        p->done = true;
+        if (p == &j->procs[j->nprocs - 1]) {
+            j->status = wait_status(status);
+        }
+        trace_end(t->trace, TRACE_PROCESS, pid, wait_status(status));
+        j->nlive--;
+    }
+
+    if (j->nlive == 0) {
+        if (j->state == JOB_RUNNING) {
+            t->running--;
+        }
+        j->state = JOB_DONE;
+        if (j->background) {
+            j->next = NULL;
+            if (t->done_tail != NULL) {
+                t->done_tail->next = j;
+            } else {
+                t->done_head = j;
+            }
+            t->done_tail = j;
+        }
+    } else if (j->nstopped == j->nlive && j->state == JOB_RUNNING) {
+        j->state = JOB_STOPPED;
+        t->running--;
+    }
+    return j;
+}
+
+/**
+ * @brief Adds what a finished process used, as reported by wait4, to its
+ * job's totals. Stops and continues carry no usage.
+ *
+ * @param j The job, or NULL if the process was not tracked.
+ * @param status The wait status.
+ * @param ru The process's resource usage.
+ */
+static void job_charge(struct job *j, int status, const struct rusage *ru) {
+    if (j == NULL || WIFSTOPPED(status) || WIFCONTINUED(status)) {
+        return;
+    }
+    struct rusage *u = &j->usage;
+    timeradd(&u->ru_utime, &ru->ru_utime, &u->ru_utime);
+    timeradd(&u->ru_stime, &ru->ru_stime, &u->ru_stime);
+    if (ru->ru_maxrss > u->ru_maxrss) {
+        u->ru_maxrss = ru->ru_maxrss;
+    }
+    u->ru_minflt += ru->ru_minflt;
+    u->ru_majflt += ru->ru_majflt;
+    u->ru_nvcsw += ru->ru_nvcsw;
+    u->ru_nivcsw += ru->ru_nivcsw;
+}
+
+/**
+ * @brief Reaps a process whose pidfd became readable.
+ *
+ * @param t The job table.
+ * @param pid The process.
+ * @return The job, or NULL if the process had already been reaped.
+ */
+struct job *job_reap_pid(struct job_table *t, pid_t pid) {
+    struct rusage ru;
+    int status;
+    pid_t rval;
+    do {
+        rval = wait4(pid, &status, WNOHANG, &ru);
+    } while (rval < 0 && errno == EINTR);
+    if (rval != pid) {
+        return NULL;
+    }
+    t->reaped++;
+    struct job *j = job_update(t, pid, status);
+    job_charge(j, status, &ru);
+    return j;
+}
+
+/**
+ * @brief Reaps every child that changed state without blocking.
+ *
+ * Nothing is done until SIGCHLD has been read from the signalfd, so an
+ * idle shell with thousands of running jobs does no work at all. Signals
+ * do not queue, one SIGCHLD can stand for many children, so the loop runs
+ * until there is nothing left. When processes have pidfds their exits are
+ * reaped from there and only stops and continues are collected here, with
+ * waitid so no exit is consumed behind a pidfd's back. Processes that
+ * could not get a pidfd fall back to wait4 for everything. Without job
+ * control there are no stops or continues to collect.
+ *
+ * @param t The job table.
+ * @return The number of children reaped, stops and continues included.
+ */
+size_t jobs_reap(struct job_table *t) {
+    struct signalfd_siginfo info[16];
+    bool pending = t->sigfd < 0; // Without a signalfd always poll.
+    size_t reaped = 0;
+
+    while (t->sigfd >= 0 && read(t->sigfd, info, sizeof(info)) > 0) {
+        pending = true;
+    }
+    if (!pending) {
+        return 0;
+    }
+    for (;;) {
+        struct rusage ru;
+        int status;
+        pid_t pid;
+        if (t->epfd >= 0 && t->unwatched == 0) {
+            if (!t->job_control) {
+                break;
+            }
+            siginfo_t si;
+            si.si_pid = 0;
+            if (waitid(P_ALL, 0, &si, WSTOPPED | WCONTINUED | WNOHANG) != 0 || si.si_pid == 0) {
+                break;
+            }
+            pid = si.si_pid;
+            status = si.si_code == CLD_CONTINUED ? JOB_CONTINUED : W_STOPCODE(si.si_status);
+        } else {
+            int flags = t->job_control ? WNOHANG | WUNTRACED | WCONTINUED : WNOHANG;
+            pid = wait4(-1, &status, flags, &ru);
+            if (pid <= 0) {
+                break;
+            }
+        }
+        // Only exits are charged, and those never come from waitid.
+        job_charge(job_update(t, pid, status), status, &ru);
+        reaped++;
+    }
+    t->reaped += reaped;
+    return reaped;
+}
+
+/**
+ * @brief Brings the job table up to date without blocking.
+ */
+static void jobs_poll(struct shell *sh) {
+    if (sh->jobs.epfd >= 0) {
+        event_wait(sh, 0);
+    } else {
+        jobs_reap(&sh->jobs);
+    }
+}
+
+/**
+ * @brief Blocks until at least one child changes state. With pidfds this
+ * runs the event loop, which also delivers SIGINT to waiting builtins.
+ *
+ * @param sh A pointer to the shell structure.
+ * @return 0, or -1 if there is nothing left to wait for.
+ */
+int jobs_block(struct shell *sh) {
+    struct job_table *t = &sh->jobs;
+    if (t->epfd >= 0) {
+        return event_wait(sh, -1) < 0 ? -1 : 0;
+    }
+
+    struct rusage ru;
+    int status;
+    pid_t pid = wait4(-1, &status, t->job_control ? WUNTRACED : 0, &ru);
+    if (pid < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    job_charge(job_update(t, pid, status), status, &ru);
+    t->reaped++;
+    return 0;
+}
+
+/**
+ * @brief Waits for a foreground job to finish or stop.
+ *
+ * Children of other jobs that change state first are recorded as they are
+ * reaped so nothing is lost. Afterwards the shell takes the terminal back
+ * and restores its own terminal modes. A finished job is freed. A stopped
+ * job keeps the modes it left the terminal in and becomes a background
+ * job with an id so fg and bg can find it.
+ *
+ * @param sh A pointer to the shell structure.
+ * @param j The job.
+ * @return The shell exit status of the job, 128 plus the stop signal if it
+ * was stopped.
+ */
+int job_wait(struct shell *sh, struct job *j) {
+    struct job_table *t = &sh->jobs;
+    int64_t start = time_now_ns();
+
+    while (j->nlive > 0 && j->state != JOB_STOPPED) {
+        if (jobs_block(sh) != 0) {
+            perror("job_wait");
+            break;
+        }
+    }
+    stats_record(sh->stats, STATS_WAIT, time_now_ns() - start);
+
+    // get control of the shell
+    if (sh->shell_is_interactive) {
+        tcsetpgrp(sh->shell_terminal, sh->shell_pgid);
+        if (j->state == JOB_STOPPED) {
+            j->has_tmodes = tcgetattr(sh->shell_terminal, &j->tmodes) == 0;
+        }
+        tcsetattr(sh->shell_terminal, TCSADRAIN, &sh->shell_tmodes);
+    }
+
+    if (j->state == JOB_STOPPED) {
+        if (j->id == 0 && job_assign_id(t, j) != 0) {
+            fprintf(stderr, "job_wait: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        j->background = true;
+        t->current = j;
+        printf("\n");
+        job_print(t, j, false);
+        int stopsig = SIGTSTP;
+        for (size_t i = 0; i < j->nprocs; i++) {
+            if (j->procs[i].stopped) {
+                stopsig = WSTOPSIG(j->procs[i].status);
+            }
+        }
+        return 128 + stopsig;
+    }
+    // Move past the ^C the terminal echoed.
+    int last = j->procs[j->nprocs - 1].status;
+    if (sh->shell_is_interactive && WIFSIGNALED(last) && WTERMSIG(last) == SIGINT) {
+        printf("\n");
+    }
+    int rval = j->status;
+    job_remove(t, j);
+    return rval;
+}
+
+/**
+ * @brief Reports finished background jobs and frees them.
+ *
+ * @param sh A pointer to the shell structure.
+ */
+void jobs_notify(struct shell *sh) {
+    struct job_table *t = &sh->jobs;
+
+    jobs_poll(sh);
+    while (t->done_head != NULL) {
+        struct job *j = t->done_head;
+        if (sh->shell_is_interactive) {
+            job_print(t, j, false);
+        }
+        job_remove(t, j);
+    }
+}
+
+/**
+ * @brief Resolves a job spec: %n or n for job n, and %%, %+ or nothing for
+ * the current job. Prints an error naming the builtin if there is no job.
+ */
+static struct job *job_spec(struct job_table *t, const char *spec, const char *name) {
+    struct job *j;
+    if (spec == NULL || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0 ||
+        strcmp(spec, "%") == 0) {
+        j = t->current;
+        if (j == NULL) {
+            fprintf(stderr, "%s: no current job\n", name);
+        }
+        return j;
+    }
+    char *end;
+    long id = strtol(spec[0] == '%' ? spec + 1 : spec, &end, 10);
+    j = *end == '\0' && id > 0 && id <= INT_MAX ? job_get(t, (int)id) : NULL;
+    if (j == NULL) {
+        fprintf(stderr, "%s: %s: no such job\n", name, spec);
+    }
+    return j;
+}
+
+/**
+ * @brief Sends a signal to a job. With job control the job is a process
+ * group, without it its processes share the shell's group and each one
+ * that is still alive is signalled on its own.
+ *
+ * @param t The job table.
+ * @param j The job.
+ * @param sig The signal.
+ */
+void job_kill(const struct job_table *t, struct job *j, int sig) {
+    if (t->job_control) {
+        kill(-j->pgid, sig);
+        return;
+    }
+    for (size_t i = 0; i < j->nprocs; i++) {
+        if (!j->procs[i].done) {
+            kill(j->procs[i].pid, sig);
+        }
+    }
+}
+
+/**
+ * @brief Sends SIGCONT to every process of a job and marks it running.
+ */
+static void job_continue(struct job_table *t, struct job *j) {
+    for (size_t i = 0; i < j->nprocs; i++) {
+        j->procs[i].stopped = false;
+    }
+    j->nstopped = 0;
+    if (j->state == JOB_STOPPED) {
+        j->state = JOB_RUNNING;
+        t->running++;
+    }
+    job_kill(t, j, SIGCONT);
+}
+
+/**
+ * @brief The jobs built in command.
+ *
+ * - jobs: list every job with its id, state and command line.
+ * - jobs -l: also list the pid of every process in the job.
+ * - jobs -p: list only the process group id of each job.
+ *
+ * Finished jobs are forgotten once they have been listed.
+ *
+ * @param sh A pointer to the shell structure.
+ * @param argv The command and its arguments, argv[0] is "jobs".
+ * @return 0 on success, 2 on a bad option.
+ */
+int jobs_cmd(struct shell *sh, char **argv) {
+    struct job_table *t = &sh->jobs;
+    bool pids = false;
+    bool pgids = false;
+
+    for (int i = 1; argv[i]; i++) {
+        if (strcmp(argv[i], "-l") == 0) {
+            pids = true;
+        } else if (strcmp(argv[i], "-p") == 0) {
+            pgids = true;
+        } else {
+            fprintf(stderr, "jobs: usage: jobs [-l | -p]\n");
+            return 2;
+        }
+    }
+
+    jobs_poll(sh);
+    for (int id = 1; id <= t->max_id; id++) {
+        struct job *j = t->jobs[id - 1];
+        if (j == NULL) {
+            continue;
+        }
+        if (pgids) {
+            printf("%d\n", j->pgid);
+        } else {
+            job_print(t, j, pids);
+        }
+    }
+    while (t->done_head != NULL) {
+        job_remove(t, t->done_head);
+    }
+    return 0;
+}
+
+/**
+ * @brief The fg built in command.
+ *
+ * The job gets the terminal back together with the terminal modes it had
+ * when it was stopped, so full screen programs pick up where they left
+ * off, then it is continued and waited for like any foreground job.
+ *
+ * @param sh A pointer to the shell structure.
+ * @param argv The command and an optional job spec, argv[0] is "fg".
+ * @return The status of the job, 1 if there is no such job.
+ */
+int fg_cmd(struct shell *sh, char **argv) {
+    struct job_table *t = &sh->jobs;
+
+    jobs_poll(sh);
+    struct job *j = job_spec(t, argv[1], "fg");
+    if (j == NULL) {
+        return 1;
+    }
+    printf("%s\n", j->cmd);
+    fflush(stdout);
+    if (j->state == JOB_DONE) {
+        int rval = j->status;
+        job_remove(t, j);
+        return rval;
+    }
+
+    j->background = false;
+    if (sh->shell_is_interactive) {
+        tcsetpgrp(sh->shell_terminal, j->pgid);
+        if (j->has_tmodes) {
+            tcsetattr(sh->shell_terminal, TCSADRAIN, &j->tmodes);
+        }
+    }
+    job_continue(t, j);
+    return job_wait(sh, j);
+}
+
+/**
+ * @brief The bg built in command.
+ *
+ * @param sh A pointer to the shell structure.
+ * @param argv The command and optional job specs, argv[0] is "bg".
+ * @return 0 on success, 1 if any job was not found.
+ */
+int bg_cmd(struct shell *sh, char **argv) {
+    struct job_table *t = &sh->jobs;
+    int rval = 0;
+
+    jobs_poll(sh);
+    for (int i = 1; i == 1 || argv[i]; i++) {
+        struct job *j = job_spec(t, argv[i], "bg");
+        if (j == NULL) {
+            rval = 1;
+        } else if (j->state != JOB_STOPPED) {
+            fprintf(stderr, "bg: job %d already in background\n", j->id);
+        } else {
+            j->background = true;
+            job_continue(t, j);
+            size_t len = strlen(j->cmd);
+            printf("[%d]%c %s%s\n", j->id, j == t->current ? '+' : ' ', j->cmd,
+                   len > 0 && j->cmd[len - 1] == '&' ? "" : " &");
+        }
+        if (argv[i] == NULL) {
+            break;
+        }
+    }
+    return rval;
+}
+
+/**
+ * @brief Blocks until a job, or every background job when j is NULL, is no
+ * longer running. Other children are recorded as they change state.
+ * @return false if the wait was interrupted.
+ */
+static bool job_wait_running(struct shell *sh, struct job *j) {
+    struct job_table *t = &sh->jobs;
+    while (j == NULL ? t->running > 0 : j->state == JOB_RUNNING) {
+        if (sh->events.interrupted || jobs_block(sh) != 0) {
+            break;
+        }
+    }
+    return !sh->events.interrupted;
+}
+
+/**
+ * @brief The wait built in command.
+ *
+ * - wait: wait until no background job is running.
+ * - wait %n|pid...: wait for each job in turn.
+ *
+ * Jobs that finish are forgotten without being reported. A stopped job
+ * ends the wait, and so does SIGINT when the event loop is running.
+ *
+ * @param sh A pointer to the shell structure.
+ * @param argv The command and its arguments, argv[0] is "wait".
+ * @return The status of the last job waited for, 0 with no arguments,
+ * 127 if the last job was unknown and 130 if the wait was interrupted.
+ */
+int wait_cmd(struct shell *sh, char **argv) {
+    struct job_table *t = &sh->jobs;
+    int rval = 0;
+
+    sh->events.interrupted = false;
+    if (argv[1] == NULL) {
+        if (!job_wait_running(sh, NULL)) {
+            printf("\n");
+            return 128 + SIGINT;
+        }
+        while (t->done_head != NULL) {
+            job_remove(t, t->done_head);
+        }
+        return 0;
+    }
+
+    for (int i = 1; argv[i]; i++) {
+        struct job *j;
+        if (argv[i][0] == '%') {
+            j = job_spec(t, argv[i], "wait");
+        } else {
+            j = job_find_pid(t, atoi(argv[i]));
+            if (j == NULL) {
+                fprintf(stderr, "wait: pid %s is not a child of this shell\n", argv[i]);
+            }
+        }
+        if (j == NULL) {
+            rval = 127;
+            continue;
+        }
+        if (!job_wait_running(sh, j)) {
+            printf("\n");
+            return 128 + SIGINT;
+        }
+        if (j->state == JOB_STOPPED) {
+            rval = 128 + SIGTSTP;
+        } else {
+            rval = j->status;
+            job_remove(t, j);
+        }
+    }
+    return rval;
+}
+
+/**
+ * @brief Checks if a command ends with & and strips it. The & may be a
+ * token of its own or the last character of the last token.
+ *
+ * @param argv The parsed command.
+ * @return true if the command should run in the background.
+ */
+bool cmd_background(char **argv) {
+    size_t n = 0;
+    while (argv[n] != NULL) {
+        n++;
+    }
+    if (n == 0) {
+        return false;
+    }
+    char *last = argv[n - 1];
+    size_t len = strlen(last);
+    if (last[len - 1] != '&') {
+        return false;
+    }
+    if (len == 1) {
+        argv[n - 1] = NULL;
+    } else {
+        last[len - 1] = '\0';
+    }
+    return true;
+}
@@ -2,11 +2,11 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <ctype.h>
 #include <pwd.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <signal.h>
+#include <errno.h>
 
 /**
  * @brief Retrieves a shell prompt string from an environment variable.
@@ -90,86 +90,103 @@ int change_dir(char **dir) {
 }
 
 
+/**
+ * @brief Measures how much memory the tokens of a line need.
+ *
+ * @param line The command line string to measure.
+ * @param len The length of line.
+ * @param ntok Receives the number of tokens in the line.
+ * @return The size of the single block holding the NULL terminated pointer
+ * array followed by a copy of the line.
+ */
+static size_t cmd_measure(char const *line, size_t len, size_t *ntok) {
+    *ntok = scan_count_tokens(line, len);
+    return (*ntok + 1) * sizeof(char *) + len + 1;
+}
+
+/**
+ * @brief Fills a block sized by cmd_measure. The line is copied behind the
+ * pointer array and split in place by terminating each token.
+ *
+ * @param block The block, it must be at least as large as cmd_measure said.
+ * @param line The command line string to split.
+ * @param len The length of line.
+ * @param ntok The number of tokens reported by cmd_measure.
+ * @return The NULL terminated token array at the start of block.
+ */
+static char **cmd_fill(void *block, char const *line, size_t len, size_t ntok) {
+    char **tokens = block;
+    char *copy = (char *)(tokens + ntok + 1);
+
+    memcpy(copy, line, len + 1);
+    scan_split(copy, len, tokens);
+    tokens[ntok] = NULL; // Null-terminate the tokens array.
+    return tokens;
+}
+
 /**
  * @brief Parses a command line string into an array of tokens.
  *
  * This function takes a command line string as input and splits it into
  * individual tokens based on whitespace delimiters (spaces, tabs,
- * carriage returns, newlines, and form feeds). It dynamically allocates
- * memory for the tokens and returns an array of strings, where each string
- * represents a token. The array is null-terminated.
+ * carriage returns, newlines, and bells). A first pass counts the tokens
+ * so that the pointer array and a copy of the line are stored in one
+ * contiguous allocation, the second pass splits the copy in place. Both
+ * passes classify 64 bytes at a time with the SIMD scan kernels. The array
+ * is null-terminated. Unlike strtok this is reentrant and never grows a
+ * buffer.
  *
  * @param line The command line string to parse.
  * @return An array of strings representing the parsed tokens, or NULL on error.
- * The caller is responsible for freeing the allocated memory.
+ * The caller is responsible for freeing the memory with cmd_free.
  */
 char **cmd_parse(char const *line) {
-    int bufsize = 64; // Initial buffer size for tokens.
-    int position = 0;  // Current position in the tokens array.
-    char **tokens = malloc(bufsize * sizeof(char *)); // Allocate initial token array.
-    char *line_copy, *token;
+    size_t len = strlen(line);
+    size_t ntok;
+    size_t size = cmd_measure(line, len, &ntok);
 
-    // Check if initial memory allocation for tokens was successful.
-    if (tokens == NULL) {
+    // One allocation holds both the pointer array and the strings.
+    void *block = malloc(size);
+    if (block == NULL) {
         fprintf(stderr, "cmd_parse: allocation error\n");
         exit(EXIT_FAILURE); // Exit with an error code.
     }
+    return cmd_fill(block, line, len, ntok);
+}
 
-    // Create a copy of the input string to avoid modifying the original.
-    line_copy = strdup(line);
-    if (line_copy == NULL) {
-        fprintf(stderr, "cmd_parse: allocation error\n");
-        exit(EXIT_FAILURE); // Exit with an error code.
-    }
 
-    // Tokenize the string using strtok.
-    token = strtok(line_copy, " \t\r\n\a"); // Delimiters: space, tab, CR, LF, FF.
-    while (token != NULL) {
-        tokens[position] = token; // Store the token in the tokens array.
-        position++;
-
-        // Check if the tokens array needs to be resized.
-        if (position >= bufsize) {
-            bufsize += 64; // Increase buffer size.
-            tokens = realloc(tokens, bufsize * sizeof(char *)); // Reallocate memory.
-            if (tokens == NULL) {
-                fprintf(stderr, "cmd_parse: allocation error\n");
-                exit(EXIT_FAILURE); // Exit with an error code.
-            }
-        }
-
-        token = strtok(NULL, " \t\r\n\a"); // Get the next token.
-    }
+/**
+ * @brief Parses a command line string into an array of tokens allocated from
+ * an arena.
+ *
+ * This is cmd_parse for the read-parse-exec cycle. The single block comes
+ * from the arena so parsing a command does not call malloc once the arena
+ * has grown to fit the largest command seen.
+ *
+ * @param a The arena to allocate from.
+ * @param line The command line string to parse.
+ * @return An array of strings representing the parsed tokens. The memory is
+ * released by arena_reset, it must not be passed to cmd_free.
+ */
+char **cmd_parse_arena(struct arena *a, char const *line) {
+    size_t len = strlen(line);
+    size_t ntok;
+    size_t size = cmd_measure(line, len, &ntok);
 
-    tokens[position] = NULL; // Null-terminate the tokens array.
-    return tokens; // Return the array of tokens.
+    return cmd_fill(arena_alloc(a, size), line, len, ntok);
 }
 
 
 /**
  * @brief Frees the memory allocated for a command line argument array.
  *
- * This function frees the memory allocated for an array of strings (char **)
- * representing command line arguments. It first frees the memory allocated
- * for the first string (line[0]), which is assumed to be a duplicated string,
- * and then frees the memory allocated for the array itself.
+ * The pointer array and the strings it points to live in the single block
+ * allocated by cmd_parse, so one call to free releases everything.
  *
  * @param line The array of strings to free.
  * It's safe to pass NULL to this function.
  */
 void cmd_free(char **line) {
-    // Check if the input array is NULL. If so, there's nothing to free.
-    if (line == NULL) {
-        return; // Exit the function.
-    }
-
-    // Free the memory allocated for the first string in the array (line[0]).
-    // This is typically a duplicated string created by strdup or similar.
-    if (line[0] != NULL) { //Added check so that we do not try to free a NULL pointer.
-        free(line[0]);
-    }
-
-    // Free the memory allocated for the array of strings itself.
     free(line);
 }
 
@@ -191,40 +208,154 @@ char *trim_white(char *line) {
         return NULL; // Return NULL if the input is NULL.
     }
 
-    // Find the first non-whitespace character.
-    char *start = line;
-    while (isspace((unsigned char)*start)) {
-        start++;
-    }
+    // Find the first and last non-whitespace characters with the SIMD
+    // scanner, long machine generated lines are common in batch mode.
+    size_t len = strlen(line);
+    size_t start = scan_skip(line, len, SCAN_SPACE);
 
     // If the string is all whitespace, return an empty string.
-    if (*start == '\0') {
+    if (start == len) {
         return strdup(""); // Return a dynamically allocated empty string.
     }
 
-    // Find the end of the string.
-    char *end = line + strlen(line) - 1;
+    // Null-terminate the trimmed string.
+    size_t end = start + scan_rskip(line + start, len - start, SCAN_SPACE);
+    line[end] = '\0';
 
-    // Move back to the last non-whitespace character.
-    while (end > start && isspace((unsigned char)*end)) {
-        end--;
+    // Return a dynamically allocated copy of the trimmed string.
+    return strdup(line + start);
+}
+
+/**
+ * @brief Trims leading and trailing whitespace from a string into an arena.
+ *
+ * Works like trim_white, including terminating line after the last
+ * printable character, but the copy comes from the arena.
+ *
+ * @param a The arena to allocate from.
+ * @param line The string to trim.
+ * @return The trimmed copy, released by arena_reset, or NULL if line is NULL.
+ */
+char *trim_white_arena(struct arena *a, char *line) {
+    if (line == NULL) {
+        return NULL;
     }
 
-    // Null-terminate the trimmed string.
-    *(end + 1) = '\0';
+    // Skip the leading whitespace and terminate after the last
+    // non-whitespace character.
+    size_t len = strlen(line);
+    size_t start = scan_skip(line, len, SCAN_SPACE);
+    size_t end = start + scan_rskip(line + start, len - start, SCAN_SPACE);
+    line[end] = '\0';
 
-    // Return a dynamically allocated copy of the trimmed string.
-    return strdup(start);
+    return arena_strdup(a, line + start);
+}
+
+/**
+ * @brief The cd built in command.
+ *
+ * @param sh A pointer to the shell structure.
+ * @param argv The command and its arguments, argv[0] is "cd".
+ * @return 0 on success, 1 if the directory could not be changed.
+ */
+int cd_cmd(struct shell *sh, char **argv) {
+    UNUSED(sh);
+    return change_dir(argv) == 0 ? 0 : 1;
+}
+
+/**
+ * @brief The exit built in command, says goodbye when interactive, cleans
+ * up the shell and exits with the given status, or the status of the last
+ * command when there is none.
+ *
+ * @param sh A pointer to the shell structure.
+ * @param argv The command and its arguments, argv[0] is "exit".
+ * @return 1 if there are too many arguments, otherwise never returns.
+ */
+int exit_cmd(struct shell *sh, char **argv) {
+    int status = sh->last_status;
+    if (argv[1] != NULL) {
+        if (argv[2] != NULL) {
+            fprintf(stderr, "exit: too many arguments\n");
+            return 1;
+        }
+        char *end;
+        errno = 0;
+        long n = strtol(argv[1], &end, 10);
+        if (errno != 0 || end == argv[1] || *end != '\0') {
+            fprintf(stderr, "exit: %s: numeric argument required\n", argv[1]);
+            n = 2;
+        }
+        status = (int)(n & 0xff);
+    }
+    if (sh->shell_is_interactive) {
+        printf("Goodbye!\n");
+    }
+    sh_destroy(sh); // argv lives in the shell's arena.
+    exit(status);
+}
+
+#define BUILTIN_ENTRY(name, run, flags) {name, run, flags},
+
+/* Every command do_builtin handles, from SHELL_BUILTINS. */
+static const struct builtin builtins[] = {SHELL_BUILTINS(BUILTIN_ENTRY)};
+
+/**
+ * @brief Looks a command name up in the shell's builtins. The perfect
+ * hash table is built on the first lookup.
+ *
+ * @param name The command name.
+ * @return The builtin, or NULL if name is not one.
+ */
+const struct builtin *builtin_find(const char *name) {
+    static struct builtin_table table;
+    if (table.slots == NULL &&
+        builtin_table_build(&table, builtins, sizeof(builtins) / sizeof(builtins[0])) != 0) {
+        // Out of memory, fall back to a scan.
+        for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+            if (strcmp(name, builtins[i].name) == 0) {
+                return &builtins[i];
+            }
+        }
+        return NULL;
+    }
+    return builtin_table_find(&table, name);
+}
+
+/**
+ * @brief Checks if a command name is handled by do_builtin.
+ *
+ * @param name The command name.
+ * @return true if name is a built-in command.
+ */
+bool is_builtin(const char *name) {
+    return builtin_find(name) != NULL;
 }
 
 /**
  * @brief Executes built-in shell commands.
  *
  * This function checks if the given command is a built-in shell command
- * and executes it if it is. Currently supported built-in commands are:
+ * and executes it if it is. The built-in commands are listed with their
+ * handlers in SHELL_BUILTINS:
  * - exit: Exits the shell.
  * - cd: Changes the current directory.
+ * - hash: Shows or updates the command path cache.
+ * - jobs, fg, bg, wait: Lists and controls jobs.
+ * - parallel: Runs a command over a list of arguments in parallel.
+ * - dag: Runs a graph of dependent commands in parallel.
  * - history: Prints the command history.
+ * - echo, printf, pwd, true, false, test, [: The common utilities, run
+ *   without a fork.
+ *
+ * echo, printf and pwd queue their output on sh->out instead of stdio, so a
+ * script of them costs a write per 64 KB rather than a process each. Other
+ * builtins write through stdio, so whichever buffer they do not use is
+ * flushed first to keep the output in order.
+ *
+ * Every command, built in or not, goes through here first, so the name
+ * is looked up in a perfect hash table rather than compared with each
+ * builtin in turn.
  *
  * @param sh A pointer to the shell structure.
  * @param argv An array of strings containing the command and its arguments.
@@ -235,34 +366,22 @@ bool do_builtin(struct shell *sh, char **argv) {
     if (argv == NULL || *argv == NULL) { //Safety check for NULL
         return false;
     }
-    // Check for the "exit" command.
-    if (strcmp(*argv, "exit") == 0) { 
-        printf("Goodbye!\n");
-        cmd_free(argv);    // Free the command arguments.
-        sh_destroy(sh);   // Clean up the shell.
-        exit(0);          // Exit the shell with a success code.
-    }
-
-    // Check for the "cd" command.
-    if (strcmp(*argv, "cd") == 0) { 
-        change_dir(argv); // Change the directory.
-        return true;       // Indicate that a built-in command was executed.
+    const struct builtin *b = builtin_find(*argv);
+    if (b == NULL) {
+        return false;
     }
-
-    // Check for the "history" command.
-    if (strcmp(*argv, "history") == 0) { 
-        HIST_ENTRY **hist_list = history_list(); // Get the history list.
-        if (hist_list) {
-            // Iterate through the history list and print each entry.
-            for (int i = 0; hist_list[i]; i++) {
-                printf("%d: %s\n", i + history_base, hist_list[i]->line);
-            }
-        }
-        return true; // Indicate that a built-in command was executed.
+    if (b->flags & BUILTIN_BUFFERED) {
+        fflush(stdout);
+    } else {
+        sh_flush(sh);
     }
-
-    // If none of the built-in commands were found, return false.
-    return false;
+    int64_t start = time_now_ns();
+    sh->last_status = b->run(sh, argv);
+    int64_t end = time_now_ns();
+    stats_record(sh->stats, STATS_BUILTIN, end - start);
+    trace_span(sh->trace, TRACE_BUILTIN, b->name, start, end);
+    stats_count(sh->stats, STATS_BUILTINS);
+    return true;
 }
 
 
@@ -271,17 +390,27 @@ bool do_builtin(struct shell *sh, char **argv) {
  *
  * This function performs the necessary initialization steps for the shell,
  * including:
- * - Determining if the shell is running interactively.
+ * - Determining if the shell is running interactively. parse_args must
+ *   have been called first.
  * - Putting the shell in its own process group.
  * - Ignoring various signals.
  * - Setting the shell's prompt.
+ * - Selecting the launch engine and pipe size.
+ * - Allocating the output buffer of the buffered builtins and the
+ *   statistics.
+ * - Opening the trace file named by -t or MY_TRACE.
+ * - Creating the job table and the event loop.
+ * - Opening the history file of an interactive shell.
  *
  * @param sh A pointer to the shell structure to be initialized.
  */
 void sh_init(struct shell *sh) {
-    // Determine if the shell is running interactively.
+    // Determine if the shell is running interactively. Running -c or a
+    // script never is, even from a terminal.
     sh->shell_terminal = STDIN_FILENO;
-    sh->shell_is_interactive = isatty(sh->shell_terminal);
+    sh->shell_is_interactive = sh->command == NULL && sh->script == NULL &&
+                               isatty(sh->shell_terminal);
+    sh->last_status = 0;
 
     // If the shell is interactive, put it in its own process group and
     // ensure it's in the foreground.
@@ -290,8 +419,8 @@ void sh_init(struct shell *sh) {
             kill(-sh->shell_pgid, SIGTTIN);
         }
 
-        // Ignore common signals that could interrupt the shell.
-        signal(SIGINT, SIG_IGN);  // Ignore interrupt signals (Ctrl+C).
+        // Ignore common signals that could interrupt the shell. SIGINT
+        // (Ctrl+C) is read from a signalfd by the event loop instead.
         signal(SIGQUIT, SIG_IGN); // Ignore quit signals (Ctrl+\).
         signal(SIGTSTP, SIG_IGN); // Ignore stop signals (Ctrl+Z).
         signal(SIGTTIN, SIG_IGN); // Ignore background input signals.
@@ -317,6 +446,75 @@ void sh_init(struct shell *sh) {
     // Set the shell's prompt using the MY_PROMPT environment variable
     // or a default prompt if it's not set.
     sh->prompt = get_prompt("MY_PROMPT");
+
+    // Pick how child processes are created, MY_LAUNCH=fork restores the
+    // classic fork/exec path.
+    sh->launch = get_launch_engine("MY_LAUNCH");
+
+    // MY_PIPE_SIZE enlarges every pipeline pipe, 0 keeps the kernel default.
+    const char *pipe_size = getenv("MY_PIPE_SIZE");
+    sh->pipe_size = pipe_size ? atoi(pipe_size) : 0;
+
+    // Start with an empty command path cache.
+    path_cache_init(&sh->paths);
+
+    // Per command allocations come from the arena, reset after each command.
+    arena_init(&sh->arena, 0);
+
+    // echo, printf and pwd queue their output here until sh_flush.
+    sh->out = malloc(sizeof(*sh->out));
+    if (sh->out == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    writer_init(sh->out, STDOUT_FILENO);
+
+    // Counters and stage histograms for the stats builtin, always on.
+    sh->stats = malloc(sizeof(*sh->stats));
+    if (sh->stats == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    stats_reset(sh->stats);
+
+    // Opt in Chrome trace of every line, builtin and child process. A file
+    // that cannot be opened only costs the trace.
+    sh->trace = trace_start(sh->trace_path, "MY_TRACE");
+
+    // Track jobs and route SIGCHLD to a signalfd. Only an interactive shell
+    // puts jobs in process groups of their own and reports stops.
+    jobs_init(&sh->jobs);
+    sh->jobs.trace = sh->trace;
+    sh->jobs.job_control = sh->shell_is_interactive;
+
+    // Every wait happens in one epoll loop: terminal, pidfds, signals and
+    // the idle timer.
+    if (event_init(sh) != 0) {
+        perror("event_init");
+        exit(1);
+    }
+
+    // Only interactive commands are recorded, a broken history file just
+    // leaves history to this session.
+    sh->history.fd = -1;
+    if (sh->shell_is_interactive && hist_init(sh) != 0) {
+        perror("history");
+    }
+}
+
+/**
+ * @brief Checks if the final command may replace the shell.
+ *
+ * An interactive shell always has to come back to the prompt. Anything
+ * the shell has to do after the last command (waiting for jobs, flushing
+ * state, recording the command's end in the trace) must also veto the
+ * exec here.
+ *
+ * @param sh A pointer to the shell structure.
+ * @return true if the last command can be exec'd in place of the shell.
+ */
+bool sh_can_exec_last(struct shell *sh) {
+    return !sh->shell_is_interactive && sh->jobs.count == 0 && sh->trace == NULL;
 }
 
 /**
@@ -324,37 +522,89 @@ void sh_init(struct shell *sh) {
  *
  * This function performs cleanup tasks for the shell, such as
  * freeing dynamically allocated memory. Currently, it frees the
- * memory allocated for the shell prompt.
+ * memory allocated for the shell prompt, the command path cache and the
+ * per command arena.
  *
  * @param sh A pointer to the shell structure to be cleaned up.
  */
 void sh_destroy(struct shell *sh) {
+    // Write out and free what the buffered builtins left queued.
+    sh_flush(sh);
+    free(sh->out);
+    sh->out = NULL;
+    free(sh->stats);
+    sh->stats = NULL;
+
+    // Write out the rest of the trace and end its JSON array.
+    trace_close(sh->trace);
+    sh->trace = NULL;
+    sh->jobs.trace = NULL;
+
     // Free the memory allocated for the shell prompt if it's not NULL.
     if (sh->prompt != NULL) {
         free(sh->prompt);
         sh->prompt = NULL; // Set the pointer to NULL to prevent accidental use after freeing.
     }
+
+    // Free the remembered command locations.
+    path_cache_destroy(&sh->paths);
+
+    // Free the per command arena.
+    arena_destroy(&sh->arena);
+
+    // Close the event loop, then forget the jobs, anything still running
+    // keeps running.
+    event_destroy(sh);
+    jobs_destroy(&sh->jobs);
+
+    // Unmap the history file and free the history ring.
+    hist_close(&sh->history);
+    hist_ring_destroy(&sh->recent);
     // TODO: further cleanup tasks here
 }
 
+/**
+ * @brief Writes out the output queued by the buffered builtins.
+ *
+ * A failed write is not reported, the command that queued the output has
+ * already returned. The error is cleared so output can go through again
+ * once standard output works, as it would with stdio.
+ *
+ * @param sh A pointer to the shell structure.
+ */
+void sh_flush(struct shell *sh) {
+    if (sh->out != NULL && writer_flush(sh->out) != 0) {
+        sh->out->error = 0;
+    }
+}
+
 /**
  * @brief Parses command-line arguments.
  *
  * This function parses the command-line arguments passed to the program.
- * It currently supports the following option:
+ * It currently supports the following options:
  * -v: Print the version number and exit.
+ * -c command: Run command (one per line) instead of reading input.
+ * -t file: Write a Chrome trace of the session to file, like MY_TRACE.
+ * script: Run the commands in the file script.
  *
  * If an invalid option is encountered, it prints a usage message to stderr
  * and exits with an error code.
  *
+ * @param sh The shell, sh->command, sh->script and sh->trace_path are set.
  * @param argc The number of command-line arguments.
  * @param argv An array of strings containing the command-line arguments.
  */
-void parse_args(int argc, char **argv) {
+void parse_args(struct shell *sh, int argc, char **argv) {
     int opt;
 
-    // Use getopt to parse command-line options.
-    while ((opt = getopt(argc, argv, "v")) != -1) {
+    sh->command = NULL;
+    sh->script = NULL;
+    sh->trace_path = NULL;
+
+    // Use getopt to parse command-line options. The leading + stops at the
+    // first operand so options meant for the script are left alone.
+    while ((opt = getopt(argc, argv, "+vc:t:")) != -1) {
         switch (opt) {
             case 'v':
                 // Print the version number and exit with a success code.
@@ -362,10 +612,25 @@ void parse_args(int argc, char **argv) {
                 exit(0);
                 break; // This break is technically unnecessary due to the exit() call.
 
+            case 'c':
+                // Run the given command string instead of reading input.
+                sh->command = optarg;
+                break;
+
+            case 't':
+                // Trace the session into the given file.
+                sh->trace_path = optarg;
+                break;
+
             default:  // '?' indicates an invalid option.
                 // Print a usage message to stderr and exit with an error code.
-                fprintf(stderr, "Usage: %s [-v]\n", *argv); // Corrected: *argv instead of argv
+                fprintf(stderr, "Usage: %s [-v] [-t trace] [-c command | script]\n", *argv);
                 exit(1);
         }
     }
+
+    // The first operand is a script to run when there is no -c.
+    if (sh->command == NULL && optind < argc) {
+        sh->script = argv[optind];
+    }
 }
@@ -2,8 +2,13 @@
 #define LAB_H
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
 #include <termios.h>
+#include <signal.h>
+#include <time.h>
 #include <unistd.h>
 
 #define lab_VERSION_MAJOR 1
@@ -15,6 +20,449 @@ extern "C"
 {
 #endif
 
+  /**
+   * @brief How the shell creates child processes. LAUNCH_SPAWN uses
+   * posix_spawn which never copies the shell image, LAUNCH_FORK is the
+   * classic fork/exec path.
+   */
+  enum launch_engine
+  {
+    LAUNCH_SPAWN,
+    LAUNCH_FORK,
+  };
+
+  /**
+   * @brief A remembered command location in the path cache. A NULL path
+   * records that the command was not found on PATH.
+   */
+  struct path_entry
+  {
+    char *name;
+    char *path;
+    unsigned long hits;
+  };
+
+  /**
+   * @brief Open addressing hash table mapping command names to the full path
+   * found by searching PATH. All entries are dropped when PATH changes and
+   * not found entries are dropped when any PATH directory's mtime changes.
+   */
+  struct path_cache
+  {
+    struct path_entry *table;
+    size_t size;
+    size_t count;
+    size_t negatives;
+    char *path_env;
+    struct timespec *dir_mtime;
+    size_t ndirs;
+    size_t dir_cap;
+    bool snapshot;
+    unsigned long hits;
+    unsigned long neg_hits;
+    unsigned long misses;
+  };
+
+  /**
+   * @brief Delimiter classes understood by the scan functions. SCAN_TOKEN
+   * is what cmd_parse splits on, SCAN_SPACE is isspace in the C locale.
+   */
+  enum scan_class
+  {
+    SCAN_TOKEN,
+    SCAN_SPACE,
+  };
+
+  /**
+   * @brief Implementations of the delimiter scanner. The best one the CPU
+   * supports is selected with cpuid on first use.
+   */
+  enum scan_kernel
+  {
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2,
+  };
+
+  struct arena_chunk;
+
+  /**
+   * @brief Bump pointer allocator for memory that only lives for one command.
+   * The counters let tests verify that steady state command processing does
+   * not call malloc.
+   */
+  struct arena
+  {
+    struct arena_chunk *chunk;
+    size_t used;
+    size_t total;
+    size_t high;
+    unsigned long mallocs;
+    unsigned long allocs;
+    unsigned long resets;
+  };
+
+  /**
+   * @brief Line oriented input for non-interactive shells. Regular files are
+   * mmap'd, pipes are read in large chunks and -c strings are split in
+   * place, so none of them go through readline. shared is set when the
+   * commands read the same descriptor, stdin: a pipe is then read up to
+   * the end of the line only and a mapped file's offset follows the line.
+   */
+  struct line_reader
+  {
+    int fd;
+    char *buf;
+    size_t len;
+    size_t cap;
+    size_t pos;
+    size_t scan;
+    char *tail;
+    bool mapped;
+    bool eof;
+    bool owns_fd;
+    bool shared;
+  };
+
+  /* Pieces a writer queues before it must flush, the kernel's IOV_MAX. */
+#define WRITER_IOV 1024
+  /* Bytes of copied output a writer holds before it must flush. */
+#define WRITER_BUF 65536
+
+  /**
+   * @brief Buffered output for builtins that print a lot. Short pieces are
+   * copied into buf, long ones are queued by reference, and everything
+   * goes out in one writev when either fills up or on writer_flush.
+   */
+  struct writer
+  {
+    int fd;
+    int niov;
+    int error;
+    size_t used;
+    struct iovec iov[WRITER_IOV];
+    char buf[WRITER_BUF];
+  };
+
+  /**
+   * @brief The process group and standard streams of a launched process.
+   * A pgid of 0 starts a new group, a descriptor of -1 keeps the shell's.
+   */
+  struct launch_opts
+  {
+    pid_t pgid;
+    int fd_in;
+    int fd_out;
+    int fd_err;
+    bool foreground;
+  };
+
+#define LAUNCH_OPTS_INIT {0, -1, -1, -1, true}
+
+  /**
+   * @brief The state of a job as last reported by waitpid.
+   */
+  enum job_state
+  {
+    JOB_RUNNING,
+    JOB_STOPPED,
+    JOB_DONE,
+  };
+
+  /**
+   * @brief One process of a job. status is the raw waitpid status once the
+   * process has finished.
+   */
+  struct job_proc
+  {
+    pid_t pid;
+    int status;
+    int pidfd;
+    bool done;
+    bool stopped;
+  };
+
+  /**
+   * @brief A pipeline or single command started by the shell. A job and its
+   * command text live in one allocation. Foreground jobs have id 0 until
+   * they are stopped. tmodes holds the terminal modes the job had when it
+   * was stopped so fg can give them back. usage adds up what wait4 reported
+   * for the processes that have finished, maxrss is the largest of them.
+   */
+  struct job
+  {
+    int id;
+    pid_t pgid;
+    enum job_state state;
+    bool background;
+    int status;
+    size_t nprocs;
+    size_t nlive;
+    size_t nstopped;
+    struct termios tmodes;
+    bool has_tmodes;
+    struct rusage usage;
+    char *cmd;
+    struct job *next;
+    struct job_proc procs[];
+  };
+
+  /**
+   * @brief A slot in the pid index of the job table.
+   */
+  struct job_slot
+  {
+    pid_t pid;
+    struct job *job;
+    size_t proc;
+  };
+
+  struct trace;
+
+  /**
+   * @brief Every job the shell is tracking. Background jobs are found by id
+   * through jobs[id - 1] and any child is found by pid through an open
+   * addressing hash table, so both lookups are O(1) no matter how many jobs
+   * are running. Children are reaped when SIGCHLD is read from sigfd and
+   * finished background jobs are queued on the done list until reported.
+   * current is the job fg and bg act on by default. When epfd is set every
+   * process also has a pidfd in that epoll set, exits are reaped from
+   * their pidfd and SIGCHLD only reports stops and continues, unless some
+   * processes could not get a pidfd (unwatched). trace, when the shell is
+   * tracing, gets an end event for every process that finishes.
+   * job_control is set for an interactive shell: every job then leads a
+   * process group of its own and stops and continues are reported. Without
+   * it children stay in the shell's process group and only exits are
+   * collected, so a script run from a terminal never has its commands
+   * stopped by SIGTTIN.
+   */
+  struct job_table
+  {
+    struct job **jobs;
+    int max_id;
+    int cap;
+    size_t count;
+    struct job_slot *pids;
+    size_t pid_size;
+    size_t pid_count;
+    size_t running;
+    size_t unwatched;
+    struct job *current;
+    struct job *done_head;
+    struct job *done_tail;
+    int sigfd;
+    int epfd;
+    sigset_t old_mask;
+    unsigned long reaped;
+    struct trace *trace;
+    bool job_control;
+  };
+
+  /**
+   * @brief What an epoll event is for. The kind is kept in the high 32 bits
+   * of the epoll data and the pid of an EVENT_CHILD in the low 32 bits.
+   */
+  enum event_kind
+  {
+    EVENT_TERMINAL = 1,
+    EVENT_CHILD,
+    EVENT_SIGCHLD,
+    EVENT_SIGNAL,
+    EVENT_TIMER,
+  };
+
+  /**
+   * @brief The shell's event loop. One epoll set watches the terminal
+   * (through readline's callback interface), a pidfd for every child, the
+   * SIGCHLD signalfd of the job table, a signalfd for SIGINT and SIGWINCH
+   * and a timerfd for the idle timeout.
+   */
+  struct event_loop
+  {
+    int epfd;
+    int sigfd;
+    int timerfd;
+    int idle_timeout;
+    bool at_prompt;
+    bool interrupted;
+    bool quit;
+    bool timed_out;
+    unsigned long wakeups;
+    unsigned long tty_events;
+    unsigned long child_events;
+    unsigned long signal_events;
+    unsigned long timer_events;
+  };
+
+  /**
+   * @brief A posting list of the trigram index: the history entries, in
+   * increasing order, whose command contains the trigram key.
+   */
+  struct tri_list
+  {
+    uint32_t key;
+    uint32_t count;
+    uint32_t cap;
+    uint32_t *ids;
+  };
+
+  /**
+   * @brief Trigram index over the commands of the history file. Every
+   * distinct run of three bytes maps to its posting list through an open
+   * addressing table. The first indexed entries are covered and
+   * hist_index_update adds the rest as the file grows.
+   */
+  struct tri_index
+  {
+    struct tri_list *table;
+    size_t size;
+    size_t used;
+    size_t indexed;
+  };
+
+  /**
+   * @brief The persistent history file. Each command is one binary record
+   * (start time, duration, exit status, directory and command) appended
+   * with a single O_APPEND write, so shells sharing the file never
+   * interleave. The file is mmap'd and offsets holds where each record
+   * starts, filled in on the first lookup by number and extended by
+   * hist_refresh as this or other shells append. path is NULL when there
+   * is no history file.
+   */
+  struct hist_store
+  {
+    int fd;
+    char *path;
+    const char *map;
+    size_t map_size;
+    size_t *offsets;
+    size_t count;
+    size_t cap;
+    size_t scanned;
+    struct tri_index index;
+  };
+
+  /**
+   * @brief One decoded history record. The strings point into the mapping
+   * of the history file.
+   */
+  struct hist_entry
+  {
+    int64_t time;
+    int64_t duration;
+    int status;
+    const char *cwd;
+    const char *cmd;
+    size_t cmd_len;
+  };
+
+  /**
+   * @brief What adding a command that is already in the history ring does.
+   * HIST_DUPS_IGNORE skips it if it repeats the newest entry,
+   * HIST_DUPS_ERASE removes the earlier copy wherever it is.
+   */
+  enum hist_dups
+  {
+    HIST_DUPS_KEEP,
+    HIST_DUPS_IGNORE,
+    HIST_DUPS_ERASE,
+  };
+
+  struct ring_argv;
+
+  /**
+   * @brief The latest commands of an interactive shell, for the arrow keys
+   * and history expansion. A fixed array of cap slots used as a ring, the
+   * oldest entry at head. Entries erased as duplicates leave NULL holes
+   * until the ring is compacted. parsed caches the argv of entries that
+   * have been replayed. With HIST_DUPS_ERASE set is an open addressing hash
+   * set of slot numbers plus one, keyed by the hashes of their lines.
+   */
+  struct hist_ring
+  {
+    char **lines;
+    uint64_t *hashes;
+    struct ring_argv **parsed;
+    size_t cap;
+    size_t head;
+    size_t count;
+    size_t holes;
+    uint32_t *set;
+    size_t set_size;
+    enum hist_dups dups;
+  };
+
+  /* Every power of two is split into 2^STATS_SUB_BITS buckets, within 3%. */
+#define STATS_SUB_BITS 5
+  /* Nanoseconds from 2^STATS_MAX_BITS, about 78 hours, share the last bucket. */
+#define STATS_MAX_BITS 48
+#define STATS_BUCKETS ((STATS_MAX_BITS - STATS_SUB_BITS + 1) << STATS_SUB_BITS)
+
+  /**
+   * @brief The stages of running a line that the shell times, in the order
+   * they happen.
+   */
+  enum stats_stage
+  {
+    STATS_READ,    // Waiting for the line, at the prompt or from the input
+    STATS_TRIM,    // trim_white
+    STATS_PARSE,   // cmd_parse and pipeline_split
+    STATS_BUILTIN, // Running a builtin
+    STATS_LAUNCH,  // fork or posix_spawn of one process
+    STATS_WAIT,    // Waiting for a foreground job
+    STATS_NSTAGES,
+  };
+
+  /**
+   * @brief Events the shell counts.
+   */
+  enum stats_counter
+  {
+    STATS_LINES,         // Lines run, blank ones not included
+    STATS_BUILTINS,      // Builtins run
+    STATS_PROCESSES,     // Processes launched
+    STATS_LAUNCH_ERRORS, // Commands that could not be launched
+    STATS_FAILURES,      // Lines that ended with a non-zero status
+    STATS_NCOUNTERS,
+  };
+
+  /**
+   * @brief A latency histogram in fixed memory, in the style of HDR
+   * histograms: log-linear buckets of nanoseconds plus exact count, sum,
+   * min and max.
+   */
+  struct stats_hist
+  {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[STATS_BUCKETS];
+  };
+
+  /**
+   * @brief The shell's always-on counters and stage histograms, collected
+   * from the time_now_ns reading in since onwards.
+   */
+  struct stats
+  {
+    int64_t since;
+    uint64_t counters[STATS_NCOUNTERS];
+    struct stats_hist stages[STATS_NSTAGES];
+  };
+
+  /**
+   * @brief What a trace event is about: a command line, a child process,
+   * the shell launching one, or a builtin.
+   */
+  enum trace_cat
+  {
+    TRACE_COMMAND,
+    TRACE_PROCESS,
+    TRACE_LAUNCH,
+    TRACE_BUILTIN,
+  };
+
   struct shell
   {
     int shell_is_interactive;
@@ -22,6 +470,22 @@ extern "C"
     struct termios shell_tmodes;
     int shell_terminal;
     char *prompt;
+    enum launch_engine launch;
+    int pipe_size;
+    struct path_cache paths;
+    struct arena arena;
+    struct job_table jobs;
+    struct event_loop events;
+    struct hist_store history;
+    struct hist_ring recent;
+    struct writer *out;
+    struct stats *stats;
+    struct trace *trace;
+    int64_t parse_ns;
+    const char *command;
+    const char *script;
+    const char *trace_path;
+    int last_status;
   };
 
 
@@ -48,11 +512,30 @@ extern "C"
    */
   int change_dir(char **dir);
 
+  /**
+   * @brief The cd built in command, change_dir with an exit status.
+   *
+   * @param sh The shell
+   * @param argv The command and its arguments
+   * @return 0 on success, 1 on error
+   */
+  int cd_cmd(struct shell *sh, char **argv);
+
+  /**
+   * @brief The exit built in command. Frees the shell and exits with the
+   * status given as its argument, modulo 256, or with sh->last_status.
+   * argv must not be used by the caller afterwards.
+   *
+   * @param sh The shell
+   * @param argv The command and its arguments
+   * @return 1 on too many arguments, otherwise never returns
+   */
+  int exit_cmd(struct shell *sh, char **argv);
+
   /**
    * @brief Convert line read from the user into to format that will work with
-   * execvp. We limit the number of arguments to ARG_MAX loaded from sysconf.
-   * This function allocates memory that must be reclaimed with the cmd_free
-   * function.
+   * execvp. The pointer array and all of the strings are stored in a single
+   * allocation that must be reclaimed with the cmd_free function.
    *
    * @param line The line to process
    *
@@ -79,6 +562,229 @@ extern "C"
   char *trim_white(char *line);
 
 
+  /**
+   * @brief Same as cmd_parse but the result is allocated from the arena and
+   * must not be passed to cmd_free. It is released by arena_reset.
+   *
+   * @param a The arena to allocate from
+   * @param line The line to process
+   * @return The line read in a format suitable for exec
+   */
+  char **cmd_parse_arena(struct arena *a, char const *line);
+
+  /**
+   * @brief Same as trim_white but the trimmed copy is allocated from the
+   * arena, so it is released by arena_reset instead of free.
+   *
+   * @param a The arena to allocate from
+   * @param line The line to trim
+   * @return The new line with no whitespace
+   */
+  char *trim_white_arena(struct arena *a, char *line);
+
+  /**
+   * @brief Return the fastest scan kernel the CPU supports.
+   *
+   * @return The kernel
+   */
+  enum scan_kernel scan_best_kernel(void);
+
+  /**
+   * @brief Force the kernel used by all scan functions.
+   *
+   * @param kernel The kernel
+   * @return 0 on success, -1 if the CPU does not support it
+   */
+  int scan_set_kernel(enum scan_kernel kernel);
+
+  /**
+   * @brief Return the scan kernel in use.
+   *
+   * @return The kernel
+   */
+  enum scan_kernel scan_get_kernel(void);
+
+  /**
+   * @brief Find the first byte of s that is not a delimiter.
+   *
+   * @param s The string
+   * @param len The number of bytes to scan
+   * @param cls The delimiter class
+   * @return The offset of the byte, or len if every byte is a delimiter
+   */
+  size_t scan_skip(const char *s, size_t len, enum scan_class cls);
+
+  /**
+   * @brief Measure s without its trailing delimiters.
+   *
+   * @param s The string
+   * @param len The number of bytes to scan
+   * @param cls The delimiter class
+   * @return The length of s once trailing delimiters are removed
+   */
+  size_t scan_rskip(const char *s, size_t len, enum scan_class cls);
+
+  /**
+   * @brief Count the SCAN_TOKEN separated tokens in s.
+   *
+   * @param s The string
+   * @param len The number of bytes to scan
+   * @return The number of tokens
+   */
+  size_t scan_count_tokens(const char *s, size_t len);
+
+  /**
+   * @brief Split s in place into SCAN_TOKEN separated tokens, terminating
+   * each one and storing its start in tokens.
+   *
+   * @param s The NUL terminated string
+   * @param len The length of s
+   * @param tokens Room for scan_count_tokens(s, len) pointers
+   * @return The number of tokens stored
+   */
+  size_t scan_split(char *s, size_t len, char **tokens);
+
+  /**
+   * @brief Initialize an arena. A zeroed arena is also valid.
+   *
+   * @param a The arena
+   * @param size The initial capacity in bytes, 0 to allocate on first use
+   */
+  void arena_init(struct arena *a, size_t size);
+
+  /**
+   * @brief Allocate memory that lives until the next arena_reset. Exits the
+   * shell if the system is out of memory.
+   *
+   * @param a The arena
+   * @param size The number of bytes
+   * @return Memory aligned for any type
+   */
+  void *arena_alloc(struct arena *a, size_t size);
+
+  /**
+   * @brief Copy a string into the arena.
+   *
+   * @param a The arena
+   * @param s The string to copy
+   * @return The copy
+   */
+  char *arena_strdup(struct arena *a, const char *s);
+
+  /**
+   * @brief Release everything allocated from the arena since the last reset.
+   * Multiple chunks are merged into one sized for the high water mark.
+   *
+   * @param a The arena
+   */
+  void arena_reset(struct arena *a);
+
+  /**
+   * @brief Free all memory held by the arena.
+   *
+   * @param a The arena
+   */
+  void arena_destroy(struct arena *a);
+
+  /**
+   * @brief What a built in command does, for callers deciding where and how
+   * it may run.
+   */
+  enum builtin_flags
+  {
+    BUILTIN_STATE = 1 << 0,  // Changes the shell itself, must run in it
+    BUILTIN_FORKS = 1 << 1,  // Starts child processes
+    BUILTIN_OUTPUT = 1 << 2, // Writes to standard output
+    BUILTIN_BUFFERED = 1 << 3, // Writes through the shell's writer, sh->out
+    BUILTIN_PREFIX = 1 << 4,   // Takes the rest of the line, pipes and all
+  };
+
+  /**
+   * @brief A built in command: its name, handler and flags. The handler
+   * returns the command's exit status.
+   */
+  struct builtin
+  {
+    const char *name;
+    int (*run)(struct shell *sh, char **argv);
+    unsigned flags;
+  };
+
+  /**
+   * @brief A perfect hash table over a list of builtins. Every name lands
+   * in a slot of its own for hash seed, so a lookup is one hash and one
+   * strcmp however many builtins there are. slots hold list indices plus
+   * one, 0 marks an empty slot.
+   */
+  struct builtin_table
+  {
+    const struct builtin *list;
+    size_t count;
+    uint16_t *slots;
+    size_t mask;
+    uint64_t seed;
+  };
+
+  /**
+   * @brief Every built in command of the shell as X("name", handler, flags),
+   * expanded into the registry do_builtin looks commands up in.
+   */
+#define SHELL_BUILTINS(X)                                                      \
+  X("exit", exit_cmd, BUILTIN_STATE)                                           \
+  X("cd", cd_cmd, BUILTIN_STATE)                                               \
+  X("hash", hash_cmd, BUILTIN_STATE | BUILTIN_OUTPUT)                          \
+  X("jobs", jobs_cmd, BUILTIN_STATE | BUILTIN_OUTPUT)                          \
+  X("fg", fg_cmd, BUILTIN_STATE)                                               \
+  X("bg", bg_cmd, BUILTIN_STATE | BUILTIN_OUTPUT)                              \
+  X("wait", wait_cmd, BUILTIN_STATE)                                           \
+  X("parallel", parallel_cmd, BUILTIN_FORKS | BUILTIN_OUTPUT)                  \
+  X("dag", dag_cmd, BUILTIN_FORKS | BUILTIN_OUTPUT)                            \
+  X("history", history_cmd, BUILTIN_OUTPUT)                                    \
+  X("echo", echo_cmd, BUILTIN_OUTPUT | BUILTIN_BUFFERED)                       \
+  X("printf", printf_cmd, BUILTIN_OUTPUT | BUILTIN_BUFFERED)                   \
+  X("pwd", pwd_cmd, BUILTIN_OUTPUT | BUILTIN_BUFFERED)                         \
+  X("true", true_cmd, 0)                                                       \
+  X("false", false_cmd, 0)                                                     \
+  X("test", test_cmd, 0)                                                       \
+  X("[", test_cmd, 0)                                                          \
+  X("time", time_cmd, BUILTIN_PREFIX | BUILTIN_FORKS)                          \
+  X("stats", stats_cmd, BUILTIN_STATE | BUILTIN_OUTPUT | BUILTIN_BUFFERED)     \
+  X("trace", trace_cmd, BUILTIN_STATE)
+
+  /**
+   * @brief Build the perfect hash table for a list of builtins.
+   *
+   * @param t The table
+   * @param list The builtins, not copied
+   * @param count How many, at most 65535
+   * @return 0 on success, -1 if memory could not be allocated
+   */
+  int builtin_table_build(struct builtin_table *t, const struct builtin *list, size_t count);
+
+  /**
+   * @brief Look a command name up in a builtin table.
+   *
+   * @param t The table
+   * @param name The command name
+   * @return The builtin, or NULL if name is not one
+   */
+  const struct builtin *builtin_table_find(const struct builtin_table *t, const char *name);
+
+  /**
+   * @brief Free a builtin table.
+   *
+   * @param t The table
+   */
+  void builtin_table_destroy(struct builtin_table *t);
+
+  /**
+   * @brief Look a command name up in the shell's builtins.
+   *
+   * @param name The command name
+   * @return The builtin, or NULL if name is not one
+   */
+  const struct builtin *builtin_find(const char *name);
+
   /**
    * @brief Takes an argument list and checks if the first argument is a
    * built in command such as exit, cd, jobs, etc. If the command is a
@@ -92,10 +798,19 @@ extern "C"
    */
   bool do_builtin(struct shell *sh, char **argv);
 
+  /**
+   * @brief Check if a command name is a built in command without running it.
+   *
+   * @param name The command name
+   * @return True if do_builtin handles the command
+   */
+  bool is_builtin(const char *name);
+
   /**
    * @brief Initialize the shell for use. Allocate all data structures
    * Grab control of the terminal and put the shell in its own
-   * process group. NOTE: This function will block until the shell is
+   * process group when it is interactive, which a shell running -c or
+   * a script never is. NOTE: This function will block until the shell is
    * in its own program group. Attaching a debugger will always cause
    * this function to fail because the debugger maintains control of
    * the subprocess it is debugging.
@@ -113,12 +828,939 @@ extern "C"
   void sh_destroy(struct shell *sh);
 
   /**
-   * @brief Parse command line args from the user when the shell was launched
+   * @brief Write out everything the buffered builtins have queued on
+   * sh->out. Called before anything else can write to standard output: a
+   * child process, a builtin using stdio, an exec or the prompt.
+   *
+   * @param sh The shell
+   */
+  void sh_flush(struct shell *sh);
+
+  /**
+   * @brief Select the launch engine from an environment variable. The value
+   * "fork" selects fork/exec, anything else (or an unset variable) selects
+   * posix_spawn.
    *
+   * @param env The environment variable
+   * @return The launch engine to use
+   */
+  enum launch_engine get_launch_engine(const char *env);
+
+  /**
+   * @brief Launch an external command into the process group and with the
+   * standard streams described by opts, using the engine selected in
+   * sh->launch. The command is resolved through the path cache in the parent
+   * so a missing command never creates a process. If the shell is interactive
+   * and opts->foreground is set the process group is given the terminal.
+   *
+   * @param sh The shell
+   * @param argv The command to launch
+   * @param opts The process group and streams of the child
+   * @return The pid of the child, or -1 with errno set on failure
+   */
+  pid_t launch_proc(struct shell *sh, char **argv, const struct launch_opts *opts);
+
+  /**
+   * @brief Split a parsed command line into pipeline stages at "|" tokens.
+   * The stages are allocated from the arena, argv is not modified.
+   *
+   * @param a The arena
+   * @param argv The parsed command line
+   * @param nstages Receives the number of stages
+   * @return The NULL terminated argv of each stage, or NULL on a syntax error
+   */
+  char ***pipeline_split(struct arena *a, char **argv, size_t *nstages);
+
+  /**
+   * @brief Launch the stages of a pipeline into one process group connected
+   * by O_CLOEXEC pipes, enlarged to sh->pipe_size bytes when it is set.
+   * opts gives the group (0 for a new one), whether it takes the terminal,
+   * the input of the first stage and the output of the last one.
+   *
+   * @param sh The shell
+   * @param stages The stages from pipeline_split
+   * @param nstages The number of stages
+   * @param opts The process group, terminal and outer streams
+   * @param pids Receives the pid of each launched stage
+   * @return The number of stages launched, fewer than nstages on error
+   */
+  size_t launch_pipeline(struct shell *sh, char ***stages, size_t nstages,
+                         const struct launch_opts *opts, pid_t *pids);
+
+  /**
+   * @brief Launch an external command using the engine selected in
+   * sh->launch, in its own process group when the shell has job control.
+   * The command is resolved through the path cache in the parent so a
+   * missing command never creates a process. If the shell is interactive
+   * the new process group is given the terminal. The caller must wait for
+   * the child.
+   *
+   * @param sh The shell
+   * @param argv The command to launch
+   * @return The pid of the child, or -1 with errno set on failure
+   */
+  pid_t launch_cmd(struct shell *sh, char **argv);
+
+  /**
+   * @brief Report a command that could not be launched on stderr, errno
+   * says why.
+   *
+   * @param cmd The command
+   * @return 127 if a bare name is not on PATH, 126 otherwise
+   */
+  int launch_error(char **cmd);
+
+  /**
+   * @brief Initialize an empty path cache. A zeroed cache is also valid.
+   *
+   * @param pc The cache
+   */
+  void path_cache_init(struct path_cache *pc);
+
+  /**
+   * @brief Free all memory held by the path cache.
+   *
+   * @param pc The cache
+   */
+  void path_cache_destroy(struct path_cache *pc);
+
+  /**
+   * @brief Forget every remembered command location.
+   *
+   * @param pc The cache
+   */
+  void path_cache_reset(struct path_cache *pc);
+
+  /**
+   * @brief Remember that the command name lives at path.
+   *
+   * @param pc The cache
+   * @param name The command name
+   * @param path The full path of the command
+   * @return 0 on success, -1 if memory could not be allocated
+   */
+  int path_cache_add(struct path_cache *pc, const char *name, const char *path);
+
+  /**
+   * @brief Forget the remembered location of the command name.
+   *
+   * @param pc The cache
+   * @param name The command name
+   * @return 0 on success, -1 if name was not in the cache
+   */
+  int path_cache_remove(struct path_cache *pc, const char *name);
+
+  /**
+   * @brief Resolve a command name to the path exec should use. Names with a
+   * slash are returned as is, everything else is looked up in the cache and
+   * then PATH. Commands that are not found are cached until a PATH directory
+   * changes. The returned string is owned by the cache.
+   *
+   * @param pc The cache
+   * @param name The command name
+   * @return The path, or NULL with errno set if the command was not found
+   */
+  const char *path_lookup(struct path_cache *pc, const char *name);
+
+  /**
+   * @brief The hash built in command. Lists, resets (-r), forgets (-d),
+   * seeds (-p path name) or reports hit and miss counts (-s) of the path
+   * cache.
+   *
+   * @param sh The shell
+   * @param argv The command and its arguments
+   * @return 0 on success, non-zero on error
+   */
+  int hash_cmd(struct shell *sh, char **argv);
+
+  /**
+   * @brief Replace the shell process with an external command, resolved
+   * through the path cache. Used for the last command of -c and scripts.
+   *
+   * @param sh The shell
+   * @param argv The command to run
+   * @return Only returns on failure, -1 with errno set
+   */
+  int exec_cmd(struct shell *sh, char **argv);
+
+  /**
+   * @brief Check if the shell may exec its final command in place. That is
+   * only safe when the shell is not interactive and has nothing left to do
+   * after the command finishes.
+   *
+   * @param sh The shell
+   * @return true if the last command can replace the shell
+   */
+  bool sh_can_exec_last(struct shell *sh);
+
+  /**
+   * @brief Read input from a string, used by -c.
+   *
+   * @param r The reader
+   * @param s The commands, one per line
+   * @return 0 on success, -1 on error
+   */
+  int reader_open_string(struct line_reader *r, const char *s);
+
+  /**
+   * @brief Read input from a descriptor the commands also read, stdin.
+   * Regular files are mmap'd with the offset kept after the current line,
+   * anything else is read no further than the end of the current line.
+   * The descriptor is not closed.
+   *
+   * @param r The reader
+   * @param fd The descriptor
+   * @return 0 on success, -1 with errno set on error
+   */
+  int reader_open_fd(struct line_reader *r, int fd);
+
+  /**
+   * @brief Read input from a script file.
+   *
+   * @param r The reader
+   * @param path The script
+   * @return 0 on success, -1 with errno set on error
+   */
+  int reader_open_file(struct line_reader *r, const char *path);
+
+  /**
+   * @brief Return the next line without its newline. The line is owned by
+   * the reader and valid until the next call.
+   *
+   * @param r The reader
+   * @return The line, or NULL at the end of input
+   */
+  char *reader_next(struct line_reader *r);
+
+  /**
+   * @brief Check if all input has been returned.
+   *
+   * @param r The reader
+   * @return true if there are no more lines
+   */
+  bool reader_at_end(struct line_reader *r);
+
+  /**
+   * @brief Release the reader's buffer and any descriptor it opened.
+   *
+   * @param r The reader
+   */
+  void reader_close(struct line_reader *r);
+
+  /**
+   * @brief Start buffered output to a descriptor.
+   *
+   * @param w The writer
+   * @param fd The descriptor, not closed by the writer
+   */
+  void writer_init(struct writer *w, int fd);
+
+  /**
+   * @brief Queue bytes for output. Long pieces are referenced rather than
+   * copied and must stay valid until the next writer_flush.
+   *
+   * @param w The writer
+   * @param p The bytes
+   * @param n How many
+   * @return 0 on success, -1 once any write has failed
+   */
+  int writer_put(struct writer *w, const void *p, size_t n);
+
+  /**
+   * @brief Copy bytes into the writer's buffer, p may be reused at once.
+   *
+   * @param w The writer
+   * @param p The bytes
+   * @param n How many
+   * @return 0 on success, -1 once any write has failed
+   */
+  int writer_copy(struct writer *w, const void *p, size_t n);
+
+  /**
+   * @brief Copy a string into the writer's buffer.
+   *
+   * @param w The writer
+   * @param s The string
+   * @return 0 on success, -1 once any write has failed
+   */
+  int writer_str(struct writer *w, const char *s);
+
+  /**
+   * @brief Copy a number in decimal, right aligned in width columns like
+   * printf's %*zu.
+   *
+   * @param w The writer
+   * @param value The number
+   * @param width The minimum width
+   * @return 0 on success, -1 once any write has failed
+   */
+  int writer_num(struct writer *w, size_t value, int width);
+
+  /**
+   * @brief Write everything queued with as few writev calls as the kernel
+   * allows.
+   *
+   * @param w The writer
+   * @return 0 on success, -1 with errno set if a write failed
+   */
+  int writer_flush(struct writer *w);
+
+  /**
+   * @brief Start tracking jobs. SIGCHLD is blocked and read from a signalfd
+   * so children are only ever reaped at safe points. Job control starts
+   * off, sh_init turns it on for an interactive shell.
+   *
+   * @param t The job table
+   */
+  void jobs_init(struct job_table *t);
+
+  /**
+   * @brief Free every job and restore the SIGCHLD mask. Running jobs are
+   * left running.
+   *
+   * @param t The job table
+   */
+  void jobs_destroy(struct job_table *t);
+
+  /**
+   * @brief Start tracking the processes of a newly launched job. Background
+   * jobs get the next job id.
+   *
+   * @param t The job table
+   * @param pgid The process group of the job
+   * @param pids The processes of the job
+   * @param n The number of processes
+   * @param cmd The command line, copied into the job
+   * @param background true if the shell does not wait for the job
+   * @return The job
+   */
+  struct job *job_add(struct job_table *t, pid_t pgid, const pid_t *pids, size_t n,
+                      const char *cmd, bool background);
+
+  /**
+   * @brief Find the job a process belongs to.
+   *
+   * @param t The job table
+   * @param pid The process
+   * @return The job, or NULL if the process is not tracked
+   */
+  struct job *job_find_pid(struct job_table *t, pid_t pid);
+
+  /**
+   * @brief Find a background job by its id.
+   *
+   * @param t The job table
+   * @param id The job id
+   * @return The job, or NULL if there is no such job
+   */
+  struct job *job_get(struct job_table *t, int id);
+
+  /**
+   * @brief Stop tracking a job and free it.
+   *
+   * @param t The job table
+   * @param j The job
+   */
+  void job_remove(struct job_table *t, struct job *j);
+
+  /**
+   * @brief Record a status reported by waitpid for a tracked process.
+   *
+   * @param t The job table
+   * @param pid The process
+   * @param status The waitpid status
+   * @return The job the process belongs to, or NULL if it is not tracked
+   */
+  struct job *job_update(struct job_table *t, pid_t pid, int status);
+
+  /**
+   * @brief Reap a process whose pidfd reported that it exited.
+   *
+   * @param t The job table
+   * @param pid The process
+   * @return The job the process belongs to, or NULL if it was not reaped
+   */
+  struct job *job_reap_pid(struct job_table *t, pid_t pid);
+
+  /**
+   * @brief Block until at least one child changes state and record it. With
+   * pidfds this runs the event loop, so SIGINT sets sh->events.interrupted.
+   *
+   * @param sh The shell
+   * @return 0, or -1 if there is nothing to wait for
+   */
+  int jobs_block(struct shell *sh);
+
+  /**
+   * @brief Reap every child that has finished without blocking. Does
+   * nothing unless SIGCHLD has arrived since the last call.
+   *
+   * @param t The job table
+   * @return The number of children reaped
+   */
+  size_t jobs_reap(struct job_table *t);
+
+  /**
+   * @brief Wait for a foreground job to finish or stop, reaping any other
+   * child that finishes in the meantime, then take back the terminal. A
+   * finished job is freed, a stopped job gets an id and keeps its terminal
+   * modes.
+   *
+   * @param sh The shell
+   * @param j The job
+   * @return The shell exit status of the job's last process, or 128 plus
+   * the signal that stopped it
+   */
+  int job_wait(struct shell *sh, struct job *j);
+
+  /**
+   * @brief Send a signal to a job, to its process group with job control
+   * and to each of its live processes without.
+   *
+   * @param t The job table
+   * @param j The job
+   * @param sig The signal
+   */
+  void job_kill(const struct job_table *t, struct job *j, int sig);
+
+  /**
+   * @brief Report and free background jobs that have finished. Reports are
+   * only printed by interactive shells.
+   *
+   * @param sh The shell
+   */
+  void jobs_notify(struct shell *sh);
+
+  /**
+   * @brief The jobs built in command. Lists every job with its state, -l
+   * adds the pids and -p prints only the process group ids.
+   *
+   * @param sh The shell
+   * @param argv The command and its arguments
+   * @return 0 on success, non-zero on error
+   */
+  int jobs_cmd(struct shell *sh, char **argv);
+
+  /**
+   * @brief The fg built in command. Continues a job in the foreground with
+   * its saved terminal modes and waits for it.
+   *
+   * @param sh The shell
+   * @param argv The command and an optional job spec (%n, n, %+ or %%)
+   * @return The status of the job, 1 if there is no such job
+   */
+  int fg_cmd(struct shell *sh, char **argv);
+
+  /**
+   * @brief The bg built in command. Continues stopped jobs in the background.
+   *
+   * @param sh The shell
+   * @param argv The command and optional job specs
+   * @return 0 on success, 1 if any job was not found
+   */
+  int bg_cmd(struct shell *sh, char **argv);
+
+  /**
+   * @brief The wait built in command. Waits for the given jobs (%n) or pids,
+   * or for every running background job when there are no arguments.
+   *
+   * @param sh The shell
+   * @param argv The command and optional job specs or pids
+   * @return The status of the last job waited for, 127 if it is unknown
+   */
+  int wait_cmd(struct shell *sh, char **argv);
+
+  /**
+   * @brief The parallel built in command. Runs a command template once for
+   * each input line (stdin, -a file or the arguments after :::) with at
+   * most -j N children at a time. {} in the template is replaced by the
+   * input and {#} by its sequence number, without {} the input is appended.
+   * -k buffers each job's output in memfds and writes it out in input
+   * order. Each job's exit status and time and the total wall time are
+   * reported on stderr.
+   *
+   * @param sh The shell
+   * @param argv The command and its arguments
+   * @return 0 if every job succeeded, otherwise the number of failed jobs
+   * up to 101, 130 if interrupted
+   */
+  int parallel_cmd(struct shell *sh, char **argv);
+
+  /**
+   * @brief The dag built in command. Reads a task graph, one
+   * "name[@cost] [deps...] : command" per line from a file or stdin, and
+   * runs each task once its prerequisites have succeeded with at most -j N
+   * tasks at a time. Ready tasks heading the longest chain of remaining
+   * cost start first. The first failure stops new tasks from starting
+   * unless -k is given, -n prints the plan instead of running it.
+   *
+   * @param sh The shell
+   * @param argv The command and its arguments
+   * @return 0 if every task succeeded, 1 if any failed or was skipped, 2 on
+   * a usage or graph error, 130 if interrupted
+   */
+  int dag_cmd(struct shell *sh, char **argv);
+
+  /**
+   * @brief Return the wall clock time in microseconds since the epoch, the
+   * unit of history timestamps and durations.
+   */
+  int64_t hist_now(void);
+
+  /**
+   * @brief Open (or create) a history file and map it. Nothing is indexed
+   * until the first hist_refresh.
+   *
+   * @param h The store
+   * @param path The history file
+   * @return 0 on success, -1 with errno set on failure
+   */
+  int hist_open(struct hist_store *h, const char *path);
+
+  /**
+   * @brief Unmap and close a history file.
+   *
+   * @param h The store
+   */
+  void hist_close(struct hist_store *h);
+
+  /**
+   * @brief Append a command to the history file as one atomic record.
+   *
+   * @param h The store
+   * @param cmd The command line
+   * @param cwd The directory it ran in
+   * @param time When it started, from hist_now
+   * @param duration How long it ran in microseconds
+   * @param status Its exit status
+   * @return 0 on success, -1 with errno set on failure
+   */
+  int hist_append(struct hist_store *h, const char *cmd, const char *cwd, int64_t time,
+                  int64_t duration, int status);
+
+  /**
+   * @brief Index any records added to the history file since the last call,
+   * by this shell or any other.
+   *
+   * @param h The store
+   * @return The number of entries
+   */
+  size_t hist_refresh(struct hist_store *h);
+
+  /**
+   * @brief Look up a history entry, valid until the next hist_refresh.
+   *
+   * @param h The store
+   * @param n The entry, 0 is the oldest
+   * @param e Receives the entry
+   * @return true if the entry exists
+   */
+  bool hist_get(struct hist_store *h, size_t n, struct hist_entry *e);
+
+  /**
+   * @brief Add the history entries appended since the last call to the
+   * trigram index of the history file.
+   *
+   * @param h The store
+   * @return The number of entries
+   */
+  size_t hist_index_update(struct hist_store *h);
+
+  /**
+   * @brief Free the trigram index of a history file.
+   *
+   * @param idx The index
+   */
+  void hist_index_destroy(struct tri_index *idx);
+
+  /**
+   * @brief Find history entries containing a string, newest first, through
+   * the trigram index.
+   *
+   * @param h The store
+   * @param q The string to look for
+   * @param before Only entries numbered below this are searched
+   * @param ids Receives the matching entries
+   * @param max The size of ids
+   * @return The number of matches found
+   */
+  size_t hist_search(struct hist_store *h, const char *q, size_t before, size_t *ids,
+                     size_t max);
+
+  /**
+   * @brief Set up an empty history ring.
+   *
+   * @param r The ring
+   * @param cap The most commands kept, 0 for none
+   * @param dups What to do with duplicate commands
+   * @return 0 on success, -1 if memory could not be allocated
+   */
+  int hist_ring_init(struct hist_ring *r, size_t cap, enum hist_dups dups);
+
+  /**
+   * @brief Free a history ring and its commands.
+   *
+   * @param r The ring
+   */
+  void hist_ring_destroy(struct hist_ring *r);
+
+  /**
+   * @brief Add a command to the ring in O(1), dropping the oldest when full
+   * and handling duplicates as the ring was set up to.
+   *
+   * @param r The ring
+   * @param line The command, copied
+   * @return true if the command was added
+   */
+  bool hist_ring_add(struct hist_ring *r, const char *line);
+
+  /**
+   * @brief Return the command at a position of the ring, 0 is the oldest.
+   *
+   * @param r The ring
+   * @param i The position, below r->count
+   * @return The command, or NULL for an erased duplicate
+   */
+  const char *hist_ring_get(const struct hist_ring *r, size_t i);
+
+  /**
+   * @brief Return the parsed argv of a ring entry, as cmd_parse_arena would,
+   * parsing it once and handing out copies of the cached result after.
+   *
+   * @param r The ring
+   * @param i The position of a live entry
+   * @param a The arena the copy comes from
+   * @return The argv, valid until the next arena_reset
+   */
+  char **hist_ring_argv(struct hist_ring *r, size_t i, struct arena *a);
+
+  /**
+   * @brief Expand history references in a line: !! is the previous command,
+   * !n entry n as history lists it, !-n the nth previous command and
+   * !prefix the latest command starting with prefix.
+   *
+   * @param sh The shell
+   * @param line A trimmed line
+   * @param argv Set to the parsed line, through the ring's cache, when the
+   * whole line is one reference to a ring entry, NULL otherwise
+   * @return line if it has no references, the expansion from the shell's
+   * arena otherwise, NULL after printing an error if an event is not found
+   */
+  char *hist_expand(struct shell *sh, char *line, char ***argv);
+
+  /**
+   * @brief Move readline's history keys (the arrow keys, Ctrl+P and so on)
+   * over to the ring.
+   *
+   * @param r The ring
+   */
+  void hist_nav_init(struct hist_ring *r);
+
+  /**
+   * @brief Go back to the bottom of the history ring, used when Ctrl+C
+   * clears the line.
+   */
+  void hist_nav_abort(void);
+
+  /**
+   * @brief Bind Ctrl+R to a reverse-i-search over the history file that
+   * uses hist_search, or over the ring when there is no history file.
+   *
+   * @param store The history file, or NULL
+   * @param ring The history ring
+   */
+  void isearch_init(struct hist_store *store, struct hist_ring *ring);
+
+  /**
+   * @brief Leave a reverse-i-search in progress, if any.
+   */
+  void isearch_abort(void);
+
+  /**
+   * @brief Set up the history ring of an interactive shell, MY_HISTSIZE
+   * and MY_HISTCONTROL, open the history file, MY_HISTFILE or
+   * ~/.deeshell_history, and load its latest commands into the ring.
+   *
+   * @param sh The shell
+   * @return 0 on success or if MY_HISTFILE is empty, -1 on error
+   */
+  int hist_init(struct shell *sh);
+
+  /**
+   * @brief The history built in command. Lists the history file, -l with
+   * start time, duration, exit status and directory, -s only the entries
+   * containing a string, -r a range of entries, N the last N and -0 the
+   * bare commands separated by NUL bytes.
+   *
+   * @param sh The shell
+   * @param argv The command and its arguments
+   * @return 0 on success, 1 if nothing matched or on a write error, 2 on a
+   * usage error
+   */
+  int history_cmd(struct shell *sh, char **argv);
+
+  /**
+   * @brief The echo built in command. Writes its arguments separated by
+   * spaces, -n leaves out the newline and -e interprets backslash escapes.
+   *
+   * @param sh The shell
+   * @param argv The command and its arguments
+   * @return 0 on success, 1 on a write error
+   */
+  int echo_cmd(struct shell *sh, char **argv);
+
+  /**
+   * @brief The printf built in command. Formats its arguments with %s, %b,
+   * %c, %d, %i, %u, %o, %x, %X, %e, %f, %g and %%, reusing the format while
+   * arguments are left.
+   *
+   * @param sh The shell
+   * @param argv The command and its arguments
+   * @return 0 on success, 1 if an argument was not a number or on a write
+   * error, 2 on a usage error
+   */
+  int printf_cmd(struct shell *sh, char **argv);
+
+  /**
+   * @brief The pwd built in command. Writes the working directory.
+   *
+   * @param sh The shell
+   * @param argv The command and its arguments
+   * @return 0 on success, 1 on error
+   */
+  int pwd_cmd(struct shell *sh, char **argv);
+
+  /**
+   * @brief The true built in command.
+   *
+   * @param sh The shell
+   * @param argv The command and its arguments
+   * @return 0
+   */
+  int true_cmd(struct shell *sh, char **argv);
+
+  /**
+   * @brief The false built in command.
+   *
+   * @param sh The shell
+   * @param argv The command and its arguments
+   * @return 1
+   */
+  int false_cmd(struct shell *sh, char **argv);
+
+  /**
+   * @brief The test and [ built in commands. Evaluates file tests, string
+   * and integer comparisons combined with !, -a, -o and parentheses.
+   *
+   * @param sh The shell
+   * @param argv The command and its arguments, ending in "]" for [
+   * @return 0 if the expression is true, 1 if it is false, 2 on an error
+   */
+  int test_cmd(struct shell *sh, char **argv);
+
+  /**
+   * @brief The time built in command. Runs the rest of the line, a command
+   * or a pipeline, and reports on stderr its wall time, user and system
+   * CPU time, max RSS and context switches from wait4, followed by where
+   * the shell's own time went: parse, fork, exec until every stage runs its
+   * program, and wait. A builtin is timed with getrusage instead.
+   *
+   * @param sh The shell
+   * @param argv "time" followed by the command line
+   * @return The status of the command, 2 on a usage error
+   */
+  int time_cmd(struct shell *sh, char **argv);
+
+  /**
+   * @brief Return a monotonic clock in nanoseconds, for measuring how long
+   * the shell's own work takes.
+   */
+  int64_t time_now_ns(void);
+
+  /**
+   * @brief Empty every counter and histogram and restart the clock.
+   *
+   * @param s The statistics
+   */
+  void stats_reset(struct stats *s);
+
+  /**
+   * @brief Record how long a stage took. Does nothing if s is NULL, so
+   * shells set up without sh_init are not counted.
+   *
+   * @param s The statistics, or NULL
+   * @param stage The stage
+   * @param ns The time it took in nanoseconds
+   */
+  void stats_record(struct stats *s, enum stats_stage stage, int64_t ns);
+
+  /**
+   * @brief Count an event. Does nothing if s is NULL.
+   *
+   * @param s The statistics, or NULL
+   * @param counter The event
+   */
+  void stats_count(struct stats *s, enum stats_counter counter);
+
+  /**
+   * @brief Estimate a percentile of a histogram, as the highest value of
+   * the bucket it falls in but never above the exact maximum.
+   *
+   * @param h The histogram
+   * @param q The fraction of values at or below the result, 0 to 1
+   * @return The value in nanoseconds, 0 for an empty histogram
+   */
+  uint64_t stats_percentile(const struct stats_hist *h, double q);
+
+  /**
+   * @brief The stats built in command. Prints the counters and, for each
+   * stage of the main loop, count, mean, percentiles and maximum. -j
+   * prints them as JSON and -r resets them afterwards, on its own -r
+   * only resets.
+   *
+   * @param sh The shell
+   * @param argv The command and its arguments
+   * @return 0 on success, 1 on a write error, 2 on a usage error
+   */
+  int stats_cmd(struct shell *sh, char **argv);
+
+  /**
+   * @brief Open a Chrome trace event file, truncating it, and start its
+   * JSON array. Events are recorded into a lock-free ring and only
+   * formatted when it is flushed.
+   *
+   * @param path The file
+   * @return The trace, or NULL with errno set
+   */
+  struct trace *trace_open(const char *path);
+
+  /**
+   * @brief Open the trace of a shell: path if it is set, else the file
+   * named by the environment variable env. env is removed from the
+   * environment so nested shells do not write into the same file.
+   *
+   * @param path The file given on the command line, or NULL
+   * @param env The environment variable, MY_TRACE
+   * @return The trace, or NULL if none was asked for or it failed to open
+   */
+  struct trace *trace_start(const char *path, const char *env);
+
+  /**
+   * @brief Record the start of a command line or a process on its own
+   * track. Does nothing if t is NULL, as do the other trace functions.
+   *
+   * @param t The trace, or NULL
+   * @param cat What is starting
+   * @param tid The track, a process's pid or 0 for the shell's
+   * @param name The command
+   */
+  void trace_begin(struct trace *t, enum trace_cat cat, pid_t tid, const char *name);
+
+  /**
+   * @brief Record the end of what the last trace_begin on a track started.
+   *
+   * @param t The trace, or NULL
+   * @param cat What is ending
+   * @param tid The track, a process's pid or 0 for the shell's
+   * @param status The exit status
+   */
+  void trace_end(struct trace *t, enum trace_cat cat, pid_t tid, int status);
+
+  /**
+   * @brief Record a finished span on the shell's track.
+   *
+   * @param t The trace, or NULL
+   * @param cat What the span was
+   * @param name Its name
+   * @param start When it started, a time_now_ns reading
+   * @param end When it ended
+   */
+  void trace_span(struct trace *t, enum trace_cat cat, const char *name, int64_t start,
+                  int64_t end);
+
+  /**
+   * @brief Write every event recorded so far to the file.
+   *
+   * @param t The trace, or NULL
+   * @return The number of events written, -1 with errno set on a write error
+   */
+  long trace_flush(struct trace *t);
+
+  /**
+   * @brief Flush the trace, end the JSON array and close the file.
+   *
+   * @param t The trace, or NULL
+   */
+  void trace_close(struct trace *t);
+
+  /**
+   * @brief The trace built in command. Writes out the events recorded so
+   * far, so the file can be loaded while the shell keeps running.
+   *
+   * @param sh The shell
+   * @param argv The command and its arguments
+   * @return 0 on success, 1 if the shell is not tracing or on a write error,
+   * 2 on a usage error
+   */
+  int trace_cmd(struct shell *sh, char **argv);
+
+  /**
+   * @brief Check for a trailing & and remove it from argv.
+   *
+   * @param argv The parsed command, modified in place
+   * @return true if the command should run in the background
+   */
+  bool cmd_background(char **argv);
+
+  /**
+   * @brief Create the event loop. The job table's signalfd is watched and
+   * children get pidfds from then on. An interactive shell also watches
+   * the terminal and reads SIGINT and SIGWINCH from a signalfd instead of
+   * letting readline install handlers. MY_TMOUT sets the idle timeout at
+   * the prompt in seconds.
+   *
+   * @param sh The shell
+   * @return 0 on success, -1 with errno set if epoll is not available
+   */
+  int event_init(struct shell *sh);
+
+  /**
+   * @brief Close every descriptor owned by the event loop.
+   *
+   * @param sh The shell
+   */
+  void event_destroy(struct shell *sh);
+
+  /**
+   * @brief Wait for events and dispatch them. Terminal input is only read
+   * while the prompt is active.
+   *
+   * @param sh The shell
+   * @param timeout Milliseconds to wait, -1 to block and 0 to poll
+   * @return The number of events dispatched, -1 on error
+   */
+  int event_wait(struct shell *sh, int timeout);
+
+  /**
+   * @brief Start or stop reading the terminal for the prompt. The idle timer
+   * only runs while the prompt is active.
+   *
+   * @param sh The shell
+   * @param on true when the prompt is shown
+   */
+  void event_prompt(struct shell *sh, bool on);
+
+  /**
+   * @brief Parse command line args from the user when the shell was launched.
+   * -c stores the command string in sh->command, the first operand is
+   * stored in sh->script and -t the trace file in sh->trace_path. Call
+   * this before sh_init.
+   *
+   * @param sh The shell
    * @param argc Number of args
    * @param argv The arg array
    */
-  void parse_args(int argc, char **argv);
+  void parse_args(struct shell *sh, int argc, char **argv);
 
 
 
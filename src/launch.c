@@ -0,0 +1,383 @@
+#define _GNU_SOURCE
+#include "lab.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <fcntl.h>
+
+extern char **environ;
+
+/* Signals the shell ignores that every child must get back as SIG_DFL. */
+static const int job_signals[] = {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU};
+
+#define NUM_JOB_SIGNALS (sizeof(job_signals) / sizeof(job_signals[0]))
+
+/**
+ * @brief Selects the launch engine from an environment variable.
+ *
+ * The value "fork" selects the classic fork/exec path, "spawn" selects
+ * posix_spawn. Anything else (including an unset variable) falls back to
+ * the default engine, posix_spawn.
+ *
+ * @param env The name of the environment variable to read.
+ * @return The selected launch engine.
+ */
+enum launch_engine get_launch_engine(const char *env) {
+    const char *engine = getenv(env);
+
+    // Only an explicit request gets the old fork path.
+    if (engine != NULL && strcmp(engine, "fork") == 0) {
+        return LAUNCH_FORK;
+    }
+    return LAUNCH_SPAWN;
+}
+
+/**
+ * @brief Launches a command with fork and execv.
+ *
+ * With job control the child joins its process group and takes the
+ * terminal when it is the foreground job of an interactive shell. It then
+ * moves any redirected streams into place, restores the default signal
+ * dispositions and execs. This copies the page tables of the whole shell
+ * so it gets slower as the shell grows.
+ *
+ * @param sh A pointer to the shell structure.
+ * @param path The resolved path of the command.
+ * @param argv The command to launch.
+ * @param opts The process group and streams of the child.
+ * @return The pid of the child, or -1 if fork failed.
+ */
+static pid_t launch_fork(struct shell *sh, const char *path, char **argv,
+                         const struct launch_opts *opts) {
+    pid_t pid = fork();
+    if (pid != 0) {
+        return pid; // Parent, or fork failed.
+    }
+
+    /*This is the child process*/
+    pid_t child = getpid();
+    if (sh->jobs.job_control) {
+        setpgid(child, opts->pgid ? opts->pgid : child);
+        if (sh->shell_is_interactive && opts->foreground) {
+            tcsetpgrp(sh->shell_terminal, opts->pgid ? opts->pgid : child);
+        }
+    }
+    if (opts->fd_in >= 0) {
+        dup2(opts->fd_in, STDIN_FILENO);
+    }
+    if (opts->fd_out >= 0) {
+        dup2(opts->fd_out, STDOUT_FILENO);
+    }
+    if (opts->fd_err >= 0) {
+        dup2(opts->fd_err, STDERR_FILENO);
+    }
+    for (size_t i = 0; i < NUM_JOB_SIGNALS; i++) {
+        signal(job_signals[i], SIG_DFL);
+    }
+    // The shell blocks SIGCHLD, the command must not inherit that.
+    sigset_t empty;
+    sigemptyset(&empty);
+    sigprocmask(SIG_SETMASK, &empty, NULL);
+    execv(path, argv);
+    fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+    _exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Launches a command with posix_spawn.
+ *
+ * glibc implements posix_spawn with clone(CLONE_VM|CLONE_VFORK) so the
+ * shell image is never copied. Process group (with job control), signal
+ * dispositions and the signal mask are set through spawn attributes, redirected streams through
+ * dup2 file actions, and on glibc 2.35 or newer a foreground child also
+ * takes the terminal before it execs.
+ *
+ * @param sh A pointer to the shell structure.
+ * @param path The resolved path of the command.
+ * @param argv The command to launch.
+ * @param opts The process group and streams of the child.
+ * @return The pid of the child, or -1 with errno set if the spawn failed.
+ */
+static pid_t launch_spawn(struct shell *sh, const char *path, char **argv,
+                          const struct launch_opts *opts) {
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+    sigset_t sigdef, sigmask;
+    pid_t pid = -1;
+    int rval;
+
+    // Reset the job control signals and start the child with nothing blocked.
+    sigemptyset(&sigdef);
+    for (size_t i = 0; i < NUM_JOB_SIGNALS; i++) {
+        sigaddset(&sigdef, job_signals[i]);
+    }
+    sigemptyset(&sigmask);
+
+    posix_spawnattr_init(&attr);
+    posix_spawn_file_actions_init(&actions);
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    if (sh->jobs.job_control) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, opts->pgid); // 0 means pgid == pid.
+    }
+    posix_spawnattr_setflags(&attr, flags);
+    posix_spawnattr_setsigdefault(&attr, &sigdef);
+    posix_spawnattr_setsigmask(&attr, &sigmask);
+
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 35)
+    // Hand the terminal over inside the child so it can never read from the
+    // terminal before it is in the foreground.
+    if (sh->jobs.job_control && sh->shell_is_interactive && opts->foreground) {
+        posix_spawn_file_actions_addtcsetpgrp_np(&actions, sh->shell_terminal);
+    }
+#endif
+    if (opts->fd_in >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, opts->fd_in, STDIN_FILENO);
+    }
+    if (opts->fd_out >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, opts->fd_out, STDOUT_FILENO);
+    }
+    if (opts->fd_err >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, opts->fd_err, STDERR_FILENO);
+    }
+
+    rval = posix_spawn(&pid, path, &actions, &attr, argv, environ);
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (rval != 0) {
+        errno = rval;
+        return -1;
+    }
+    return pid;
+}
+
+/**
+ * @brief Launches an external command into a process group.
+ *
+ * This function resolves argv[0] through the path cache, so PATH is only
+ * walked once per command, and then starts it with the engine selected in
+ * sh->launch. With job control the child joins opts->pgid, or leads a
+ * new group when it is 0, otherwise it stays in the shell's group. Its
+ * standard streams are replaced by the descriptors in opts. When the
+ * shell is interactive and opts->foreground is set the group is made the
+ * foreground process group of the terminal. The parent sets the process
+ * group and terminal too so there is no race with the child.
+ *
+ * @param sh A pointer to the shell structure.
+ * @param argv The command to launch.
+ * @param opts The process group and streams of the child.
+ * @return The pid of the child, or -1 with errno set on failure.
+ */
+pid_t launch_proc(struct shell *sh, char **argv, const struct launch_opts *opts) {
+    // Builtin output comes before the child's, or before the error if there
+    // is no child.
+    sh_flush(sh);
+    const char *path = path_lookup(&sh->paths, argv[0]);
+    pid_t pid;
+
+    if (path == NULL) {
+        stats_count(sh->stats, STATS_LAUNCH_ERRORS);
+        return -1;
+    }
+    int64_t start = time_now_ns();
+    if (sh->launch == LAUNCH_FORK) {
+        pid = launch_fork(sh, path, argv, opts);
+    } else {
+        pid = launch_spawn(sh, path, argv, opts);
+    }
+    if (pid < 0) {
+        stats_count(sh->stats, STATS_LAUNCH_ERRORS);
+        return -1;
+    }
+    int64_t end = time_now_ns();
+    stats_record(sh->stats, STATS_LAUNCH, end - start);
+    stats_count(sh->stats, STATS_PROCESSES);
+    trace_span(sh->trace, TRACE_LAUNCH, argv[0], start, end);
+    trace_begin(sh->trace, TRACE_PROCESS, pid, argv[0]);
+
+    /*
+    This is in the parent put the child process into its
+    process group and give it control of the terminal
+    to avoid a race condition
+    */
+    if (sh->jobs.job_control) {
+        pid_t pgid = opts->pgid ? opts->pgid : pid;
+        setpgid(pid, pgid);
+        if (sh->shell_is_interactive && opts->foreground) {
+            tcsetpgrp(sh->shell_terminal, pgid);
+        }
+    }
+    return pid;
+}
+
+/**
+ * @brief Launches an external command as a foreground job of its own.
+ *
+ * @param sh A pointer to the shell structure.
+ * @param argv The command to launch.
+ * @return The pid of the child, or -1 with errno set on failure.
+ */
+pid_t launch_cmd(struct shell *sh, char **argv) {
+    struct launch_opts opts = LAUNCH_OPTS_INIT;
+    return launch_proc(sh, argv, &opts);
+}
+
+/**
+ * @brief Splits a parsed command line into pipeline stages at "|" tokens.
+ *
+ * argv is left untouched, each stage gets its own NULL terminated copy of
+ * the pointers allocated from the arena.
+ *
+ * @param a The arena to allocate the stages from.
+ * @param argv The parsed command line.
+ * @param nstages Receives the number of stages.
+ * @return The stages, or NULL if a stage is empty (a syntax error).
+ */
+char ***pipeline_split(struct arena *a, char **argv, size_t *nstages) {
+    size_t n = 1;
+    size_t ntok = 0;
+    for (; argv[ntok]; ntok++) {
+        n += strcmp(argv[ntok], "|") == 0;
+    }
+
+    // One block holds the stage array and every stage's pointers, each
+    // stage needs one extra slot for its terminator.
+    char ***stages = arena_alloc(a, n * sizeof(char **) + (ntok + 1) * sizeof(char *));
+    char **out = (char **)(stages + n);
+    size_t stage = 0;
+
+    stages[0] = out;
+    for (size_t i = 0; i <= ntok; i++) {
+        if (argv[i] == NULL || strcmp(argv[i], "|") == 0) {
+            if (out == stages[stage]) {
+                return NULL; // "| cmd", "cmd |" or "cmd | | cmd"
+            }
+            *out++ = NULL;
+            if (argv[i] != NULL) {
+                stages[++stage] = out;
+            }
+        } else {
+            *out++ = argv[i];
+        }
+    }
+    *nstages = n;
+    return stages;
+}
+
+/**
+ * @brief Launches every stage of a pipeline into one process group.
+ *
+ * Stages are connected with pipe2(O_CLOEXEC) so no child inherits a pipe
+ * end it does not use. If sh->pipe_size is set each pipe is enlarged with
+ * F_SETPIPE_SZ, which cuts context switches for high throughput stages;
+ * a size above the system limit is silently ignored. The first stage leads
+ * the group, or joins opts->pgid, and the group takes the terminal when
+ * opts->foreground is set. opts->fd_in feeds the first stage and
+ * opts->fd_out receives the output of the last one.
+ *
+ * @param sh A pointer to the shell structure.
+ * @param stages The stages from pipeline_split.
+ * @param nstages The number of stages.
+ * @param opts The process group, terminal and outer streams of the pipeline.
+ * @param pids Receives the pid of each stage that was launched.
+ * @return The number of stages launched. Fewer than nstages means a stage
+ * failed to launch with errno set, the caller must still wait for the
+ * ones that started.
+ */
+size_t launch_pipeline(struct shell *sh, char ***stages, size_t nstages,
+                       const struct launch_opts *opts, pid_t *pids) {
+    struct launch_opts stage = *opts;
+    int prev_read = -1;
+    size_t i;
+
+    for (i = 0; i < nstages; i++) {
+        int fds[2] = {-1, -1};
+        if (i + 1 < nstages) {
+            if (pipe2(fds, O_CLOEXEC) != 0) {
+                break;
+            }
+            if (sh->pipe_size > 0) {
+                fcntl(fds[1], F_SETPIPE_SZ, sh->pipe_size);
+            }
+        }
+
+        stage.fd_in = i == 0 ? opts->fd_in : prev_read;
+        stage.fd_out = i + 1 < nstages ? fds[1] : opts->fd_out;
+        pids[i] = launch_proc(sh, stages[i], &stage);
+        int err = errno;
+
+        // The children have their copies, the shell must not keep the
+        // write ends open or the readers would never see end of file.
+        if (prev_read >= 0) {
+            close(prev_read);
+        }
+        if (fds[1] >= 0) {
+            close(fds[1]);
+        }
+        prev_read = fds[0];
+        if (pids[i] < 0) {
+            errno = err;
+            break;
+        }
+        if (i == 0 && stage.pgid == 0) {
+            stage.pgid = pids[0];
+        }
+    }
+    if (prev_read >= 0) {
+        close(prev_read);
+    }
+    return i;
+}
+
+/**
+ * @brief Reports a command that could not be launched.
+ *
+ * @param cmd The command, errno holds the reason.
+ * @return The exit status for the failure, 127 when a bare name is not on
+ * PATH and 126 otherwise.
+ */
+int launch_error(char **cmd) {
+    // A bare name that is not on PATH never gets a process.
+    if (errno == ENOENT && strchr(cmd[0], '/') == NULL) {
+        fprintf(stderr, "%s: command not found\n", cmd[0]);
+        return 127;
+    }
+    fprintf(stderr, "%s: %s\n", cmd[0], strerror(errno));
+    return 126;
+}
+
+/**
+ * @brief Replaces the shell with an external command.
+ *
+ * Used for the last command of -c and scripts so there is no fork and no
+ * waitpid, and the command's signals and exit status reach our parent
+ * directly. The job control signals are reset and the signal mask cleared
+ * exactly as a launched child would see them. stdio buffers and the
+ * shell's writer are flushed first since exec discards them.
+ *
+ * @param sh A pointer to the shell structure.
+ * @param argv The command to run.
+ * @return Only returns on failure, -1 with errno set.
+ */
+int exec_cmd(struct shell *sh, char **argv) {
+    const char *path = path_lookup(&sh->paths, argv[0]);
+    sigset_t empty;
+
+    if (path == NULL) {
+        return -1;
+    }
+    sh_flush(sh);
+    fflush(NULL);
+    for (size_t i = 0; i < NUM_JOB_SIGNALS; i++) {
+        signal(job_signals[i], SIG_DFL);
+    }
+    sigemptyset(&empty);
+    sigprocmask(SIG_SETMASK, &empty, NULL);
+    execv(path, argv);
+    return -1;
+}
@@ -0,0 +1,484 @@
+#define _GNU_SOURCE
+#include "lab.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+
+/* Most failed jobs counted in the exit status, like GNU parallel. */
+#define PAR_MAX_FAILED 101
+
+/**
+ * @brief One place in the in-flight window. A slot is busy from launch
+ * until its job has been reported. In keep order mode out and err are the
+ * memfds holding the job's output until its turn comes, -1 otherwise.
+ */
+struct par_slot {
+    struct job *job;
+    size_t seq;
+    char *arg;
+    double start;
+    double elapsed;
+    int status;
+    int out;
+    int err;
+    bool busy;
+    bool finished;
+};
+
+/**
+ * @brief The state of one parallel run.
+ */
+struct par_run {
+    struct shell *sh;
+    char **tmpl;
+    bool has_braces;
+    size_t window;
+    bool keep_order;
+    bool quiet;
+    struct par_slot *slots;
+    size_t running;
+    size_t next_seq;
+    size_t next_report;
+    size_t failed;
+    struct line_reader in;
+    bool use_reader;
+    char **args;
+    int fd_in;
+    struct arena arena;
+};
+
+/**
+ * @brief Returns a monotonic timestamp in seconds.
+ */
+static double par_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Returns the next input, or NULL when there is none left. Blank
+ * lines are skipped like xargs does.
+ */
+static const char *par_next_input(struct par_run *p) {
+    if (!p->use_reader) {
+        return *p->args != NULL ? *p->args++ : NULL;
+    }
+    char *line;
+    while ((line = reader_next(&p->in)) != NULL && *line == '\0') {
+    }
+    return line;
+}
+
+/**
+ * @brief Copies s into out replacing every {} with arg and every {#} with
+ * seq. When out is NULL only the length is computed.
+ * @return The length of the expanded token.
+ */
+static size_t par_expand(const char *s, const char *arg, const char *seq, char *out) {
+    size_t len = 0;
+    while (*s) {
+        const char *with = NULL;
+        if (s[0] == '{' && s[1] == '}') {
+            with = arg;
+            s += 2;
+        } else if (s[0] == '{' && s[1] == '#' && s[2] == '}') {
+            with = seq;
+            s += 3;
+        }
+        if (with != NULL) {
+            size_t n = strlen(with);
+            if (out != NULL) {
+                memcpy(out + len, with, n);
+            }
+            len += n;
+        } else {
+            if (out != NULL) {
+                out[len] = *s;
+            }
+            len++;
+            s++;
+        }
+    }
+    if (out != NULL) {
+        out[len] = '\0';
+    }
+    return len;
+}
+
+/**
+ * @brief Builds the argv of one job from the template in the run's arena.
+ */
+static char **par_argv(struct par_run *p, const char *arg, size_t seq) {
+    char seqbuf[32];
+    size_t n = 0;
+
+    snprintf(seqbuf, sizeof(seqbuf), "%zu", seq);
+    while (p->tmpl[n] != NULL) {
+        n++;
+    }
+    char **argv = arena_alloc(&p->arena, (n + 2) * sizeof(char *));
+    for (size_t i = 0; i < n; i++) {
+        argv[i] = arena_alloc(&p->arena, par_expand(p->tmpl[i], arg, seqbuf, NULL) + 1);
+        par_expand(p->tmpl[i], arg, seqbuf, argv[i]);
+    }
+    // Without {} the input becomes the last argument.
+    if (!p->has_braces) {
+        argv[n++] = arena_strdup(&p->arena, arg);
+    }
+    argv[n] = NULL;
+    return argv;
+}
+
+/**
+ * @brief Copies everything a job wrote to its memfd to fd and closes the
+ * memfd. sendfile moves the data inside the kernel; targets it refuses,
+ * such as files opened with O_APPEND, get a plain read/write loop.
+ */
+static void par_flush(int memfd, int fd) {
+    off_t size = lseek(memfd, 0, SEEK_END);
+    off_t off = 0;
+    char buf[65536];
+
+    while (off < size) {
+        ssize_t n = sendfile(fd, memfd, &off, (size_t)(size - off));
+        if (n > 0) {
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n == 0 || (errno != EINVAL && errno != ENOSYS)) {
+            break;
+        }
+        while ((n = pread(memfd, buf, sizeof(buf), off)) > 0) {
+            for (ssize_t done = 0, w; done < n; done += w) {
+                if ((w = write(fd, buf + done, (size_t)(n - done))) < 0) {
+                    close(memfd);
+                    return;
+                }
+            }
+            off += n;
+        }
+        break;
+    }
+    close(memfd);
+}
+
+/**
+ * @brief Creates the memfds that hold a job's output in keep order mode.
+ * If memfds are not available the job writes straight to the terminal.
+ */
+static void par_buffer(struct par_slot *slot) {
+    slot->out = memfd_create("parallel-out", MFD_CLOEXEC);
+    slot->err = memfd_create("parallel-err", MFD_CLOEXEC);
+    if (slot->out < 0 || slot->err < 0) {
+        if (slot->out >= 0) {
+            close(slot->out);
+        }
+        if (slot->err >= 0) {
+            close(slot->err);
+        }
+        slot->out = slot->err = -1;
+    }
+}
+
+/**
+ * @brief Finds the slot for the next job. In order mode job seq always uses
+ * slot (seq - 1) % window, so it can only start once the job window places
+ * before it has been reported. That bounds what has to be held back.
+ * @return The slot, or NULL if the window is full.
+ */
+static struct par_slot *par_free_slot(struct par_run *p) {
+    if (p->keep_order) {
+        struct par_slot *slot = &p->slots[(p->next_seq - 1) % p->window];
+        return slot->busy ? NULL : slot;
+    }
+    if (p->running == p->window) {
+        return NULL;
+    }
+    for (size_t i = 0; i < p->window; i++) {
+        if (!p->slots[i].busy) {
+            return &p->slots[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Starts the job for arg in slot. A job that cannot be launched
+ * finishes straight away with the shell's status for the failure.
+ */
+static void par_launch(struct par_run *p, struct par_slot *slot, const char *arg) {
+    struct launch_opts opts = LAUNCH_OPTS_INIT;
+    opts.foreground = false;
+    opts.fd_in = p->fd_in;
+
+    memset(slot, 0, sizeof(*slot));
+    slot->busy = true;
+    slot->seq = p->next_seq++;
+    slot->arg = strdup(arg);
+    slot->out = slot->err = -1;
+    if (p->keep_order) {
+        par_buffer(slot);
+        opts.fd_out = slot->out;
+        opts.fd_err = slot->err;
+    }
+    slot->start = par_now();
+
+    char **argv = par_argv(p, arg, slot->seq);
+    pid_t pid = launch_proc(p->sh, argv, &opts);
+    if (pid < 0) {
+        bool missing = errno == ENOENT && strchr(argv[0], '/') == NULL;
+        dprintf(slot->err >= 0 ? slot->err : STDERR_FILENO, "parallel: %s: %s\n", argv[0],
+                missing ? "command not found" : strerror(errno));
+        slot->status = missing ? 127 : 126;
+        slot->finished = true;
+    } else {
+        slot->job = job_add(&p->sh->jobs, pid, &pid, 1, arg, false);
+        p->running++;
+    }
+    arena_reset(&p->arena);
+}
+
+/**
+ * @brief Reports a finished job, after its buffered output if it has any,
+ * and frees its slot.
+ */
+static void par_report(struct par_run *p, struct par_slot *slot) {
+    if (slot->out >= 0) {
+        par_flush(slot->out, STDOUT_FILENO);
+        par_flush(slot->err, STDERR_FILENO);
+    }
+    if (slot->status != 0) {
+        p->failed++;
+    }
+    if (!p->quiet) {
+        fprintf(stderr, "parallel: %zu exit %d %.3fs %s\n", slot->seq, slot->status,
+                slot->elapsed, slot->arg);
+    }
+    free(slot->arg);
+    memset(slot, 0, sizeof(*slot));
+}
+
+/**
+ * @brief Frees a slot that will never be reported. After an interrupt in
+ * keep order mode that includes jobs that finished behind one that did
+ * not, and their output memfds are closed with them so they do not stay
+ * open in the shell.
+ */
+static void par_discard(struct par_slot *slot) {
+    if (slot->busy) {
+        if (slot->out >= 0) {
+            close(slot->out);
+        }
+        if (slot->err >= 0) {
+            close(slot->err);
+        }
+    }
+    free(slot->arg);
+    memset(slot, 0, sizeof(*slot));
+}
+
+/**
+ * @brief Moves jobs that have finished out of the job table and reports
+ * them, in input order when keep_order is set.
+ */
+static void par_collect(struct par_run *p) {
+    double now = par_now();
+    for (size_t i = 0; i < p->window; i++) {
+        struct par_slot *slot = &p->slots[i];
+        if (slot->job != NULL && slot->job->state == JOB_DONE) {
+            slot->status = slot->job->status;
+            slot->elapsed = now - slot->start;
+            slot->finished = true;
+            job_remove(&p->sh->jobs, slot->job);
+            slot->job = NULL;
+            p->running--;
+        }
+        if (!p->keep_order && slot->busy && slot->finished) {
+            par_report(p, slot);
+        }
+    }
+    while (p->keep_order) {
+        struct par_slot *slot = &p->slots[(p->next_report - 1) % p->window];
+        if (!slot->busy || !slot->finished || slot->seq != p->next_report) {
+            break;
+        }
+        par_report(p, slot);
+        p->next_report++;
+    }
+}
+
+/**
+ * @brief Terminates every running job after an interrupt and waits for
+ * them so none is left behind.
+ */
+static void par_abort(struct par_run *p) {
+    for (size_t i = 0; i < p->window; i++) {
+        if (p->slots[i].job != NULL) {
+            job_kill(&p->sh->jobs, p->slots[i].job, SIGTERM);
+        }
+    }
+    p->sh->events.interrupted = false;
+    while (p->running > 0 && jobs_block(p->sh) == 0) {
+        par_collect(p);
+    }
+}
+
+/**
+ * @brief Parses the options of parallel.
+ * @return 0 on success, -1 on a usage error.
+ */
+static int par_options(struct par_run *p, char **argv, const char **file) {
+    int i = 1;
+    for (; argv[i] != NULL && argv[i][0] == '-'; i++) {
+        const char *opt = argv[i];
+        if (strcmp(opt, "-k") == 0) {
+            p->keep_order = true;
+        } else if (strcmp(opt, "-q") == 0) {
+            p->quiet = true;
+        } else if (strncmp(opt, "-j", 2) == 0) {
+            const char *n = opt[2] ? opt + 2 : argv[++i];
+            if (n == NULL || atoi(n) <= 0) {
+                return -1;
+            }
+            p->window = (size_t)atoi(n);
+        } else if (strcmp(opt, "-a") == 0) {
+            if ((*file = argv[++i]) == NULL) {
+                return -1;
+            }
+        } else {
+            return -1;
+        }
+    }
+
+    // The template runs up to ::: and the inputs follow it.
+    p->tmpl = &argv[i];
+    for (; argv[i] != NULL; i++) {
+        if (strcmp(argv[i], ":::") == 0) {
+            argv[i] = NULL;
+            p->args = &argv[i + 1];
+            break;
+        }
+        if (strstr(argv[i], "{}") != NULL) {
+            p->has_braces = true;
+        }
+    }
+    return p->tmpl[0] != NULL ? 0 : -1;
+}
+
+/**
+ * @brief The parallel built in command.
+ *
+ * parallel [-j N] [-k] [-q] [-a file] command [args...] [::: inputs...]
+ *
+ * Runs the command once per input with at most N jobs in flight, the
+ * number of online CPUs by default. Inputs are the arguments after :::,
+ * the lines of file with -a, or the lines of standard input, read only as
+ * fast as jobs are started. Jobs are launched straight from the shell
+ * through launch_proc, so there is no extra xargs process and the path
+ * cache resolves the command once. Each job is its own process group, and
+ * gets /dev/null as standard input when the inputs come from it.
+ *
+ * -k keeps the output in input order. Each job writes its stdout and
+ * stderr to memfds, anonymous memory backed files, which are copied to the
+ * shell's own stdout and stderr once every job before it has been
+ * reported. Jobs never wait on each other and nothing touches the disk.
+ * -q only reports the summary.
+ *
+ * @param sh A pointer to the shell structure.
+ * @param argv The command and its arguments, argv[0] is "parallel".
+ * @return 0 if every job succeeded, the number of failed jobs (at most
+ * 101) otherwise, 2 on a usage error and 130 if interrupted.
+ */
+int parallel_cmd(struct shell *sh, char **argv) {
+    struct par_run p;
+    const char *file = NULL;
+    int rval;
+
+    memset(&p, 0, sizeof(p));
+    p.sh = sh;
+    p.fd_in = -1;
+    p.next_seq = 1;
+    p.next_report = 1;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    p.window = cpus > 0 ? (size_t)cpus : 1;
+    if (par_options(&p, argv, &file) != 0) {
+        fprintf(stderr, "parallel: usage: parallel [-j N] [-k] [-q] [-a file] command "
+                        "[args...] [::: inputs...]\n");
+        return 2;
+    }
+
+    if (p.args == NULL) {
+        p.use_reader = true;
+        rval = file ? reader_open_file(&p.in, file) : reader_open_fd(&p.in, STDIN_FILENO);
+        if (rval != 0) {
+            fprintf(stderr, "parallel: %s: %s\n", file ? file : "stdin", strerror(errno));
+            return 1;
+        }
+        // Jobs must not eat the list they are started from.
+        if (file == NULL) {
+            p.fd_in = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        }
+    }
+    p.slots = calloc(p.window, sizeof(*p.slots));
+    if (p.slots == NULL) {
+        fprintf(stderr, "parallel: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    arena_init(&p.arena, 0);
+    fflush(stdout);
+
+    double start = par_now();
+    bool more = true;
+    bool interrupted = false;
+    sh->events.interrupted = false;
+    for (;;) {
+        struct par_slot *slot;
+        while (more && (slot = par_free_slot(&p)) != NULL) {
+            const char *arg = par_next_input(&p);
+            if (arg == NULL) {
+                more = false;
+                break;
+            }
+            par_launch(&p, slot, arg);
+        }
+        par_collect(&p);
+        if (p.running == 0) {
+            if (!more) {
+                break;
+            }
+            continue; // Only launch failures were in flight, all reported now.
+        }
+        if (jobs_block(sh) != 0 || sh->events.interrupted) {
+            interrupted = true;
+            par_abort(&p);
+            break;
+        }
+    }
+
+    fprintf(stderr, "parallel: %zu jobs, %zu failed, %.3fs wall\n", p.next_seq - 1, p.failed,
+            par_now() - start);
+    rval = p.failed > PAR_MAX_FAILED ? PAR_MAX_FAILED : (int)p.failed;
+    if (interrupted) {
+        rval = 128 + SIGINT;
+    }
+    for (size_t i = 0; i < p.window; i++) {
+        par_discard(&p.slots[i]);
+    }
+    free(p.slots);
+    arena_destroy(&p.arena);
+    if (p.use_reader) {
+        reader_close(&p.in);
+    }
+    if (p.fd_in >= 0) {
+        close(p.fd_in);
+    }
+    return rval;
+}
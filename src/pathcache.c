@@ -0,0 +1,484 @@
+#include "lab.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+/* Search path used by execvp when PATH is not set. */
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+/* Initial number of slots, must be a power of two. */
+#define PATH_CACHE_MIN 64
+
+/**
+ * @brief 64-bit FNV-1a hash of a NUL terminated string.
+ */
+static size_t path_hash(const char *s) {
+    uint64_t h = 14695981039346656037ULL;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+    return (size_t)h;
+}
+
+/**
+ * @brief Returns the value of PATH, or the execvp default if it is unset.
+ */
+static const char *path_env(void) {
+    const char *path = getenv("PATH");
+    return path != NULL ? path : DEFAULT_PATH;
+}
+
+/**
+ * @brief Finds the slot for name. The returned slot either holds name or is
+ * the empty slot where name would be inserted.
+ */
+static struct path_entry *path_slot(struct path_cache *pc, const char *name) {
+    size_t mask = pc->size - 1;
+    size_t i = path_hash(name) & mask;
+    while (pc->table[i].name != NULL && strcmp(pc->table[i].name, name) != 0) {
+        i = (i + 1) & mask;
+    }
+    return &pc->table[i];
+}
+
+/**
+ * @brief Doubles the table (or creates it) and rehashes every entry.
+ * @return 0 on success, -1 if the allocation failed.
+ */
+static int path_grow(struct path_cache *pc) {
+    size_t old_size = pc->size;
+    struct path_entry *old = pc->table;
+    size_t size = old_size ? old_size * 2 : PATH_CACHE_MIN;
+
+    struct path_entry *table = calloc(size, sizeof(*table));
+    if (table == NULL) {
+        return -1;
+    }
+    pc->table = table;
+    pc->size = size;
+    for (size_t i = 0; i < old_size; i++) {
+        if (old[i].name != NULL) {
+            *path_slot(pc, old[i].name) = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+/**
+ * @brief Drops every entry if PATH changed since the entries were resolved.
+ */
+static void path_check_env(struct path_cache *pc) {
+    const char *path = path_env();
+    if (pc->path_env != NULL && strcmp(pc->path_env, path) == 0) {
+        return;
+    }
+    path_cache_reset(pc);
+    free(pc->path_env);
+    pc->path_env = strdup(path);
+}
+
+/**
+ * @brief Copies the next PATH element into buf.
+ *
+ * @param dir The start of the element, updated to the start of the next one
+ * or NULL after the last element.
+ * @param buf Receives the directory, PATH_MAX bytes long.
+ * @return The length of the directory, or 0 if it does not fit in buf.
+ */
+static size_t path_next_dir(const char **dir, char *buf) {
+    const char *start = *dir;
+    const char *end = strchr(start, ':');
+    size_t len = end ? (size_t)(end - start) : strlen(start);
+
+    *dir = end ? end + 1 : NULL;
+    // An empty PATH element means the current directory.
+    if (len == 0) {
+        start = ".";
+        len = 1;
+    }
+    if (len >= PATH_MAX) {
+        return 0;
+    }
+    memcpy(buf, start, len);
+    buf[len] = '\0';
+    return len;
+}
+
+/**
+ * @brief Records the modification time of every PATH directory. Negative
+ * entries stay valid for as long as none of these times change.
+ */
+static void path_snapshot_dirs(struct path_cache *pc) {
+    const char *dir = pc->path_env;
+    char buf[PATH_MAX];
+    size_t n = 0;
+
+    while (dir != NULL) {
+        if (n == pc->dir_cap) {
+            size_t cap = pc->dir_cap ? pc->dir_cap * 2 : 16;
+            struct timespec *tmp = realloc(pc->dir_mtime, cap * sizeof(*tmp));
+            if (tmp == NULL) {
+                break;
+            }
+            pc->dir_mtime = tmp;
+            pc->dir_cap = cap;
+        }
+        struct stat st;
+        memset(&pc->dir_mtime[n], 0, sizeof(pc->dir_mtime[n]));
+        // A missing directory keeps a zero time so creating it counts as a change.
+        if (path_next_dir(&dir, buf) != 0 && stat(buf, &st) == 0) {
+            pc->dir_mtime[n] = st.st_mtim;
+        }
+        n++;
+    }
+    pc->ndirs = n;
+    pc->snapshot = true;
+}
+
+/**
+ * @brief Checks whether any PATH directory was modified since the last
+ * snapshot. Costs one stat per directory but never creates a process.
+ *
+ * @return true if a directory changed (or there is no snapshot).
+ */
+static bool path_dirs_changed(struct path_cache *pc) {
+    const char *dir = pc->path_env;
+    char buf[PATH_MAX];
+    size_t n = 0;
+
+    if (!pc->snapshot) {
+        return true;
+    }
+    while (dir != NULL && n < pc->ndirs) {
+        struct stat st;
+        struct timespec mtime = {0, 0};
+        if (path_next_dir(&dir, buf) != 0 && stat(buf, &st) == 0) {
+            mtime = st.st_mtim;
+        }
+        if (mtime.tv_sec != pc->dir_mtime[n].tv_sec ||
+            mtime.tv_nsec != pc->dir_mtime[n].tv_nsec) {
+            return true;
+        }
+        n++;
+    }
+    return dir != NULL;
+}
+
+/**
+ * @brief Walks PATH looking for an executable regular file called name.
+ *
+ * @param name The command to find, it must not contain a slash.
+ * @param buf Receives the full path of the command, PATH_MAX bytes long.
+ * @return 0 if the command was found, -1 otherwise.
+ */
+static int path_search(const char *name, char *buf) {
+    const char *dir = path_env();
+    size_t name_len = strlen(name);
+
+    while (dir != NULL) {
+        size_t dir_len = path_next_dir(&dir, buf);
+        if (dir_len != 0 && dir_len + name_len + 2 <= PATH_MAX) {
+            struct stat st;
+            buf[dir_len] = '/';
+            memcpy(buf + dir_len + 1, name, name_len + 1);
+            if (stat(buf, &st) == 0 && S_ISREG(st.st_mode) && access(buf, X_OK) == 0) {
+                return 0;
+            }
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Initializes an empty path cache. A zeroed cache is also valid, the
+ * table is allocated on first use.
+ *
+ * @param pc The cache to initialize.
+ */
+void path_cache_init(struct path_cache *pc) {
+    memset(pc, 0, sizeof(*pc));
+}
+
+/**
+ * @brief Frees every entry and the table itself.
+ *
+ * @param pc The cache to destroy.
+ */
+void path_cache_destroy(struct path_cache *pc) {
+    path_cache_reset(pc);
+    free(pc->table);
+    free(pc->path_env);
+    free(pc->dir_mtime);
+    memset(pc, 0, sizeof(*pc));
+}
+
+/**
+ * @brief Forgets every remembered location, found or not found. The table
+ * and the hit and miss counters are kept.
+ *
+ * @param pc The cache to reset.
+ */
+void path_cache_reset(struct path_cache *pc) {
+    for (size_t i = 0; i < pc->size; i++) {
+        free(pc->table[i].name);
+        free(pc->table[i].path);
+    }
+    if (pc->table != NULL) {
+        memset(pc->table, 0, pc->size * sizeof(*pc->table));
+    }
+    pc->count = 0;
+    pc->negatives = 0;
+    pc->snapshot = false;
+}
+
+/**
+ * @brief Stores an entry for name, replacing any previous entry. A NULL path
+ * records that name was not found on PATH.
+ *
+ * @return The entry, or NULL if memory could not be allocated.
+ */
+static struct path_entry *path_insert(struct path_cache *pc, const char *name,
+                                      const char *path) {
+    if ((pc->count + 1) * 10 >= pc->size * 7 && path_grow(pc) != 0) {
+        return NULL;
+    }
+
+    struct path_entry *e = path_slot(pc, name);
+    char *copy = NULL;
+    if (path != NULL && (copy = strdup(path)) == NULL) {
+        return NULL;
+    }
+    if (e->name == NULL) {
+        e->name = strdup(name);
+        if (e->name == NULL) {
+            free(copy);
+            return NULL;
+        }
+        pc->count++;
+    } else if (e->path == NULL) {
+        pc->negatives--;
+    }
+    if (copy == NULL) {
+        pc->negatives++;
+    }
+    free(e->path);
+    e->path = copy;
+    e->hits = 0;
+    return e;
+}
+
+/**
+ * @brief Empties the slot at index. Uses backward shift deletion so lookups
+ * never have to skip tombstones.
+ */
+static void path_remove_slot(struct path_cache *pc, size_t index) {
+    struct path_entry *e = &pc->table[index];
+    if (e->path == NULL) {
+        pc->negatives--;
+    }
+    free(e->name);
+    free(e->path);
+
+    size_t mask = pc->size - 1;
+    size_t hole = index;
+    size_t i = (hole + 1) & mask;
+    while (pc->table[i].name != NULL) {
+        size_t home = path_hash(pc->table[i].name) & mask;
+        // Move the entry back if the hole lies between its home and its slot.
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            pc->table[hole] = pc->table[i];
+            hole = i;
+        }
+        i = (i + 1) & mask;
+    }
+    memset(&pc->table[hole], 0, sizeof(pc->table[hole]));
+    pc->count--;
+}
+
+/**
+ * @brief Forgets every command that was recorded as not found.
+ */
+static void path_drop_negatives(struct path_cache *pc) {
+    size_t i = 0;
+    while (pc->negatives > 0 && i < pc->size) {
+        // Removal can shift a later entry into slot i, so look at it again.
+        if (pc->table[i].name != NULL && pc->table[i].path == NULL) {
+            path_remove_slot(pc, i);
+        } else {
+            i++;
+        }
+    }
+}
+
+/**
+ * @brief Remembers that name lives at path, replacing any previous entry.
+ *
+ * @param pc The cache.
+ * @param name The command name.
+ * @param path The full path of the command.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int path_cache_add(struct path_cache *pc, const char *name, const char *path) {
+    path_check_env(pc);
+    return path_insert(pc, name, path) != NULL ? 0 : -1;
+}
+
+/**
+ * @brief Forgets the remembered location of name.
+ *
+ * @param pc The cache.
+ * @param name The command name.
+ * @return 0 if name was removed, -1 if it was not in the cache.
+ */
+int path_cache_remove(struct path_cache *pc, const char *name) {
+    if (pc->size == 0) {
+        return -1;
+    }
+    struct path_entry *e = path_slot(pc, name);
+    if (e->name == NULL) {
+        return -1;
+    }
+    path_remove_slot(pc, (size_t)(e - pc->table));
+    return 0;
+}
+
+/**
+ * @brief Resolves a command name to the path that exec should use.
+ *
+ * Names containing a slash are returned unchanged. Anything else is looked
+ * up in the cache first and only on a miss is PATH walked. Names that are
+ * not found are cached too, those entries are trusted until one of the
+ * PATH directories is modified. The cache is flushed whenever PATH changes.
+ *
+ * @param pc The cache.
+ * @param name The command name.
+ * @return The path to exec, owned by the cache and valid until the next
+ * call that modifies it, or NULL with errno set to ENOENT.
+ */
+const char *path_lookup(struct path_cache *pc, const char *name) {
+    if (strchr(name, '/') != NULL) {
+        return name;
+    }
+    if (*name == '\0') {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    path_check_env(pc);
+    if (pc->size != 0) {
+        struct path_entry *e = path_slot(pc, name);
+        if (e->name != NULL && e->path != NULL) {
+            pc->hits++;
+            e->hits++;
+            return e->path;
+        }
+        if (e->name != NULL) {
+            if (!path_dirs_changed(pc)) {
+                pc->neg_hits++;
+                e->hits++;
+                errno = ENOENT;
+                return NULL;
+            }
+            // Something was installed or removed, every negative entry is suspect.
+            path_drop_negatives(pc);
+            pc->snapshot = false;
+        }
+    }
+
+    pc->misses++;
+    // Snapshot before searching so a change during the search is not missed.
+    if (!pc->snapshot) {
+        path_snapshot_dirs(pc);
+    }
+    char buf[PATH_MAX];
+    int found = path_search(name, buf);
+    struct path_entry *e = path_insert(pc, name, found == 0 ? buf : NULL);
+    if (found != 0) {
+        errno = ENOENT;
+        return NULL;
+    }
+    if (e == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    e->hits = 1;
+    return e->path;
+}
+
+/**
+ * @brief The hash built in command.
+ *
+ * - hash: list remembered commands with their hit counts.
+ * - hash -r: forget every remembered location.
+ * - hash -d name...: forget the given names.
+ * - hash -p path name: remember that name lives at path.
+ * - hash -s: print the total hits and misses, including lookups answered
+ *   by a cached "not found".
+ * - hash name...: look up and remember the given names.
+ *
+ * @param sh A pointer to the shell structure.
+ * @param argv The command and its arguments, argv[0] is "hash".
+ * @return 0 on success, 1 if any argument failed.
+ */
+int hash_cmd(struct shell *sh, char **argv) {
+    struct path_cache *pc = &sh->paths;
+    int rval = 0;
+
+    if (argv[1] == NULL) {
+        if (pc->count == pc->negatives) {
+            printf("hash: hash table empty\n");
+            return 0;
+        }
+        printf("hits\tcommand\n");
+        for (size_t i = 0; i < pc->size; i++) {
+            if (pc->table[i].path != NULL) {
+                printf("%4lu\t%s\n", pc->table[i].hits, pc->table[i].path);
+            }
+        }
+        return 0;
+    }
+
+    if (strcmp(argv[1], "-r") == 0) {
+        path_cache_reset(pc);
+        return 0;
+    }
+
+    if (strcmp(argv[1], "-s") == 0) {
+        printf("hits %lu misses %lu not-found hits %lu entries %zu not-found %zu\n",
+               pc->hits, pc->misses, pc->neg_hits, pc->count - pc->negatives,
+               pc->negatives);
+        return 0;
+    }
+
+    if (strcmp(argv[1], "-p") == 0) {
+        if (argv[2] == NULL || argv[3] == NULL) {
+            fprintf(stderr, "hash: usage: hash -p path name\n");
+            return 1;
+        }
+        return path_cache_add(pc, argv[3], argv[2]) == 0 ? 0 : 1;
+    }
+
+    if (strcmp(argv[1], "-d") == 0) {
+        for (int i = 2; argv[i]; i++) {
+            if (path_cache_remove(pc, argv[i]) != 0) {
+                fprintf(stderr, "hash: %s: not found\n", argv[i]);
+                rval = 1;
+            }
+        }
+        return rval;
+    }
+
+    for (int i = 1; argv[i]; i++) {
+        if (path_lookup(pc, argv[i]) == NULL) {
+            fprintf(stderr, "hash: %s: not found\n", argv[i]);
+            rval = 1;
+        }
+    }
+    return rval;
+}
@@ -0,0 +1,281 @@
+#include "lab.h"
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+/* Bytes classified per call to a mask kernel. */
+#define SCAN_BLOCK 64
+
+/*
+ * Delimiter tables for the scalar kernel. SCAN_TOKEN matches the characters
+ * cmd_parse splits on, SCAN_SPACE matches isspace in the C locale.
+ */
+static const unsigned char token_delim[256] = {
+    [' '] = 1, ['\t'] = 1, ['\r'] = 1, ['\n'] = 1, ['\a'] = 1,
+};
+static const unsigned char space_delim[256] = {
+    [' '] = 1, ['\t'] = 1, ['\n'] = 1, ['\v'] = 1, ['\f'] = 1, ['\r'] = 1,
+};
+
+/**
+ * @brief Classifies 64 bytes, bit i of the result is set if p[i] is a
+ * delimiter of the given class.
+ */
+typedef uint64_t (*scan_mask_fn)(const unsigned char *p, enum scan_class cls);
+
+static uint64_t mask_scalar(const unsigned char *p, enum scan_class cls) {
+    const unsigned char *table = cls == SCAN_TOKEN ? token_delim : space_delim;
+    uint64_t mask = 0;
+    for (int i = 0; i < SCAN_BLOCK; i++) {
+        mask |= (uint64_t)table[p[i]] << i;
+    }
+    return mask;
+}
+
+#ifdef SCAN_X86
+/**
+ * @brief SSE2 classification of 16 bytes.
+ */
+__attribute__((target("sse2"))) static inline uint32_t mask16_sse2(const unsigned char *p,
+                                                                   enum scan_class cls) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i hit = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    if (cls == SCAN_TOKEN) {
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('\a')));
+    } else {
+        // '\t' through '\r' is the range 9..13, test (c - 9) <= 4 unsigned.
+        __m128i t = _mm_sub_epi8(v, _mm_set1_epi8(9));
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(4)), t));
+    }
+    return (uint32_t)_mm_movemask_epi8(hit);
+}
+
+__attribute__((target("sse2"))) static uint64_t mask_sse2(const unsigned char *p,
+                                                          enum scan_class cls) {
+    return (uint64_t)mask16_sse2(p, cls) | (uint64_t)mask16_sse2(p + 16, cls) << 16 |
+           (uint64_t)mask16_sse2(p + 32, cls) << 32 | (uint64_t)mask16_sse2(p + 48, cls) << 48;
+}
+
+/**
+ * @brief AVX2 classification of 32 bytes.
+ */
+__attribute__((target("avx2"))) static inline uint32_t mask32_avx2(const unsigned char *p,
+                                                                   enum scan_class cls) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    __m256i hit = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+    if (cls == SCAN_TOKEN) {
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')));
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\a')));
+    } else {
+        __m256i t = _mm256_sub_epi8(v, _mm256_set1_epi8(9));
+        hit = _mm256_or_si256(
+            hit, _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(4)), t));
+    }
+    return (uint32_t)_mm256_movemask_epi8(hit);
+}
+
+__attribute__((target("avx2"))) static uint64_t mask_avx2(const unsigned char *p,
+                                                          enum scan_class cls) {
+    return (uint64_t)mask32_avx2(p, cls) | (uint64_t)mask32_avx2(p + 32, cls) << 32;
+}
+#endif
+
+static uint64_t mask_resolve(const unsigned char *p, enum scan_class cls);
+
+/* The active kernel, picked on first use like an IFUNC. */
+static scan_mask_fn scan_mask = mask_resolve;
+static enum scan_kernel scan_active = SCAN_SCALAR;
+
+/**
+ * @brief Selects the best kernel on the first call and forwards to it.
+ */
+static uint64_t mask_resolve(const unsigned char *p, enum scan_class cls) {
+    scan_set_kernel(scan_best_kernel());
+    return scan_mask(p, cls);
+}
+
+/**
+ * @brief Returns the fastest kernel the CPU supports, found with cpuid.
+ *
+ * @return The kernel.
+ */
+enum scan_kernel scan_best_kernel(void) {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return SCAN_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return SCAN_SSE2;
+    }
+#endif
+    return SCAN_SCALAR;
+}
+
+/**
+ * @brief Forces the kernel used by every scan function. Benchmarks and tests
+ * use this to compare kernels.
+ *
+ * @param kernel The kernel to use.
+ * @return 0 on success, -1 if the CPU does not support the kernel.
+ */
+int scan_set_kernel(enum scan_kernel kernel) {
+    switch (kernel) {
+    case SCAN_SCALAR:
+        scan_mask = mask_scalar;
+        break;
+#ifdef SCAN_X86
+    case SCAN_SSE2:
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("sse2")) {
+            return -1;
+        }
+        scan_mask = mask_sse2;
+        break;
+    case SCAN_AVX2:
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("avx2")) {
+            return -1;
+        }
+        scan_mask = mask_avx2;
+        break;
+#endif
+    default:
+        return -1;
+    }
+    scan_active = kernel;
+    return 0;
+}
+
+/**
+ * @brief Returns the kernel in use, selecting one first if needed.
+ *
+ * @return The kernel.
+ */
+enum scan_kernel scan_get_kernel(void) {
+    if (scan_mask == mask_resolve) {
+        scan_set_kernel(scan_best_kernel());
+    }
+    return scan_active;
+}
+
+/**
+ * @brief Classifies the block that starts at offset i of s. A partial block
+ * at the end is copied into a buffer padded with spaces, which are
+ * delimiters in every class, so kernels can always read 64 bytes.
+ */
+static uint64_t block_mask(const char *s, size_t len, size_t i, enum scan_class cls) {
+    if (len - i >= SCAN_BLOCK) {
+        return scan_mask((const unsigned char *)s + i, cls);
+    }
+    unsigned char tail[SCAN_BLOCK];
+    memset(tail, ' ', sizeof(tail));
+    memcpy(tail, s + i, len - i);
+    return scan_mask(tail, cls);
+}
+
+/**
+ * @brief Finds the first byte that is not a delimiter.
+ *
+ * @param s The string to scan.
+ * @param len The number of bytes to scan.
+ * @param cls The delimiter class.
+ * @return The offset of the first non delimiter, or len if there is none.
+ */
+size_t scan_skip(const char *s, size_t len, enum scan_class cls) {
+    for (size_t i = 0; i < len; i += SCAN_BLOCK) {
+        uint64_t tokens = ~block_mask(s, len, i, cls);
+        if (tokens != 0) {
+            return i + (size_t)__builtin_ctzll(tokens);
+        }
+    }
+    return len;
+}
+
+/**
+ * @brief Finds the end of s once trailing delimiters are removed.
+ *
+ * @param s The string to scan.
+ * @param len The number of bytes to scan.
+ * @param cls The delimiter class.
+ * @return The length of s without its trailing delimiters.
+ */
+size_t scan_rskip(const char *s, size_t len, enum scan_class cls) {
+    size_t i = len;
+    while (i > 0) {
+        // Scan whole blocks backwards, only the one at the start may be partial.
+        size_t start = i >= SCAN_BLOCK ? i - SCAN_BLOCK : 0;
+        uint64_t tokens = ~block_mask(s, i, start, cls);
+        if (tokens != 0) {
+            return start + 64 - (size_t)__builtin_clzll(tokens);
+        }
+        i = start;
+    }
+    return 0;
+}
+
+/**
+ * @brief Counts the tokens in s. A token starts wherever a non delimiter
+ * follows a delimiter, so each block is counted with a shift and a popcount.
+ *
+ * @param s The string to scan.
+ * @param len The number of bytes to scan.
+ * @return The number of SCAN_TOKEN separated tokens.
+ */
+size_t scan_count_tokens(const char *s, size_t len) {
+    size_t count = 0;
+    uint64_t carry = 0; // Set if the previous block ended inside a token.
+
+    for (size_t i = 0; i < len; i += SCAN_BLOCK) {
+        uint64_t tokens = ~block_mask(s, len, i, SCAN_TOKEN);
+        uint64_t starts = tokens & ~((tokens << 1) | carry);
+        count += (size_t)__builtin_popcountll(starts);
+        carry = tokens >> 63;
+    }
+    return count;
+}
+
+/**
+ * @brief Splits s in place into SCAN_TOKEN separated tokens. Each token is
+ * terminated by overwriting the delimiter that follows it and its start is
+ * stored in tokens. Blocks are classified before they are modified.
+ *
+ * @param s The NUL terminated string to split.
+ * @param len The length of s.
+ * @param tokens Receives the start of each token, it must have room for
+ * scan_count_tokens(s, len) pointers.
+ * @return The number of tokens stored.
+ */
+size_t scan_split(char *s, size_t len, char **tokens) {
+    size_t count = 0;
+    uint64_t carry = 0;
+
+    for (size_t i = 0; i < len; i += SCAN_BLOCK) {
+        uint64_t tok = ~block_mask(s, len, i, SCAN_TOKEN);
+        uint64_t prev = (tok << 1) | carry;
+        uint64_t starts = tok & ~prev;
+        uint64_t ends = ~tok & prev;
+        carry = tok >> 63;
+
+        // Padding past len is never a token so no start lands beyond it and
+        // an end at len only rewrites the terminator.
+        while (starts != 0) {
+            tokens[count++] = s + i + __builtin_ctzll(starts);
+            starts &= starts - 1;
+        }
+        while (ends != 0) {
+            s[i + __builtin_ctzll(ends)] = '\0';
+            ends &= ends - 1;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,242 @@
+#include "lab.h"
+#include <stdio.h>
+#include <string.h>
+
+/* Bucket count of each power of two above the exact range. */
+#define STATS_SUB (1 << STATS_SUB_BITS)
+
+/* Stage and counter names, in enum order. */
+static const char *const stage_names[STATS_NSTAGES] = {
+    "read", "trim", "parse", "builtin", "launch", "wait",
+};
+static const char *const counter_names[STATS_NCOUNTERS] = {
+    "lines", "builtins", "processes", "launch_errors", "failures",
+};
+
+/* Percentiles reported, and their labels. */
+static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+static const char *const quantile_names[] = {"p50", "p90", "p99", "p999"};
+
+#define NQUANTILES (sizeof(quantiles) / sizeof(quantiles[0]))
+
+/**
+ * @brief Finds the bucket of a value. Values below STATS_SUB have one
+ * each, above that the top STATS_SUB_BITS + 1 bits pick the bucket.
+ */
+static size_t stats_bucket(uint64_t v) {
+    if (v >= (uint64_t)1 << STATS_MAX_BITS) {
+        v = ((uint64_t)1 << STATS_MAX_BITS) - 1;
+    }
+    if (v < STATS_SUB) {
+        return (size_t)v;
+    }
+    int e = 63 - __builtin_clzll(v);
+    return (size_t)(e - STATS_SUB_BITS + 1) * STATS_SUB +
+           (size_t)((v >> (e - STATS_SUB_BITS)) - STATS_SUB);
+}
+
+/**
+ * @brief Returns the highest value that lands in a bucket.
+ */
+static uint64_t stats_bucket_top(size_t i) {
+    if (i < STATS_SUB) {
+        return i;
+    }
+    int shift = (int)(i / STATS_SUB) - 1;
+    uint64_t sub = i % STATS_SUB + STATS_SUB;
+    return ((sub + 1) << shift) - 1;
+}
+
+/**
+ * @brief Empties every counter and histogram and restarts the clock.
+ *
+ * @param s The statistics.
+ */
+void stats_reset(struct stats *s) {
+    memset(s, 0, sizeof(*s));
+    s->since = time_now_ns();
+}
+
+/**
+ * @brief Records how long a stage took: one bucket increment and the exact
+ * count, sum, min and max, so it is cheap enough to leave on.
+ *
+ * @param s The statistics, or NULL to record nothing.
+ * @param stage The stage.
+ * @param ns The time in nanoseconds, negative times count as 0.
+ */
+void stats_record(struct stats *s, enum stats_stage stage, int64_t ns) {
+    if (s == NULL) {
+        return;
+    }
+    struct stats_hist *h = &s->stages[stage];
+    uint64_t v = ns > 0 ? (uint64_t)ns : 0;
+    if (h->count == 0 || v < h->min) {
+        h->min = v;
+    }
+    if (v > h->max) {
+        h->max = v;
+    }
+    h->count++;
+    h->sum += v;
+    h->buckets[stats_bucket(v)]++;
+}
+
+/**
+ * @brief Counts an event.
+ *
+ * @param s The statistics, or NULL to count nothing.
+ * @param counter The event.
+ */
+void stats_count(struct stats *s, enum stats_counter counter) {
+    if (s != NULL) {
+        s->counters[counter]++;
+    }
+}
+
+/**
+ * @brief Estimates a percentile by walking the buckets to the one holding
+ * the value at that rank.
+ *
+ * @param h The histogram.
+ * @param q The fraction of values at or below the result.
+ * @return The top of that bucket, at most the exact maximum, or 0 when the
+ * histogram is empty.
+ */
+uint64_t stats_percentile(const struct stats_hist *h, double q) {
+    if (h->count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(q * (double)h->count + 0.999999);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < STATS_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            // The last bucket is open ended, the maximum is its best bound.
+            uint64_t top = i + 1 < STATS_BUCKETS ? stats_bucket_top(i) : h->max;
+            return top < h->max ? top : h->max;
+        }
+    }
+    return h->max;
+}
+
+/**
+ * @brief Formats a duration in the unit that keeps it short.
+ */
+static void stats_duration(char *buf, size_t size, uint64_t ns) {
+    if (ns < 1000) {
+        snprintf(buf, size, "%lluns", (unsigned long long)ns);
+    } else if (ns < 1000000) {
+        snprintf(buf, size, "%.1fus", ns / 1e3);
+    } else if (ns < 1000000000) {
+        snprintf(buf, size, "%.1fms", ns / 1e6);
+    } else {
+        snprintf(buf, size, "%.2fs", ns / 1e9);
+    }
+}
+
+/**
+ * @brief Writes a table: the counters, then one row per stage.
+ */
+static void stats_table(struct writer *w, const struct stats *s) {
+    char line[256];
+    char cell[6][16];
+
+    for (int c = 0; c < STATS_NCOUNTERS; c++) {
+        snprintf(line, sizeof(line), "%-14s %llu\n", counter_names[c],
+                 (unsigned long long)s->counters[c]);
+        writer_str(w, line);
+    }
+    stats_duration(cell[0], sizeof(cell[0]), (uint64_t)(time_now_ns() - s->since));
+    snprintf(line, sizeof(line), "%-14s %s\n\n", "elapsed", cell[0]);
+    writer_str(w, line);
+
+    snprintf(line, sizeof(line), "%-8s %10s %9s %9s %9s %9s %9s %9s\n", "stage", "count", "mean",
+             "p50", "p90", "p99", "p99.9", "max");
+    writer_str(w, line);
+    for (int i = 0; i < STATS_NSTAGES; i++) {
+        const struct stats_hist *h = &s->stages[i];
+        stats_duration(cell[0], sizeof(cell[0]), h->count ? h->sum / h->count : 0);
+        for (size_t q = 0; q < NQUANTILES; q++) {
+            stats_duration(cell[q + 1], sizeof(cell[q + 1]), stats_percentile(h, quantiles[q]));
+        }
+        stats_duration(cell[5], sizeof(cell[5]), h->max);
+        snprintf(line, sizeof(line), "%-8s %10llu %9s %9s %9s %9s %9s %9s\n", stage_names[i],
+                 (unsigned long long)h->count, cell[0], cell[1], cell[2], cell[3], cell[4],
+                 cell[5]);
+        writer_str(w, line);
+    }
+}
+
+/**
+ * @brief Writes the statistics as one JSON object, every time in
+ * nanoseconds.
+ */
+static void stats_json(struct writer *w, const struct stats *s) {
+    char buf[128];
+
+    snprintf(buf, sizeof(buf), "{\"elapsed_ns\":%lld,\"counters\":{",
+             (long long)(time_now_ns() - s->since));
+    writer_str(w, buf);
+    for (int c = 0; c < STATS_NCOUNTERS; c++) {
+        snprintf(buf, sizeof(buf), "%s\"%s\":%llu", c ? "," : "", counter_names[c],
+                 (unsigned long long)s->counters[c]);
+        writer_str(w, buf);
+    }
+    writer_str(w, "},\"stages\":{");
+    for (int i = 0; i < STATS_NSTAGES; i++) {
+        const struct stats_hist *h = &s->stages[i];
+        snprintf(buf, sizeof(buf), "%s\"%s\":{\"count\":%llu,\"sum_ns\":%llu,\"min_ns\":%llu",
+                 i ? "," : "", stage_names[i], (unsigned long long)h->count,
+                 (unsigned long long)h->sum, (unsigned long long)h->min);
+        writer_str(w, buf);
+        for (size_t q = 0; q < NQUANTILES; q++) {
+            snprintf(buf, sizeof(buf), ",\"%s_ns\":%llu", quantile_names[q],
+                     (unsigned long long)stats_percentile(h, quantiles[q]));
+            writer_str(w, buf);
+        }
+        snprintf(buf, sizeof(buf), ",\"max_ns\":%llu}", (unsigned long long)h->max);
+        writer_str(w, buf);
+    }
+    writer_str(w, "}}\n");
+}
+
+/**
+ * @brief Reports the shell's counters and stage latencies.
+ *
+ * @param sh The shell, the report goes to sh->out.
+ * @param argv The command and its arguments.
+ * @return 0 on success, 1 if the shell keeps no statistics or on a write
+ * error, 2 on a usage error.
+ */
+int stats_cmd(struct shell *sh, char **argv) {
+    bool json = false;
+    bool reset = false;
+
+    for (int i = 1; argv[i] != NULL; i++) {
+        if (strcmp(argv[i], "-j") == 0) {
+            json = true;
+        } else if (strcmp(argv[i], "-r") == 0) {
+            reset = true;
+        } else {
+            fprintf(stderr, "usage: stats [-j] [-r]\n");
+            return 2;
+        }
+    }
+    if (sh->stats == NULL) {
+        fprintf(stderr, "stats: not collecting\n");
+        return 1;
+    }
+    if (json) {
+        stats_json(sh->out, sh->stats);
+    } else if (!reset) {
+        stats_table(sh->out, sh->stats);
+    }
+    if (reset) {
+        stats_reset(sh->stats);
+    }
+    return sh->out->error != 0 ? 1 : 0;
+}
@@ -0,0 +1,219 @@
+#define _GNU_SOURCE
+#include "lab.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/time.h>
+
+/**
+ * @brief What time found out about one command. The phases that do not
+ * apply to it, fork, exec and wait for a builtin and run for anything
+ * else, are -1.
+ */
+struct time_report {
+    int64_t real;
+    int64_t parse;
+    int64_t fork;
+    int64_t exec;
+    int64_t wait;
+    int64_t run;
+    struct rusage usage;
+};
+
+/**
+ * @brief Returns a monotonic clock in nanoseconds.
+ * @return The time.
+ */
+int64_t time_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief Converts a timeval to nanoseconds.
+ */
+static int64_t timeval_ns(const struct timeval *tv) {
+    return (int64_t)tv->tv_sec * 1000000000 + (int64_t)tv->tv_usec * 1000;
+}
+
+/**
+ * @brief Prints a duration in the unit that keeps it readable, unless it
+ * is -1.
+ */
+static void time_line(const char *label, int64_t ns) {
+    if (ns < 0) {
+        return;
+    }
+    if (ns < 1000) {
+        fprintf(stderr, "%-7s %9lld ns\n", label, (long long)ns);
+    } else if (ns < 1000000) {
+        fprintf(stderr, "%-7s %9.3f us\n", label, ns / 1e3);
+    } else if (ns < 1000000000) {
+        fprintf(stderr, "%-7s %9.3f ms\n", label, ns / 1e6);
+    } else {
+        fprintf(stderr, "%-7s %9.3f s\n", label, ns / 1e9);
+    }
+}
+
+/**
+ * @brief Prints a report on stderr, the command first and then the shell.
+ */
+static void time_print(const struct time_report *r) {
+    time_line("real", r->real);
+    time_line("user", timeval_ns(&r->usage.ru_utime));
+    time_line("sys", timeval_ns(&r->usage.ru_stime));
+    fprintf(stderr, "%-7s %9ld KB\n", "maxrss", r->usage.ru_maxrss);
+    fprintf(stderr, "%-7s %9ld voluntary, %ld involuntary\n", "ctxsw", r->usage.ru_nvcsw,
+            r->usage.ru_nivcsw);
+    time_line("parse", r->parse);
+    time_line("fork", r->fork);
+    time_line("exec", r->exec);
+    time_line("wait", r->wait);
+    time_line("run", r->run);
+}
+
+/**
+ * @brief Puts the arguments back together for the job table.
+ */
+static char *time_cmdline(struct arena *a, char **argv) {
+    size_t len = 1;
+    for (char **arg = argv; *arg != NULL; arg++) {
+        len += strlen(*arg) + 1;
+    }
+    char *line = arena_alloc(a, len);
+    char *p = line;
+    for (char **arg = argv; *arg != NULL; arg++) {
+        size_t n = strlen(*arg);
+        memcpy(p, *arg, n);
+        p += n;
+        *p++ = ' ';
+    }
+    p[p > line ? -1 : 0] = '\0';
+    return line;
+}
+
+/**
+ * @brief Times a builtin in the shell itself. With no process of its own
+ * its usage is the change in the shell's usage plus that of any children
+ * it reaped, and maxrss is the shell's.
+ *
+ * @return The builtin's status.
+ */
+static int time_builtin(struct shell *sh, char **argv, struct time_report *r) {
+    struct rusage self0, self1, kids0, kids1;
+
+    getrusage(RUSAGE_SELF, &self0);
+    getrusage(RUSAGE_CHILDREN, &kids0);
+    int64_t start = time_now_ns();
+    do_builtin(sh, argv);
+    r->run = time_now_ns() - start;
+    getrusage(RUSAGE_SELF, &self1);
+    getrusage(RUSAGE_CHILDREN, &kids1);
+
+    struct rusage *u = &r->usage;
+    timersub(&self1.ru_utime, &self0.ru_utime, &u->ru_utime);
+    timersub(&self1.ru_stime, &self0.ru_stime, &u->ru_stime);
+    timeradd(&u->ru_utime, &kids1.ru_utime, &u->ru_utime);
+    timersub(&u->ru_utime, &kids0.ru_utime, &u->ru_utime);
+    timeradd(&u->ru_stime, &kids1.ru_stime, &u->ru_stime);
+    timersub(&u->ru_stime, &kids0.ru_stime, &u->ru_stime);
+    u->ru_maxrss = self1.ru_maxrss;
+    u->ru_nvcsw = self1.ru_nvcsw - self0.ru_nvcsw + kids1.ru_nvcsw - kids0.ru_nvcsw;
+    u->ru_nivcsw = self1.ru_nivcsw - self0.ru_nivcsw + kids1.ru_nivcsw - kids0.ru_nivcsw;
+    r->real = r->run;
+    return sh->last_status;
+}
+
+/**
+ * @brief Times a pipeline of external commands.
+ *
+ * Every stage inherits the write end of a close-on-exec probe pipe, so
+ * reading it returns end of file once the last stage has exec'd its
+ * program. That splits the launch into the shell's side, fork, and the
+ * children's side, exec. With the posix_spawn engine the parent only
+ * resumes after the exec, so nearly all of it shows up as fork. The
+ * resource usage is what wait4 reported for each process.
+ *
+ * @return The status of the last stage, or of the launch failure.
+ */
+static int time_pipeline(struct shell *sh, char **argv, char ***stages, size_t nstages,
+                         struct time_report *r) {
+    pid_t *pids = arena_alloc(&sh->arena, nstages * sizeof(pid_t));
+    struct launch_opts opts = LAUNCH_OPTS_INIT;
+    int probe[2];
+    char byte;
+
+    if (pipe2(probe, O_CLOEXEC) != 0) {
+        perror("time");
+        return 1;
+    }
+    int64_t start = time_now_ns();
+    size_t launched = launch_pipeline(sh, stages, nstages, &opts, pids);
+    int error = launched < nstages ? launch_error(stages[launched]) : 0;
+    int64_t forked = time_now_ns();
+    close(probe[1]);
+    while (read(probe[0], &byte, 1) < 0 && errno == EINTR) {
+    }
+    close(probe[0]);
+    int64_t started = time_now_ns();
+    r->fork = forked - start;
+    r->exec = started - forked;
+    if (launched == 0) {
+        r->real = started - start;
+        return error;
+    }
+
+    struct job *job = job_add(&sh->jobs, pids[0], pids, launched, time_cmdline(&sh->arena, argv),
+                              false);
+    while (job->nlive > 0 && job->state != JOB_STOPPED && jobs_block(sh) == 0) {
+    }
+    int64_t done = time_now_ns();
+    r->usage = job->usage;
+    r->wait = done - started;
+    r->real = done - start;
+    int status = job_wait(sh, job);
+    return error ? error : status;
+}
+
+/**
+ * @brief Runs the rest of the line and reports how long it took.
+ *
+ * The shell hands time the whole line before splitting it into pipeline
+ * stages, so "time a | b" times the pipeline. A single builtin runs in the
+ * shell, everything else is launched as a foreground job. The report goes
+ * to stderr after the command's output, including anything the buffered
+ * builtins still hold. The parse time is the shell's for the whole line.
+ *
+ * @param sh A pointer to the shell structure.
+ * @param argv "time" followed by the command line.
+ * @return The status of the command, 2 on a usage or syntax error.
+ */
+int time_cmd(struct shell *sh, char **argv) {
+    struct time_report r;
+    size_t nstages;
+    int status;
+
+    if (argv[1] == NULL) {
+        fprintf(stderr, "usage: time command [args...] [| command...]\n");
+        return 2;
+    }
+    memset(&r, 0, sizeof(r));
+    r.parse = sh->parse_ns;
+    r.fork = r.exec = r.wait = r.run = -1;
+    char ***stages = pipeline_split(&sh->arena, argv + 1, &nstages);
+    if (stages == NULL) {
+        fprintf(stderr, "time: syntax error near unexpected token `|'\n");
+        return 2;
+    }
+    if (nstages == 1 && is_builtin(stages[0][0])) {
+        status = time_builtin(sh, stages[0], &r);
+    } else {
+        status = time_pipeline(sh, argv + 1, stages, nstages, &r);
+    }
+    sh_flush(sh);
+    fflush(stdout);
+    time_print(&r);
+    return status;
+}
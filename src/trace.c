@@ -0,0 +1,329 @@
+#define _GNU_SOURCE
+#include "lab.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+
+/* Events the ring holds before the producer has to drain it, a power of two. */
+#define TRACE_EVENTS 4096
+/* Bytes of a command name kept with an event, longer names are cut. */
+#define TRACE_NAME 96
+
+/**
+ * @brief One event as recorded, formatted only when it is flushed. ts is
+ * a time_now_ns reading, dur is the length of a span and status the exit
+ * status an end carries, -1 for none.
+ */
+struct trace_event {
+    int64_t ts;
+    int64_t dur;
+    int32_t tid;
+    int32_t status;
+    char ph;
+    unsigned char cat;
+    char name[TRACE_NAME];
+};
+
+/**
+ * @brief An open trace. Events go into a single producer, single consumer
+ * ring: the producer only writes the slot at head and then publishes head,
+ * the consumer only reads slots before head and then publishes tail. Neither
+ * side takes a lock or makes a system call, so recording costs a clock read
+ * and a copy, and a flush could run from another thread without stopping
+ * the shell. Today the shell is both sides and drains the ring itself when
+ * it fills up.
+ */
+struct trace {
+    _Atomic size_t head;
+    _Atomic size_t tail;
+    int64_t start;
+    int32_t pid;
+    bool first;
+    struct writer out;
+    struct trace_event events[TRACE_EVENTS];
+};
+
+/* Category names, in enum order. */
+static const char *const trace_cats[] = {"command", "process", "launch", "builtin"};
+
+/**
+ * @brief Opens a trace file and writes the start of the JSON array.
+ *
+ * @param path The file, truncated.
+ * @return The trace, or NULL with errno set.
+ */
+struct trace *trace_open(const char *path) {
+    struct trace *t = malloc(sizeof(*t));
+    if (t == NULL) {
+        return NULL;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        int err = errno;
+        free(t);
+        errno = err;
+        return NULL;
+    }
+    atomic_init(&t->head, 0);
+    atomic_init(&t->tail, 0);
+    t->start = time_now_ns();
+    t->pid = (int32_t)getpid();
+    t->first = true;
+    writer_init(&t->out, fd);
+    writer_str(&t->out, "[");
+    return t;
+}
+
+/**
+ * @brief Opens the trace a shell asked for, the path from -t or else the
+ * environment variable. The variable is removed either way: nested shells
+ * inherit the environment, and each one would truncate the same file and
+ * write over the others at its own offset.
+ *
+ * @param path The path given with -t, or NULL.
+ * @param env The environment variable naming the file otherwise.
+ * @return The trace, or NULL when there is none or it could not be opened,
+ * which is reported on stderr.
+ */
+struct trace *trace_start(const char *path, const char *env) {
+    const char *value = getenv(env);
+    char *copy = path == NULL && value != NULL ? strdup(value) : NULL;
+    unsetenv(env);
+    if (path == NULL) {
+        path = copy;
+    }
+    struct trace *t = NULL;
+    if (path != NULL && *path != '\0') {
+        t = trace_open(path);
+        if (t == NULL) {
+            perror(path);
+        }
+    }
+    free(copy);
+    return t;
+}
+
+/**
+ * @brief Copies a string into JSON, quotes and backslashes escaped with a
+ * backslash and control characters as \uXXXX escapes.
+ */
+static void trace_string(struct writer *w, const char *s) {
+    writer_copy(w, "\"", 1);
+    while (*s != '\0') {
+        size_t n = strcspn(s, "\"\\\b\f\n\r\t\x01\x02\x03\x04\x05\x06\x07\x0b\x0e\x0f\x10\x11"
+                              "\x12\x13\x14\x15\x16\x17\x18\x19\x1a\x1b\x1c\x1d\x1e\x1f");
+        writer_copy(w, s, n);
+        s += n;
+        if (*s == '"' || *s == '\\') {
+            char esc[2] = {'\\', *s++};
+            writer_copy(w, esc, 2);
+        } else if (*s != '\0') {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", (unsigned char)*s++);
+            writer_str(w, esc);
+        }
+    }
+    writer_copy(w, "\"", 1);
+}
+
+/**
+ * @brief Starts the next element of the JSON array.
+ */
+static void trace_next(struct trace *t) {
+    writer_str(&t->out, t->first ? "\n" : ",\n");
+    t->first = false;
+}
+
+/**
+ * @brief Formats one event in the Chrome trace event format, times in
+ * microseconds since the trace started. A process gets its own track,
+ * named after its command when it begins.
+ */
+static void trace_format(struct trace *t, const struct trace_event *e) {
+    struct writer *w = &t->out;
+    char buf[160];
+
+    if (e->ph == 'B' && e->tid != t->pid) {
+        trace_next(t);
+        snprintf(buf, sizeof(buf), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                 "\"args\":{\"name\":", t->pid, e->tid);
+        writer_str(w, buf);
+        trace_string(w, e->name);
+        writer_str(w, "}}");
+    }
+    trace_next(t);
+    writer_str(w, "{\"name\":");
+    trace_string(w, e->name);
+    snprintf(buf, sizeof(buf), ",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d",
+             trace_cats[e->cat], e->ph, (e->ts - t->start) / 1e3, t->pid, e->tid);
+    writer_str(w, buf);
+    if (e->ph == 'X') {
+        snprintf(buf, sizeof(buf), ",\"dur\":%.3f", e->dur / 1e3);
+        writer_str(w, buf);
+    }
+    if (e->status >= 0) {
+        snprintf(buf, sizeof(buf), ",\"args\":{\"status\":%d}", e->status);
+        writer_str(w, buf);
+    }
+    writer_str(w, "}");
+}
+
+/**
+ * @brief Writes out every event recorded so far. The file is valid JSON
+ * once trace_close has ended the array, and trace viewers also load it
+ * as it stands after a flush.
+ *
+ * @param t The trace, or NULL.
+ * @return The number of events written, -1 with errno set if writing
+ * failed.
+ */
+long trace_flush(struct trace *t) {
+    if (t == NULL) {
+        return 0;
+    }
+    size_t tail = atomic_load_explicit(&t->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&t->head, memory_order_acquire);
+    for (size_t i = tail; i != head; i++) {
+        trace_format(t, &t->events[i & (TRACE_EVENTS - 1)]);
+    }
+    atomic_store_explicit(&t->tail, head, memory_order_release);
+    if (writer_flush(&t->out) != 0) {
+        return -1;
+    }
+    return (long)(head - tail);
+}
+
+/**
+ * @brief Claims the next slot of the ring, draining it first if it is full.
+ */
+static struct trace_event *trace_slot(struct trace *t) {
+    size_t head = atomic_load_explicit(&t->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&t->tail, memory_order_acquire) == TRACE_EVENTS) {
+        trace_flush(t);
+    }
+    return &t->events[head & (TRACE_EVENTS - 1)];
+}
+
+/**
+ * @brief Publishes the slot trace_slot handed out.
+ */
+static void trace_publish(struct trace *t) {
+    atomic_fetch_add_explicit(&t->head, 1, memory_order_release);
+}
+
+/**
+ * @brief Records the start of a command line or a process.
+ *
+ * @param t The trace, or NULL to record nothing.
+ * @param cat What is starting.
+ * @param tid The track, the shell's pid for a command line and the
+ * process's own pid for a process.
+ * @param name The command, cut to fit.
+ */
+void trace_begin(struct trace *t, enum trace_cat cat, pid_t tid, const char *name) {
+    if (t == NULL) {
+        return;
+    }
+    struct trace_event *e = trace_slot(t);
+    e->ts = time_now_ns();
+    e->dur = 0;
+    e->tid = tid ? tid : t->pid;
+    e->status = -1;
+    e->ph = 'B';
+    e->cat = (unsigned char)cat;
+    snprintf(e->name, sizeof(e->name), "%s", name);
+    trace_publish(t);
+}
+
+/**
+ * @brief Records the end of what the last trace_begin on the same track
+ * started.
+ *
+ * @param t The trace, or NULL to record nothing.
+ * @param cat What is ending.
+ * @param tid The track, 0 for the shell's.
+ * @param status The exit status.
+ */
+void trace_end(struct trace *t, enum trace_cat cat, pid_t tid, int status) {
+    if (t == NULL) {
+        return;
+    }
+    struct trace_event *e = trace_slot(t);
+    e->ts = time_now_ns();
+    e->dur = 0;
+    e->tid = tid ? tid : t->pid;
+    e->status = status;
+    e->ph = 'E';
+    e->cat = (unsigned char)cat;
+    e->name[0] = '\0';
+    trace_publish(t);
+}
+
+/**
+ * @brief Records a span on the shell's track that has already finished,
+ * such as a launch or a builtin.
+ *
+ * @param t The trace, or NULL to record nothing.
+ * @param cat What the span was.
+ * @param name Its name, cut to fit.
+ * @param start When it started, a time_now_ns reading.
+ * @param end When it ended.
+ */
+void trace_span(struct trace *t, enum trace_cat cat, const char *name, int64_t start,
+                int64_t end) {
+    if (t == NULL) {
+        return;
+    }
+    struct trace_event *e = trace_slot(t);
+    e->ts = start;
+    e->dur = end - start;
+    e->tid = t->pid;
+    e->status = -1;
+    e->ph = 'X';
+    e->cat = (unsigned char)cat;
+    snprintf(e->name, sizeof(e->name), "%s", name);
+    trace_publish(t);
+}
+
+/**
+ * @brief Flushes what is left, ends the JSON array and closes the file.
+ *
+ * @param t The trace, or NULL.
+ */
+void trace_close(struct trace *t) {
+    if (t == NULL) {
+        return;
+    }
+    trace_flush(t);
+    writer_str(&t->out, "\n]\n");
+    writer_flush(&t->out);
+    close(t->out.fd);
+    free(t);
+}
+
+/**
+ * @brief Writes out the events recorded so far, so a running session can
+ * be loaded into a trace viewer.
+ *
+ * @param sh A pointer to the shell structure.
+ * @param argv The command and its arguments.
+ * @return 0 on success, 1 if the shell is not tracing or on a write error.
+ */
+int trace_cmd(struct shell *sh, char **argv) {
+    if (argv[1] != NULL) {
+        fprintf(stderr, "usage: trace\n");
+        return 2;
+    }
+    if (sh->trace == NULL) {
+        fprintf(stderr, "trace: not tracing, set MY_TRACE or start the shell with -t file\n");
+        return 1;
+    }
+    if (trace_flush(sh->trace) < 0) {
+        fprintf(stderr, "trace: %s\n", strerror(errno));
+        return 1;
+    }
+    return 0;
+}
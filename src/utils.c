@@ -0,0 +1,762 @@
+#define _GNU_SOURCE
+#include "lab.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* Formatted printf pieces shorter than this are built on the stack. */
+#define PRINTF_BUF 512
+
+/**
+ * @brief Decodes the backslash escape whose letter is at s: \a \b \e \f \n
+ * \r \t \v \\, \xHH and octal bytes, \0nnn for echo and \nnn for printf.
+ *
+ * @param s Just past the backslash.
+ * @param c Set to the byte.
+ * @param echo Whether to use echo's octal form.
+ * @return How many characters after the backslash were used, 0 if it is not
+ * an escape and the backslash stands for itself, -1 for \c.
+ */
+static int unescape(const char *s, char *c, bool echo) {
+    static const char from[] = "abefnrtv\\";
+    static const char to[] = "\a\b\033\f\n\r\t\v\\";
+    const char *hit = *s != '\0' ? strchr(from, *s) : NULL;
+    int value = 0;
+    int n;
+
+    if (hit != NULL) {
+        *c = to[hit - from];
+        return 1;
+    }
+    if (*s == 'c') {
+        return -1;
+    }
+    if (*s == 'x' && isxdigit((unsigned char)s[1])) {
+        for (n = 1; n < 3 && isxdigit((unsigned char)s[n]); n++) {
+            int digit = tolower((unsigned char)s[n]);
+            value = value * 16 + (isdigit(digit) ? digit - '0' : digit - 'a' + 10);
+        }
+        *c = (char)value;
+        return n;
+    }
+    if (echo ? *s == '0' : *s >= '0' && *s <= '7') {
+        int start = echo ? 1 : 0;
+        for (n = start; n < start + 3 && s[n] >= '0' && s[n] <= '7'; n++) {
+            value = value * 8 + s[n] - '0';
+        }
+        *c = (char)value;
+        return n;
+    }
+    *c = '\\';
+    return 0;
+}
+
+/**
+ * @brief Queues a string with its backslash escapes decoded.
+ *
+ * @param w The writer.
+ * @param s The string.
+ * @param echo Whether to use echo's octal escapes.
+ * @return false if a \c asked for all output to stop there.
+ */
+static bool put_escaped(struct writer *w, const char *s, bool echo) {
+    const char *bs;
+
+    while ((bs = strchr(s, '\\')) != NULL) {
+        char c;
+        int n = unescape(bs + 1, &c, echo);
+        writer_copy(w, s, (size_t)(bs - s));
+        if (n < 0) {
+            return false;
+        }
+        writer_copy(w, &c, 1);
+        s = bs + 1 + n;
+    }
+    writer_str(w, s);
+    return true;
+}
+
+/**
+ * @brief Writes the arguments separated by spaces. Leading arguments made
+ * only of the letters n, e and E are options: -n leaves out the newline,
+ * -e decodes backslash escapes and -E turns that off again.
+ *
+ * @param sh The shell, output goes to sh->out.
+ * @param argv The command and its arguments.
+ * @return 0 on success, 1 on a write error.
+ */
+int echo_cmd(struct shell *sh, char **argv) {
+    struct writer *w = sh->out;
+    bool newline = true;
+    bool escapes = false;
+    char **arg = argv + 1;
+
+    for (; *arg != NULL && (*arg)[0] == '-' && (*arg)[1] != '\0' &&
+           (*arg)[1 + strspn(*arg + 1, "neE")] == '\0';
+         arg++) {
+        for (const char *o = *arg + 1; *o != '\0'; o++) {
+            if (*o == 'n') {
+                newline = false;
+            } else {
+                escapes = *o == 'e';
+            }
+        }
+    }
+    for (; *arg != NULL; arg++) {
+        if (!escapes) {
+            writer_str(w, *arg);
+        } else if (!put_escaped(w, *arg, true)) {
+            return w->error != 0 ? 1 : 0;
+        }
+        if (arg[1] != NULL) {
+            writer_copy(w, " ", 1);
+        }
+    }
+    if (newline) {
+        writer_copy(w, "\n", 1);
+    }
+    return w->error != 0 ? 1 : 0;
+}
+
+/**
+ * @brief The arguments of printf still to be formatted.
+ */
+struct printf_args {
+    char **next;
+    int status;
+};
+
+/**
+ * @brief Takes the next argument.
+ * @return The argument, or NULL once they have all been used.
+ */
+static const char *printf_arg(struct printf_args *a) {
+    return *a->next != NULL ? *a->next++ : NULL;
+}
+
+/**
+ * @brief Checks the end of a number parsed from s, complaining if it was not
+ * all number.
+ */
+static void printf_check(struct printf_args *a, const char *s, const char *end) {
+    if (end == s || *end != '\0' || errno == ERANGE) {
+        fprintf(stderr, "printf: %s: invalid number\n", s);
+        a->status = 1;
+    }
+}
+
+/**
+ * @brief Takes the next argument as a signed integer. A leading quote gives
+ * the value of the character after it, a missing argument is 0.
+ */
+static long long printf_int(struct printf_args *a) {
+    const char *s = printf_arg(a);
+    char *end;
+
+    if (s == NULL) {
+        return 0;
+    }
+    if (*s == '\'' || *s == '"') {
+        return (unsigned char)s[1];
+    }
+    errno = 0;
+    long long value = strtoll(s, &end, 0);
+    printf_check(a, s, end);
+    return value;
+}
+
+/**
+ * @brief Takes the next argument as an unsigned integer.
+ */
+static unsigned long long printf_uint(struct printf_args *a) {
+    const char *s = printf_arg(a);
+    char *end;
+
+    if (s == NULL) {
+        return 0;
+    }
+    if (*s == '\'' || *s == '"') {
+        return (unsigned char)s[1];
+    }
+    errno = 0;
+    unsigned long long value = strtoull(s, &end, 0);
+    printf_check(a, s, end);
+    return value;
+}
+
+/**
+ * @brief Takes the next argument as a floating point number.
+ */
+static double printf_double(struct printf_args *a) {
+    const char *s = printf_arg(a);
+    char *end;
+
+    if (s == NULL) {
+        return 0;
+    }
+    errno = 0;
+    double value = strtod(s, &end);
+    printf_check(a, s, end);
+    return value;
+}
+
+/**
+ * @brief Formats with a single conversion and queues the result, on the
+ * stack when it is short.
+ *
+ * @param w The writer.
+ * @param spec The conversion, built from the format and checked.
+ */
+static void put_formatted(struct writer *w, const char *spec, ...) {
+    char buf[PRINTF_BUF];
+    va_list ap;
+
+    va_start(ap, spec);
+    int n = vsnprintf(buf, sizeof(buf), spec, ap);
+    va_end(ap);
+    if (n < 0) {
+        return;
+    }
+    if ((size_t)n < sizeof(buf)) {
+        writer_copy(w, buf, (size_t)n);
+        return;
+    }
+    char *big = malloc((size_t)n + 1);
+    if (big == NULL) {
+        return;
+    }
+    va_start(ap, spec);
+    vsnprintf(big, (size_t)n + 1, spec, ap);
+    va_end(ap);
+    writer_copy(w, big, (size_t)n);
+    free(big);
+}
+
+/**
+ * @brief Copies the next argument's value into a conversion for a * width
+ * or precision.
+ */
+static void spec_star(char *spec, size_t size, struct printf_args *a) {
+    size_t len = strlen(spec);
+    snprintf(spec + len, size - len, "%d", (int)printf_int(a));
+}
+
+/**
+ * @brief Goes through the format once, taking arguments as conversions
+ * need them.
+ *
+ * @param w The writer.
+ * @param f The format.
+ * @param a The arguments.
+ * @return false if output stopped early, at a \c or a bad conversion.
+ */
+static bool printf_format(struct writer *w, const char *f, struct printf_args *a) {
+    while (*f != '\0') {
+        if (*f == '\\') {
+            char c;
+            int n = unescape(f + 1, &c, false);
+            if (n < 0) {
+                return false;
+            }
+            writer_copy(w, &c, 1);
+            f += 1 + n;
+            continue;
+        }
+        if (*f != '%') {
+            size_t n = strcspn(f, "\\%");
+            writer_copy(w, f, n);
+            f += n;
+            continue;
+        }
+        if (f[1] == '%') {
+            writer_copy(w, "%", 1);
+            f += 2;
+            continue;
+        }
+
+        // Rebuild the conversion with * filled in and a length modifier
+        // for the types the arguments are converted to.
+        char spec[64] = "%";
+        const char *start = f++;
+        size_t flags = strspn(f, "-+ #0");
+        if (flags > 8) {
+            flags = 8;
+        }
+        strncat(spec, f, flags);
+        f += strspn(f, "-+ #0");
+        if (*f == '*') {
+            spec_star(spec, sizeof(spec), a);
+            f++;
+        } else {
+            size_t digits = strspn(f, "0123456789");
+            strncat(spec, f, digits < 9 ? digits : 9);
+            f += digits;
+        }
+        if (*f == '.') {
+            strcat(spec, ".");
+            f++;
+            if (*f == '*') {
+                spec_star(spec, sizeof(spec), a);
+                f++;
+            } else {
+                size_t digits = strspn(f, "0123456789");
+                strncat(spec, f, digits < 9 ? digits : 9);
+                f += digits;
+            }
+        }
+        char conv = *f;
+        if (conv != '\0') {
+            f++;
+        }
+        size_t len = strlen(spec);
+        switch (conv) {
+            case 's':
+            case 'b':
+            case 'c': {
+                const char *s = printf_arg(a);
+                char *decoded = NULL;
+                bool stop = false;
+                if (conv == 'c') {
+                    if (s == NULL || *s == '\0') {
+                        break;
+                    }
+                    spec[len] = 'c';
+                    put_formatted(w, spec, *s);
+                    break;
+                }
+                if (conv == 'b' && s != NULL) {
+                    // Decoding never makes a string longer.
+                    decoded = malloc(strlen(s) + 1);
+                    if (decoded != NULL) {
+                        char *d = decoded;
+                        const char *bs;
+                        while ((bs = strchr(s, '\\')) != NULL) {
+                            memcpy(d, s, (size_t)(bs - s));
+                            d += bs - s;
+                            int n = unescape(bs + 1, d, true);
+                            if (n < 0) {
+                                stop = true;
+                                break;
+                            }
+                            d++;
+                            s = bs + 1 + n;
+                        }
+                        if (!stop) {
+                            strcpy(d, s);
+                        } else {
+                            *d = '\0';
+                        }
+                        s = decoded;
+                    }
+                }
+                spec[len] = 's';
+                put_formatted(w, spec, s != NULL ? s : "");
+                free(decoded);
+                if (stop) {
+                    return false;
+                }
+                break;
+            }
+            case 'd':
+            case 'i':
+                snprintf(spec + len, sizeof(spec) - len, "ll%c", conv);
+                put_formatted(w, spec, printf_int(a));
+                break;
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+                snprintf(spec + len, sizeof(spec) - len, "ll%c", conv);
+                put_formatted(w, spec, printf_uint(a));
+                break;
+            case 'a':
+            case 'A':
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+                spec[len] = conv;
+                put_formatted(w, spec, printf_double(a));
+                break;
+            default:
+                fprintf(stderr, "printf: %.*s: invalid conversion\n", (int)(f - start), start);
+                a->status = 1;
+                return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Formats the arguments, going through the format again for as
+ * long as it uses up arguments and some are left.
+ *
+ * @param sh The shell, output goes to sh->out.
+ * @param argv The command, the format and the arguments.
+ * @return 0 on success, 1 if an argument was not a number, a conversion
+ * was bad or on a write error, 2 on a usage error.
+ */
+int printf_cmd(struct shell *sh, char **argv) {
+    struct writer *w = sh->out;
+    struct printf_args a = {argv + 2, 0};
+    char **before;
+
+    if (argv[1] == NULL) {
+        fprintf(stderr, "usage: printf format [arguments...]\n");
+        return 2;
+    }
+    do {
+        before = a.next;
+        if (!printf_format(w, argv[1], &a)) {
+            break;
+        }
+    } while (*a.next != NULL && a.next != before);
+    return w->error != 0 ? 1 : a.status;
+}
+
+/**
+ * @brief Writes the working directory. -L and -P are accepted, the shell
+ * does not track a logical directory so both print the physical one.
+ *
+ * @param sh The shell, output goes to sh->out.
+ * @param argv The command and its arguments.
+ * @return 0 on success, 1 if the directory is gone or on a write error, 2
+ * on a usage error.
+ */
+int pwd_cmd(struct shell *sh, char **argv) {
+    struct writer *w = sh->out;
+    char cwd[PATH_MAX];
+
+    for (char **arg = argv + 1; *arg != NULL; arg++) {
+        if (strcmp(*arg, "-L") != 0 && strcmp(*arg, "-P") != 0) {
+            fprintf(stderr, "usage: pwd [-L | -P]\n");
+            return 2;
+        }
+    }
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        fprintf(stderr, "pwd: %s\n", strerror(errno));
+        return 1;
+    }
+    writer_str(w, cwd);
+    writer_copy(w, "\n", 1);
+    return w->error != 0 ? 1 : 0;
+}
+
+/**
+ * @brief Does nothing, successfully.
+ * @return 0.
+ */
+int true_cmd(struct shell *sh, char **argv) {
+    UNUSED(sh);
+    UNUSED(argv);
+    return 0;
+}
+
+/**
+ * @brief Does nothing, unsuccessfully.
+ * @return 1.
+ */
+int false_cmd(struct shell *sh, char **argv) {
+    UNUSED(sh);
+    UNUSED(argv);
+    return 1;
+}
+
+/**
+ * @brief A test expression being evaluated, argv[pos] is the next token.
+ * Evaluation carries on after an error so the parser stays simple, only
+ * the first error is reported.
+ */
+struct test_parser {
+    char **argv;
+    int argc;
+    int pos;
+    bool error;
+};
+
+/**
+ * @brief Reports an error in the expression once.
+ */
+static void test_error(struct test_parser *t, const char *what, const char *token) {
+    if (!t->error) {
+        if (token != NULL) {
+            fprintf(stderr, "%s: %s: %s\n", t->argv[0], token, what);
+        } else {
+            fprintf(stderr, "%s: %s\n", t->argv[0], what);
+        }
+    }
+    t->error = true;
+}
+
+/**
+ * @brief Looks ahead in the expression.
+ * @return The token ahead tokens after the next one, or NULL past the end.
+ */
+static const char *test_peek(struct test_parser *t, int ahead) {
+    return t->pos + ahead < t->argc ? t->argv[t->pos + ahead] : NULL;
+}
+
+/**
+ * @brief Checks if a token is a binary operator.
+ */
+static bool test_binary_op(const char *s) {
+    static const char *const ops[] = {"=",   "==",  "!=",  "<",   ">",   "-eq", "-ne", "-lt",
+                                      "-le", "-gt", "-ge", "-nt", "-ot", "-ef", NULL};
+    for (const char *const *op = ops; *op != NULL; op++) {
+        if (strcmp(s, *op) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Checks if a token is a unary operator.
+ */
+static bool test_unary_op(const char *s) {
+    return s[0] == '-' && s[1] != '\0' && s[2] == '\0' && strchr("bcdefghLkprsStuwxOGnz", s[1]);
+}
+
+/**
+ * @brief Parses an integer operand, reporting anything else.
+ */
+static long long test_int(struct test_parser *t, const char *s) {
+    char *end;
+
+    errno = 0;
+    long long value = strtoll(s, &end, 10);
+    if (end == s || *end != '\0' || errno == ERANGE) {
+        test_error(t, "integer expression expected", s);
+    }
+    return value;
+}
+
+/**
+ * @brief Evaluates a unary operator.
+ */
+static bool test_unary(struct test_parser *t, char op, const char *arg) {
+    struct stat st;
+
+    switch (op) {
+        case 'n':
+            return *arg != '\0';
+        case 'z':
+            return *arg == '\0';
+        case 't':
+            return isatty((int)test_int(t, arg));
+        case 'r':
+            return access(arg, R_OK) == 0;
+        case 'w':
+            return access(arg, W_OK) == 0;
+        case 'x':
+            return access(arg, X_OK) == 0;
+        case 'h':
+        case 'L':
+            return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    }
+    if (stat(arg, &st) != 0) {
+        return false;
+    }
+    switch (op) {
+        case 'b':
+            return S_ISBLK(st.st_mode);
+        case 'c':
+            return S_ISCHR(st.st_mode);
+        case 'd':
+            return S_ISDIR(st.st_mode);
+        case 'f':
+            return S_ISREG(st.st_mode);
+        case 'p':
+            return S_ISFIFO(st.st_mode);
+        case 'S':
+            return S_ISSOCK(st.st_mode);
+        case 'g':
+            return (st.st_mode & S_ISGID) != 0;
+        case 'u':
+            return (st.st_mode & S_ISUID) != 0;
+        case 'k':
+            return (st.st_mode & S_ISVTX) != 0;
+        case 's':
+            return st.st_size > 0;
+        case 'O':
+            return st.st_uid == geteuid();
+        case 'G':
+            return st.st_gid == getegid();
+        default: // -e
+            return true;
+    }
+}
+
+/**
+ * @brief Evaluates a binary operator.
+ */
+static bool test_binary(struct test_parser *t, const char *a, const char *op, const char *b) {
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) {
+        return strcmp(a, b) == 0;
+    }
+    if (strcmp(op, "!=") == 0) {
+        return strcmp(a, b) != 0;
+    }
+    if (strcmp(op, "<") == 0) {
+        return strcmp(a, b) < 0;
+    }
+    if (strcmp(op, ">") == 0) {
+        return strcmp(a, b) > 0;
+    }
+    if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0) {
+        struct stat sa, sb;
+        bool has_a = stat(a, &sa) == 0;
+        bool has_b = stat(b, &sb) == 0;
+        if (op[1] == 'e') {
+            return has_a && has_b && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+        }
+        if (op[1] == 'o') {
+            struct stat swap = sa;
+            sa = sb;
+            sb = swap;
+            bool has = has_a;
+            has_a = has_b;
+            has_b = has;
+        }
+        // a is newer than b: it exists and b does not, or its mtime is later.
+        return has_a && (!has_b || sa.st_mtim.tv_sec > sb.st_mtim.tv_sec ||
+                         (sa.st_mtim.tv_sec == sb.st_mtim.tv_sec &&
+                          sa.st_mtim.tv_nsec > sb.st_mtim.tv_nsec));
+    }
+    long long x = test_int(t, a);
+    long long y = test_int(t, b);
+    switch (op[1] << 8 | op[2]) {
+        case 'e' << 8 | 'q':
+            return x == y;
+        case 'n' << 8 | 'e':
+            return x != y;
+        case 'l' << 8 | 't':
+            return x < y;
+        case 'l' << 8 | 'e':
+            return x <= y;
+        case 'g' << 8 | 't':
+            return x > y;
+        default: // -ge
+            return x >= y;
+    }
+}
+
+static bool test_or(struct test_parser *t);
+
+/**
+ * @brief primary: ( expr ) | string binop string | unop string | string
+ *
+ * A binary operator wins over everything else when there is room for
+ * it, as POSIX has it for three arguments, so "( = (" compares strings.
+ */
+static bool test_primary(struct test_parser *t) {
+    const char *a = test_peek(t, 0);
+    const char *op = test_peek(t, 1);
+
+    if (a == NULL) {
+        test_error(t, "argument expected", NULL);
+        return false;
+    }
+    if (op != NULL && test_binary_op(op) && test_peek(t, 2) != NULL) {
+        t->pos += 3;
+        return test_binary(t, a, op, t->argv[t->pos - 1]);
+    }
+    if (strcmp(a, "(") == 0 && op != NULL) {
+        t->pos++;
+        bool value = test_or(t);
+        const char *close = test_peek(t, 0);
+        if (close == NULL || strcmp(close, ")") != 0) {
+            test_error(t, "')' expected", NULL);
+        } else {
+            t->pos++;
+        }
+        return value;
+    }
+    if (test_unary_op(a) && op != NULL) {
+        t->pos += 2;
+        return test_unary(t, a[1], op);
+    }
+    t->pos++;
+    return *a != '\0';
+}
+
+/**
+ * @brief not: ! not | primary. A lone "!" is just a string.
+ */
+static bool test_not(struct test_parser *t) {
+    const char *a = test_peek(t, 0);
+    if (a != NULL && strcmp(a, "!") == 0 && test_peek(t, 1) != NULL) {
+        t->pos++;
+        return !test_not(t);
+    }
+    return test_primary(t);
+}
+
+/**
+ * @brief and: not [-a not]...
+ */
+static bool test_and(struct test_parser *t) {
+    bool value = test_not(t);
+    const char *a;
+    while (!t->error && (a = test_peek(t, 0)) != NULL && strcmp(a, "-a") == 0) {
+        t->pos++;
+        bool right = test_not(t);
+        value = value && right;
+    }
+    return value;
+}
+
+/**
+ * @brief expr: and [-o and]...
+ */
+static bool test_or(struct test_parser *t) {
+    bool value = test_and(t);
+    const char *a;
+    while (!t->error && (a = test_peek(t, 0)) != NULL && strcmp(a, "-o") == 0) {
+        t->pos++;
+        bool right = test_and(t);
+        value = value || right;
+    }
+    return value;
+}
+
+/**
+ * @brief Evaluates a test expression. As [ the last argument must be "]".
+ * No expression is false, a single argument is true if it is not empty.
+ *
+ * @param sh The shell.
+ * @param argv The command and the expression.
+ * @return 0 if the expression is true, 1 if it is false, 2 on an error.
+ */
+int test_cmd(struct shell *sh, char **argv) {
+    int argc = 0;
+
+    UNUSED(sh);
+    while (argv[argc] != NULL) {
+        argc++;
+    }
+    if (strcmp(argv[0], "[") == 0) {
+        if (strcmp(argv[argc - 1], "]") != 0) {
+            fprintf(stderr, "[: missing ]\n");
+            return 2;
+        }
+        argc--;
+    }
+    if (argc == 1) {
+        return 1;
+    }
+    struct test_parser t = {argv, argc, 1, false};
+    bool value = test_or(&t);
+    if (!t.error && t.pos < argc) {
+        test_error(&t, "unexpected argument", argv[t.pos]);
+    }
+    return t.error ? 2 : !value;
+}
@@ -0,0 +1,157 @@
+#include "lab.h"
+#include <string.h>
+#include <errno.h>
+
+/* Pieces shorter than this are copied, a queue entry costs more. */
+#define WRITER_COPY_MAX 256
+
+/**
+ * @brief Starts buffered output to a descriptor.
+ *
+ * @param w The writer.
+ * @param fd The descriptor, left open.
+ */
+void writer_init(struct writer *w, int fd) {
+    w->fd = fd;
+    w->niov = 0;
+    w->error = 0;
+    w->used = 0;
+}
+
+/**
+ * @brief Writes everything queued.
+ *
+ * One writev hands the kernel up to WRITER_IOV pieces, so a full queue
+ * usually costs a single system call. Short writes, which pipes produce
+ * when the reader is slow, pick up where the kernel stopped. The first
+ * error sticks and later output is dropped.
+ *
+ * @param w The writer.
+ * @return 0 on success, -1 with errno set if a write failed.
+ */
+int writer_flush(struct writer *w) {
+    struct iovec *iov = w->iov;
+    int niov = w->niov;
+
+    while (niov > 0 && w->error == 0) {
+        ssize_t n = writev(w->fd, iov, niov);
+        if (n < 0) {
+            if (errno != EINTR) {
+                w->error = errno;
+            }
+            continue;
+        }
+        while (niov > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            niov--;
+        }
+        if (niov > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    w->niov = 0;
+    w->used = 0;
+    if (w->error != 0) {
+        errno = w->error;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Copies bytes into the buffer. Bytes copied right after the last
+ * copy extend its queue entry, so a run of short pieces costs one entry.
+ *
+ * @param w The writer.
+ * @param p The bytes, free to reuse once this returns.
+ * @param n How many.
+ * @return 0 on success, -1 once any write has failed.
+ */
+int writer_copy(struct writer *w, const void *p, size_t n) {
+    const char *s = p;
+
+    while (n > 0 && w->error == 0) {
+        if (w->used == WRITER_BUF) {
+            writer_flush(w);
+            continue;
+        }
+        char *end = w->buf + w->used;
+        struct iovec *last = w->niov > 0 ? &w->iov[w->niov - 1] : NULL;
+        if (last == NULL || (char *)last->iov_base + last->iov_len != end) {
+            if (w->niov == WRITER_IOV) {
+                writer_flush(w);
+                continue;
+            }
+            last = &w->iov[w->niov++];
+            last->iov_base = end;
+            last->iov_len = 0;
+        }
+        size_t chunk = n < WRITER_BUF - w->used ? n : WRITER_BUF - w->used;
+        memcpy(end, s, chunk);
+        last->iov_len += chunk;
+        w->used += chunk;
+        s += chunk;
+        n -= chunk;
+    }
+    return w->error != 0 ? -1 : 0;
+}
+
+/**
+ * @brief Queues bytes for output. Long pieces are not copied, the queue
+ * points at them, so they must stay put until the next flush.
+ *
+ * @param w The writer.
+ * @param p The bytes.
+ * @param n How many.
+ * @return 0 on success, -1 once any write has failed.
+ */
+int writer_put(struct writer *w, const void *p, size_t n) {
+    if (n < WRITER_COPY_MAX) {
+        return writer_copy(w, p, n);
+    }
+    if (w->niov == WRITER_IOV) {
+        writer_flush(w);
+    }
+    if (w->error == 0) {
+        w->iov[w->niov].iov_base = (void *)p;
+        w->iov[w->niov].iov_len = n;
+        w->niov++;
+    }
+    return w->error != 0 ? -1 : 0;
+}
+
+/**
+ * @brief Copies a string into the buffer.
+ *
+ * @param w The writer.
+ * @param s The string.
+ * @return 0 on success, -1 once any write has failed.
+ */
+int writer_str(struct writer *w, const char *s) {
+    return writer_copy(w, s, strlen(s));
+}
+
+/**
+ * @brief Copies a number in decimal, padded on the left with spaces to
+ * width columns.
+ *
+ * @param w The writer.
+ * @param value The number.
+ * @param width The minimum width, at most 20.
+ * @return 0 on success, -1 once any write has failed.
+ */
+int writer_num(struct writer *w, size_t value, int width) {
+    char digits[24];
+    char *p = digits + sizeof(digits);
+
+    do {
+        *--p = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (p > digits + sizeof(digits) - width && p > digits) {
+        *--p = ' ';
+    }
+    return writer_copy(w, p, (size_t)(digits + sizeof(digits) - p));
+}
@@ -1,4 +1,9 @@
+#include <stdio.h>
+#include <stdint.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include "harness/unity.h"
 #include "../src/lab.h"
 
@@ -49,6 +54,49 @@ void test_cmd_parse(void)
      cmd_free(rval);
 }
 
+void test_cmd_parse_delimiters(void)
+{
+     char **rval = cmd_parse("\t ls \r\n  -a\a-l   ");
+     TEST_ASSERT_EQUAL_STRING("ls", rval[0]);
+     TEST_ASSERT_EQUAL_STRING("-a", rval[1]);
+     TEST_ASSERT_EQUAL_STRING("-l", rval[2]);
+     TEST_ASSERT_NULL(rval[3]);
+     // Every token lives in the same block right after the pointer array
+     TEST_ASSERT_TRUE(rval[0] >= (char *)(rval + 4));
+     TEST_ASSERT_TRUE(rval[2] > rval[1] && rval[1] > rval[0]);
+     cmd_free(rval);
+}
+
+void test_cmd_parse_empty(void)
+{
+     char **rval = cmd_parse("   ");
+     TEST_ASSERT_NOT_NULL(rval);
+     TEST_ASSERT_NULL(rval[0]);
+     cmd_free(rval);
+     rval = cmd_parse("");
+     TEST_ASSERT_NULL(rval[0]);
+     cmd_free(rval);
+}
+
+void test_cmd_parse_many(void)
+{
+     size_t n = 10000;
+     char *line = malloc(n * 8);
+     size_t len = 0;
+     for (size_t i = 0; i < n; i++) {
+          len += sprintf(line + len, "f%zu ", i);
+     }
+     char **rval = cmd_parse(line);
+     for (size_t i = 0; i < n; i++) {
+          char expected[16];
+          sprintf(expected, "f%zu", i);
+          TEST_ASSERT_EQUAL_STRING(expected, rval[i]);
+     }
+     TEST_ASSERT_NULL(rval[n]);
+     cmd_free(rval);
+     free(line);
+}
+
 void test_trim_white_no_whitespace(void)
 {
      char *line = (char*) calloc(10, sizeof(char));
@@ -159,10 +207,1403 @@ void test_ch_dir_root(void)
      cmd_free(cmd);
 }
 
+void test_launch_cmd_spawn(void)
+{
+     struct shell sh = {0};
+     sh.launch = LAUNCH_SPAWN;
+     char **cmd = cmd_parse("false");
+     pid_t pid = launch_cmd(&sh, cmd);
+     TEST_ASSERT_TRUE(pid > 0);
+     int status;
+     TEST_ASSERT_EQUAL_INT(pid, waitpid(pid, &status, 0));
+     TEST_ASSERT_TRUE(WIFEXITED(status));
+     TEST_ASSERT_EQUAL_INT(1, WEXITSTATUS(status));
+     cmd_free(cmd);
+     path_cache_destroy(&sh.paths);
+}
+
+void test_launch_cmd_fork(void)
+{
+     struct shell sh = {0};
+     sh.launch = LAUNCH_FORK;
+     char **cmd = cmd_parse("true");
+     pid_t pid = launch_cmd(&sh, cmd);
+     TEST_ASSERT_TRUE(pid > 0);
+     int status;
+     TEST_ASSERT_EQUAL_INT(pid, waitpid(pid, &status, 0));
+     TEST_ASSERT_TRUE(WIFEXITED(status));
+     TEST_ASSERT_EQUAL_INT(0, WEXITSTATUS(status));
+     cmd_free(cmd);
+     path_cache_destroy(&sh.paths);
+}
+
+void test_launch_cmd_not_found(void)
+{
+     struct shell sh = {0};
+     sh.launch = LAUNCH_SPAWN;
+     char **cmd = cmd_parse("no-such-command-here");
+     TEST_ASSERT_EQUAL_INT(-1, launch_cmd(&sh, cmd));
+     cmd_free(cmd);
+     path_cache_destroy(&sh.paths);
+}
+
+void test_get_launch_engine(void)
+{
+     unsetenv("MY_LAUNCH");
+     TEST_ASSERT_EQUAL_INT(LAUNCH_SPAWN, get_launch_engine("MY_LAUNCH"));
+     setenv("MY_LAUNCH", "fork", true);
+     TEST_ASSERT_EQUAL_INT(LAUNCH_FORK, get_launch_engine("MY_LAUNCH"));
+     unsetenv("MY_LAUNCH");
+}
+
+void test_path_lookup_caches(void)
+{
+     struct path_cache pc;
+     path_cache_init(&pc);
+     const char *first = path_lookup(&pc, "sh");
+     TEST_ASSERT_NOT_NULL(first);
+     TEST_ASSERT_EQUAL_UINT(1, pc.misses);
+     const char *second = path_lookup(&pc, "sh");
+     TEST_ASSERT_EQUAL_STRING(first, second);
+     TEST_ASSERT_EQUAL_UINT(1, pc.misses);
+     TEST_ASSERT_EQUAL_UINT(1, pc.hits);
+     TEST_ASSERT_EQUAL_STRING("/bin/ls", path_lookup(&pc, "/bin/ls"));
+     path_cache_destroy(&pc);
+}
+
+void test_path_lookup_path_change(void)
+{
+     struct path_cache pc;
+     path_cache_init(&pc);
+     char *saved = strdup(getenv("PATH"));
+     TEST_ASSERT_EQUAL_INT(0, path_cache_add(&pc, "foo", "/bin/true"));
+     TEST_ASSERT_EQUAL_STRING("/bin/true", path_lookup(&pc, "foo"));
+     setenv("PATH", "/nonexistent", true);
+     TEST_ASSERT_NULL(path_lookup(&pc, "foo"));
+     TEST_ASSERT_EQUAL_UINT(1, pc.count);
+     TEST_ASSERT_EQUAL_UINT(1, pc.negatives);
+     setenv("PATH", saved, true);
+     free(saved);
+     path_cache_destroy(&pc);
+}
+
+void test_path_cache_remove(void)
+{
+     struct path_cache pc;
+     path_cache_init(&pc);
+     char name[16];
+     for (int i = 0; i < 200; i++) {
+          snprintf(name, sizeof(name), "cmd%d", i);
+          TEST_ASSERT_EQUAL_INT(0, path_cache_add(&pc, name, name));
+     }
+     for (int i = 0; i < 200; i += 2) {
+          snprintf(name, sizeof(name), "cmd%d", i);
+          TEST_ASSERT_EQUAL_INT(0, path_cache_remove(&pc, name));
+     }
+     TEST_ASSERT_EQUAL_UINT(100, pc.count);
+     for (int i = 1; i < 200; i += 2) {
+          snprintf(name, sizeof(name), "cmd%d", i);
+          TEST_ASSERT_EQUAL_STRING(name, path_lookup(&pc, name));
+     }
+     TEST_ASSERT_EQUAL_INT(-1, path_cache_remove(&pc, "cmd0"));
+     path_cache_destroy(&pc);
+}
+
+void test_path_lookup_negative_cache(void)
+{
+     struct path_cache pc;
+     path_cache_init(&pc);
+     char dir[] = "/tmp/test-lab-XXXXXX";
+     TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+     char *saved = strdup(getenv("PATH"));
+     setenv("PATH", dir, true);
+
+     TEST_ASSERT_NULL(path_lookup(&pc, "probe"));
+     TEST_ASSERT_NULL(path_lookup(&pc, "probe"));
+     TEST_ASSERT_EQUAL_UINT(1, pc.misses);
+     TEST_ASSERT_EQUAL_UINT(1, pc.neg_hits);
+
+     // Installing the command changes the directory mtime
+     char file[64];
+     snprintf(file, sizeof(file), "%s/probe", dir);
+     FILE *fp = fopen(file, "w");
+     TEST_ASSERT_NOT_NULL(fp);
+     fclose(fp);
+     chmod(file, 0755);
+     struct timespec times[2] = {{0, UTIME_OMIT}, {1, 0}};
+     utimensat(AT_FDCWD, dir, times, 0);
+     TEST_ASSERT_EQUAL_STRING(file, path_lookup(&pc, "probe"));
+     TEST_ASSERT_EQUAL_UINT(0, pc.negatives);
+
+     unlink(file);
+     rmdir(dir);
+     setenv("PATH", saved, true);
+     free(saved);
+     path_cache_destroy(&pc);
+}
+
+void test_arena_alloc_aligned(void)
+{
+     struct arena a;
+     arena_init(&a, 0);
+     char *c = arena_alloc(&a, 1);
+     long *l = arena_alloc(&a, sizeof(long));
+     TEST_ASSERT_NOT_NULL(c);
+     TEST_ASSERT_EQUAL_UINT(0, (uintptr_t)l % sizeof(long));
+     TEST_ASSERT_TRUE((char *)l > c);
+     TEST_ASSERT_EQUAL_STRING("hello", arena_strdup(&a, "hello"));
+     TEST_ASSERT_EQUAL_UINT(1, a.mallocs);
+     TEST_ASSERT_EQUAL_UINT(3, a.allocs);
+     arena_destroy(&a);
+}
+
+void test_arena_reset_merges_chunks(void)
+{
+     struct arena a;
+     arena_init(&a, 0);
+     for (int i = 0; i < 100; i++) {
+          memset(arena_alloc(&a, 1000), 'x', 1000);
+     }
+     TEST_ASSERT_TRUE(a.mallocs > 1);
+     arena_reset(&a);
+     unsigned long mallocs = a.mallocs;
+     for (int round = 0; round < 10; round++) {
+          for (int i = 0; i < 100; i++) {
+               memset(arena_alloc(&a, 1000), 'x', 1000);
+          }
+          arena_reset(&a);
+     }
+     TEST_ASSERT_EQUAL_UINT(mallocs, a.mallocs);
+     arena_destroy(&a);
+}
+
+void test_arena_steady_state_no_malloc(void)
+{
+     struct arena a;
+     arena_init(&a, 0);
+     char raw[] = "   ls -a -l /tmp   ";
+     char **cmd = cmd_parse_arena(&a, trim_white_arena(&a, raw));
+     TEST_ASSERT_EQUAL_STRING("ls", cmd[0]);
+     TEST_ASSERT_EQUAL_STRING("/tmp", cmd[3]);
+     TEST_ASSERT_NULL(cmd[4]);
+     arena_reset(&a);
+     unsigned long mallocs = a.mallocs;
+     for (int i = 0; i < 1000; i++) {
+          char line[] = "  echo hello world  ";
+          cmd = cmd_parse_arena(&a, trim_white_arena(&a, line));
+          TEST_ASSERT_EQUAL_STRING("world", cmd[2]);
+          arena_reset(&a);
+     }
+     TEST_ASSERT_EQUAL_UINT(mallocs, a.mallocs);
+     TEST_ASSERT_EQUAL_UINT(2002, a.allocs);
+     arena_destroy(&a);
+}
+
+void test_trim_white_arena_all_whitespace(void)
+{
+     struct arena a;
+     arena_init(&a, 0);
+     char line[] = " \t  ";
+     TEST_ASSERT_EQUAL_STRING("", trim_white_arena(&a, line));
+     TEST_ASSERT_NULL(trim_white_arena(&a, NULL));
+     arena_destroy(&a);
+}
+
+static const enum scan_kernel all_kernels[] = {SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2};
+
+void test_scan_kernels_agree(void)
+{
+     // Random mix of token bytes and every kind of whitespace, long enough
+     // to cover full blocks and a partial tail.
+     const char alphabet[] = "ab \t\r\n\a\v\f-";
+     char line[1000];
+     srand(42);
+     for (size_t len = 0; len < sizeof(line); len += 37) {
+          for (size_t i = 0; i < len; i++) {
+               line[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+          }
+          line[len] = '\0';
+          TEST_ASSERT_EQUAL_INT(0, scan_set_kernel(SCAN_SCALAR));
+          size_t count = scan_count_tokens(line, len);
+          size_t skip = scan_skip(line, len, SCAN_SPACE);
+          size_t rskip = scan_rskip(line, len, SCAN_SPACE);
+          for (size_t k = 1; k < sizeof(all_kernels) / sizeof(all_kernels[0]); k++) {
+               if (scan_set_kernel(all_kernels[k]) != 0) {
+                    continue;
+               }
+               TEST_ASSERT_EQUAL_UINT(count, scan_count_tokens(line, len));
+               TEST_ASSERT_EQUAL_UINT(skip, scan_skip(line, len, SCAN_SPACE));
+               TEST_ASSERT_EQUAL_UINT(rskip, scan_rskip(line, len, SCAN_SPACE));
+          }
+     }
+     scan_set_kernel(scan_best_kernel());
+}
+
+void test_scan_split(void)
+{
+     char line[200];
+     // Tokens straddle the 64 byte block boundary
+     memset(line, 'x', 70);
+     strcpy(line + 70, "  yy\tz ");
+     char *tokens[4];
+     for (size_t k = 0; k < sizeof(all_kernels) / sizeof(all_kernels[0]); k++) {
+          if (scan_set_kernel(all_kernels[k]) != 0) {
+               continue;
+          }
+          char copy[200];
+          strcpy(copy, line);
+          TEST_ASSERT_EQUAL_UINT(3, scan_count_tokens(copy, strlen(copy)));
+          TEST_ASSERT_EQUAL_UINT(3, scan_split(copy, strlen(copy), tokens));
+          TEST_ASSERT_EQUAL_UINT(70, strlen(tokens[0]));
+          TEST_ASSERT_EQUAL_STRING("yy", tokens[1]);
+          TEST_ASSERT_EQUAL_STRING("z", tokens[2]);
+     }
+     scan_set_kernel(scan_best_kernel());
+}
+
+void test_trim_white_long_line(void)
+{
+     char *line = malloc(300);
+     memset(line, ' ', 299);
+     line[299] = '\0';
+     line[100] = 'a';
+     line[200] = 'b';
+     char *rval = trim_white(line);
+     TEST_ASSERT_EQUAL_UINT(101, strlen(rval));
+     TEST_ASSERT_EQUAL_CHAR('a', rval[0]);
+     TEST_ASSERT_EQUAL_CHAR('b', rval[100]);
+     free(rval);
+     free(line);
+}
+
+void test_reader_string(void)
+{
+     struct line_reader r;
+     TEST_ASSERT_EQUAL_INT(0, reader_open_string(&r, "echo a\n\nls -l"));
+     TEST_ASSERT_EQUAL_STRING("echo a", reader_next(&r));
+     TEST_ASSERT_FALSE(reader_at_end(&r));
+     TEST_ASSERT_EQUAL_STRING("", reader_next(&r));
+     TEST_ASSERT_EQUAL_STRING("ls -l", reader_next(&r));
+     TEST_ASSERT_TRUE(reader_at_end(&r));
+     TEST_ASSERT_NULL(reader_next(&r));
+     reader_close(&r);
+}
+
+void test_reader_file_mapped(void)
+{
+     char path[] = "/tmp/test-lab-XXXXXX";
+     int fd = mkstemp(path);
+     TEST_ASSERT_TRUE(fd >= 0);
+     // Fill exactly one page so the last line has no spare byte after it
+     long page = sysconf(_SC_PAGESIZE);
+     char *data = malloc(page);
+     memset(data, 'a', page);
+     data[9] = '\n';
+     TEST_ASSERT_EQUAL_INT(page, write(fd, data, page));
+     close(fd);
+
+     struct line_reader r;
+     TEST_ASSERT_EQUAL_INT(0, reader_open_file(&r, path));
+     TEST_ASSERT_TRUE(r.mapped);
+     TEST_ASSERT_EQUAL_UINT(9, strlen(reader_next(&r)));
+     TEST_ASSERT_EQUAL_UINT(page - 10, strlen(reader_next(&r)));
+     TEST_ASSERT_NULL(reader_next(&r));
+     reader_close(&r);
+     unlink(path);
+     free(data);
+}
+
+void test_reader_pipe_long_line(void)
+{
+     int fds[2];
+     TEST_ASSERT_EQUAL_INT(0, pipe(fds));
+     pid_t pid = fork();
+     if (pid == 0) {
+          close(fds[0]);
+          char buf[4096];
+          memset(buf, 'x', sizeof(buf));
+          for (int i = 0; i < 64; i++) {
+               write(fds[1], buf, sizeof(buf));
+          }
+          write(fds[1], "\nshort\nlast", 12);
+          _exit(0);
+     }
+     close(fds[1]);
+     struct line_reader r;
+     TEST_ASSERT_EQUAL_INT(0, reader_open_fd(&r, fds[0]));
+     TEST_ASSERT_FALSE(r.mapped);
+     TEST_ASSERT_EQUAL_UINT(64 * 4096, strlen(reader_next(&r)));
+     TEST_ASSERT_EQUAL_STRING("short", reader_next(&r));
+     TEST_ASSERT_EQUAL_STRING("last", reader_next(&r));
+     TEST_ASSERT_NULL(reader_next(&r));
+     reader_close(&r);
+     close(fds[0]);
+     waitpid(pid, NULL, 0);
+}
+
+void test_reader_shared_fd(void)
+{
+     // A file on stdin: commands read on from where the current line ends
+     char path[] = "/tmp/test-lab-XXXXXX";
+     int fd = mkstemp(path);
+     unlink(path);
+     const char *script = "head -n1\nfoo\necho after\n";
+     TEST_ASSERT_EQUAL_INT(strlen(script), write(fd, script, strlen(script)));
+     lseek(fd, 0, SEEK_SET);
+     struct line_reader r;
+     TEST_ASSERT_EQUAL_INT(0, reader_open_fd(&r, fd));
+     TEST_ASSERT_TRUE(r.mapped);
+     TEST_ASSERT_EQUAL_STRING("head -n1", reader_next(&r));
+     char buf[16] = {0};
+     TEST_ASSERT_EQUAL_INT(4, read(fd, buf, 4));
+     TEST_ASSERT_EQUAL_STRING("foo\n", buf);
+     TEST_ASSERT_EQUAL_STRING("echo after", reader_next(&r));
+     TEST_ASSERT_NULL(reader_next(&r));
+     reader_close(&r);
+     close(fd);
+
+     // A pipe is never read past the end of the current line
+     int fds[2];
+     TEST_ASSERT_EQUAL_INT(0, pipe(fds));
+     TEST_ASSERT_EQUAL_INT(strlen(script), write(fds[1], script, strlen(script)));
+     close(fds[1]);
+     TEST_ASSERT_EQUAL_INT(0, reader_open_fd(&r, fds[0]));
+     TEST_ASSERT_EQUAL_STRING("head -n1", reader_next(&r));
+     memset(buf, 0, sizeof(buf));
+     TEST_ASSERT_EQUAL_INT(4, read(fds[0], buf, 4));
+     TEST_ASSERT_EQUAL_STRING("foo\n", buf);
+     TEST_ASSERT_EQUAL_STRING("echo after", reader_next(&r));
+     TEST_ASSERT_NULL(reader_next(&r));
+     reader_close(&r);
+     close(fds[0]);
+}
+
+void test_exec_cmd_replaces_process(void)
+{
+     pid_t pid = fork();
+     if (pid == 0) {
+          struct shell sh = {0};
+          char **cmd = cmd_parse("false");
+          exec_cmd(&sh, cmd);
+          _exit(99);
+     }
+     int status;
+     TEST_ASSERT_EQUAL_INT(pid, waitpid(pid, &status, 0));
+     TEST_ASSERT_EQUAL_INT(1, WEXITSTATUS(status));
+}
+
+void test_exec_cmd_not_found(void)
+{
+     struct shell sh = {0};
+     char **cmd = cmd_parse("no-such-command-here");
+     TEST_ASSERT_EQUAL_INT(-1, exec_cmd(&sh, cmd));
+     cmd_free(cmd);
+     path_cache_destroy(&sh.paths);
+}
+
+void test_launch_not_found_flushes(void)
+{
+     // Buffered builtin output goes out before the command not found error
+     char path[] = "/tmp/test-lab-XXXXXX";
+     int fd = mkstemp(path);
+     unlink(path);
+     struct shell sh = {0};
+     sh.out = malloc(sizeof(*sh.out));
+     writer_init(sh.out, fd);
+     writer_str(sh.out, "queued\n");
+     char **cmd = cmd_parse("no-such-command-here");
+     TEST_ASSERT_EQUAL_INT(-1, launch_cmd(&sh, cmd));
+     char buf[16] = {0};
+     TEST_ASSERT_EQUAL_INT(7, pread(fd, buf, sizeof(buf) - 1, 0));
+     TEST_ASSERT_EQUAL_STRING("queued\n", buf);
+     cmd_free(cmd);
+     free(sh.out);
+     close(fd);
+     path_cache_destroy(&sh.paths);
+}
+
+void test_pipeline_split(void)
+{
+     struct arena a = {0};
+     char **cmd = cmd_parse("ls -l | grep x | wc");
+     size_t n = 0;
+     char ***stages = pipeline_split(&a, cmd, &n);
+     TEST_ASSERT_NOT_NULL(stages);
+     TEST_ASSERT_EQUAL_INT(3, n);
+     TEST_ASSERT_EQUAL_STRING("ls", stages[0][0]);
+     TEST_ASSERT_EQUAL_STRING("-l", stages[0][1]);
+     TEST_ASSERT_NULL(stages[0][2]);
+     TEST_ASSERT_EQUAL_STRING("grep", stages[1][0]);
+     TEST_ASSERT_NULL(stages[1][2]);
+     TEST_ASSERT_EQUAL_STRING("wc", stages[2][0]);
+     TEST_ASSERT_NULL(stages[2][1]);
+     // argv itself is not modified
+     TEST_ASSERT_EQUAL_STRING("|", cmd[2]);
+     cmd_free(cmd);
+     arena_destroy(&a);
+}
+
+void test_pipeline_split_syntax_error(void)
+{
+     struct arena a = {0};
+     const char *bad[] = {"| ls", "ls |", "ls | | wc"};
+     for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+          char **cmd = cmd_parse(bad[i]);
+          size_t n = 0;
+          TEST_ASSERT_NULL(pipeline_split(&a, cmd, &n));
+          cmd_free(cmd);
+     }
+     arena_destroy(&a);
+}
+
+void test_launch_pipeline(void)
+{
+     struct shell sh = {0};
+     sh.pipe_size = 1 << 20;
+     sh.jobs.job_control = true;
+     char **cmd = cmd_parse("echo hello pipes | tr a-z A-Z | tr -d P");
+     size_t n = 0;
+     char ***stages = pipeline_split(&sh.arena, cmd, &n);
+     pid_t pids[3];
+
+     // The last stage writes to our stdout, point it at a file
+     char path[] = "/tmp/test-lab-XXXXXX";
+     int fd = mkstemp(path);
+     int saved = dup(STDOUT_FILENO);
+     fflush(stdout);
+     dup2(fd, STDOUT_FILENO);
+     struct launch_opts opts = LAUNCH_OPTS_INIT;
+     size_t launched = launch_pipeline(&sh, stages, n, &opts, pids);
+     dup2(saved, STDOUT_FILENO);
+     close(saved);
+     TEST_ASSERT_EQUAL_INT(3, launched);
+
+     // Every stage is in the group led by the first one
+     for (size_t i = 0; i < launched; i++) {
+          TEST_ASSERT_EQUAL_INT(pids[0], getpgid(pids[i]));
+     }
+     int status;
+     for (size_t i = 0; i < launched; i++) {
+          TEST_ASSERT_EQUAL_INT(pids[i], waitpid(pids[i], &status, 0));
+          TEST_ASSERT_EQUAL_INT(0, WEXITSTATUS(status));
+     }
+     char buf[64] = {0};
+     TEST_ASSERT_TRUE(pread(fd, buf, sizeof(buf) - 1, 0) > 0);
+     TEST_ASSERT_EQUAL_STRING("HELLO IES\n", buf);
+     close(fd);
+     unlink(path);
+     cmd_free(cmd);
+     arena_destroy(&sh.arena);
+     path_cache_destroy(&sh.paths);
+}
+
+void test_launch_no_job_control(void)
+{
+     struct shell sh = {0};
+     jobs_init(&sh.jobs);
+     char **cmd = cmd_parse("sleep 10 | sleep 10");
+     size_t n = 0;
+     char ***stages = pipeline_split(&sh.arena, cmd, &n);
+     enum launch_engine engines[] = {LAUNCH_FORK, LAUNCH_SPAWN};
+
+     // A script's commands stay in the shell's group, so they can read
+     // the terminal it was started from without being stopped
+     for (size_t e = 0; e < 2; e++) {
+          sh.launch = engines[e];
+          pid_t pids[2];
+          struct launch_opts opts = LAUNCH_OPTS_INIT;
+          TEST_ASSERT_EQUAL_INT(2, launch_pipeline(&sh, stages, n, &opts, pids));
+          TEST_ASSERT_EQUAL_INT(getpgrp(), getpgid(pids[0]));
+          TEST_ASSERT_EQUAL_INT(getpgrp(), getpgid(pids[1]));
+          struct job *job = job_add(&sh.jobs, pids[0], pids, 2, "sleep 10 | sleep 10", false);
+          job_kill(&sh.jobs, job, SIGTERM);
+          TEST_ASSERT_EQUAL_INT(128 + SIGTERM, job_wait(&sh, job));
+          TEST_ASSERT_EQUAL_INT(0, sh.jobs.count);
+     }
+     cmd_free(cmd);
+     jobs_destroy(&sh.jobs);
+     arena_destroy(&sh.arena);
+     path_cache_destroy(&sh.paths);
+}
+
+void test_cmd_background(void)
+{
+     char **cmd = cmd_parse("sleep 1 &");
+     TEST_ASSERT_TRUE(cmd_background(cmd));
+     TEST_ASSERT_NULL(cmd[2]);
+     cmd_free(cmd);
+     cmd = cmd_parse("sleep 1&");
+     TEST_ASSERT_TRUE(cmd_background(cmd));
+     TEST_ASSERT_EQUAL_STRING("1", cmd[1]);
+     cmd_free(cmd);
+     cmd = cmd_parse("sleep 1");
+     TEST_ASSERT_FALSE(cmd_background(cmd));
+     TEST_ASSERT_EQUAL_STRING("1", cmd[1]);
+     cmd_free(cmd);
+}
+
+void test_job_table_lookup(void)
+{
+     struct job_table t;
+     jobs_init(&t);
+     struct job *jobs[1000];
+     for (int i = 0; i < 1000; i++) {
+          pid_t pids[2] = {100000 + 2 * i, 100001 + 2 * i};
+          jobs[i] = job_add(&t, pids[0], pids, 2, "cmd | cmd", true);
+          TEST_ASSERT_EQUAL_INT(i + 1, jobs[i]->id);
+     }
+     TEST_ASSERT_EQUAL_INT(2000, t.pid_count);
+     for (int i = 0; i < 1000; i++) {
+          TEST_ASSERT_EQUAL_PTR(jobs[i], job_find_pid(&t, 100001 + 2 * i));
+          TEST_ASSERT_EQUAL_PTR(jobs[i], job_get(&t, i + 1));
+     }
+     // A finished process leaves the index, the job finishes with its last
+     TEST_ASSERT_EQUAL_PTR(jobs[5], job_update(&t, 100010, 0));
+     TEST_ASSERT_NULL(job_find_pid(&t, 100010));
+     TEST_ASSERT_EQUAL_INT(JOB_RUNNING, jobs[5]->state);
+     job_update(&t, 100011, 3 << 8);
+     TEST_ASSERT_EQUAL_INT(JOB_DONE, jobs[5]->state);
+     TEST_ASSERT_EQUAL_INT(3, jobs[5]->status);
+     TEST_ASSERT_EQUAL_PTR(jobs[5], t.done_head);
+
+     // Removing the highest ids lets them be reused
+     job_remove(&t, jobs[999]);
+     job_remove(&t, jobs[998]);
+     TEST_ASSERT_NULL(job_get(&t, 999));
+     TEST_ASSERT_NULL(job_find_pid(&t, 100001 + 2 * 999));
+     pid_t pid = 1;
+     TEST_ASSERT_EQUAL_INT(999, job_add(&t, pid, &pid, 1, "cmd", true)->id);
+     TEST_ASSERT_EQUAL_INT(0, job_add(&t, 2, (pid_t[]){2}, 1, "cmd", false)->id);
+     jobs_destroy(&t);
+}
+
+void test_jobs_reap_background(void)
+{
+     struct shell sh = {0};
+     jobs_init(&sh.jobs);
+     char **cmd = cmd_parse("false");
+     pid_t pid = launch_cmd(&sh, cmd);
+     TEST_ASSERT_TRUE(pid > 0);
+     struct job *job = job_add(&sh.jobs, pid, &pid, 1, "false &", true);
+
+     // Nothing blocks, poll until SIGCHLD shows up on the signalfd
+     for (int i = 0; i < 200 && job->state != JOB_DONE; i++) {
+          if (jobs_reap(&sh.jobs) == 0)
+               usleep(10000);
+     }
+     TEST_ASSERT_EQUAL_INT(JOB_DONE, job->state);
+     TEST_ASSERT_EQUAL_INT(1, job->status);
+     TEST_ASSERT_EQUAL_INT(-1, waitpid(pid, NULL, WNOHANG));
+     jobs_notify(&sh);
+     TEST_ASSERT_EQUAL_INT(0, sh.jobs.count);
+     cmd_free(cmd);
+     jobs_destroy(&sh.jobs);
+     path_cache_destroy(&sh.paths);
+}
+
+void test_job_stop_bg_wait(void)
+{
+     struct shell sh = {0};
+     jobs_init(&sh.jobs);
+     sh.jobs.job_control = true;
+     char **cmd = cmd_parse("sleep 10");
+     pid_t pid = launch_cmd(&sh, cmd);
+     TEST_ASSERT_TRUE(pid > 0);
+     struct job *job = job_add(&sh.jobs, pid, &pid, 1, "sleep 10", false);
+     TEST_ASSERT_EQUAL_INT(0, job->id);
+     TEST_ASSERT_EQUAL_INT(1, sh.jobs.running);
+
+     // A stopped foreground job comes back as a background job with an id
+     kill(pid, SIGSTOP);
+     TEST_ASSERT_EQUAL_INT(128 + SIGSTOP, job_wait(&sh, job));
+     TEST_ASSERT_EQUAL_INT(JOB_STOPPED, job->state);
+     TEST_ASSERT_EQUAL_INT(1, job->id);
+     TEST_ASSERT_EQUAL_PTR(job, sh.jobs.current);
+     TEST_ASSERT_EQUAL_INT(0, sh.jobs.running);
+
+     char *bg[] = {"bg", "%1", NULL};
+     TEST_ASSERT_EQUAL_INT(0, bg_cmd(&sh, bg));
+     TEST_ASSERT_EQUAL_INT(JOB_RUNNING, job->state);
+     TEST_ASSERT_EQUAL_INT(1, sh.jobs.running);
+
+     kill(pid, SIGTERM);
+     char *wait[] = {"wait", "%1", NULL};
+     TEST_ASSERT_EQUAL_INT(128 + SIGTERM, wait_cmd(&sh, wait));
+     TEST_ASSERT_NULL(job_get(&sh.jobs, 1));
+     TEST_ASSERT_EQUAL_INT(0, sh.jobs.count);
+     char *fg[] = {"fg", NULL};
+     TEST_ASSERT_EQUAL_INT(1, fg_cmd(&sh, fg));
+     cmd_free(cmd);
+     jobs_destroy(&sh.jobs);
+     path_cache_destroy(&sh.paths);
+}
+
+void test_event_loop_pidfd_reap(void)
+{
+     struct shell sh = {0};
+     jobs_init(&sh.jobs);
+     TEST_ASSERT_EQUAL_INT(0, event_init(&sh));
+     TEST_ASSERT_EQUAL_INT(sh.events.epfd, sh.jobs.epfd);
+     char **cmd = cmd_parse("false");
+     pid_t pid = launch_cmd(&sh, cmd);
+     struct job *job = job_add(&sh.jobs, pid, &pid, 1, "false &", true);
+     TEST_ASSERT_TRUE(job->procs[0].pidfd >= 0);
+
+     // The exit arrives on the pidfd
+     for (int i = 0; i < 100 && job->state != JOB_DONE; i++)
+          event_wait(&sh, 100);
+     TEST_ASSERT_EQUAL_INT(JOB_DONE, job->state);
+     TEST_ASSERT_EQUAL_INT(1, job->status);
+     TEST_ASSERT_EQUAL_INT(-1, job->procs[0].pidfd);
+     TEST_ASSERT_TRUE(sh.events.child_events > 0);
+     jobs_notify(&sh);
+     TEST_ASSERT_EQUAL_INT(0, sh.jobs.count);
+
+     // Stops come from SIGCHLD without reaping anything
+     sh.jobs.job_control = true;
+     pid = launch_cmd(&sh, cmd);
+     job = job_add(&sh.jobs, pid, &pid, 1, "false", false);
+     kill(pid, SIGSTOP);
+     TEST_ASSERT_EQUAL_INT(128 + SIGSTOP, job_wait(&sh, job));
+     TEST_ASSERT_EQUAL_INT(JOB_STOPPED, job->state);
+     char *fg[] = {"fg", NULL};
+     TEST_ASSERT_EQUAL_INT(1, fg_cmd(&sh, fg));
+     TEST_ASSERT_EQUAL_INT(0, sh.jobs.count);
+
+     cmd_free(cmd);
+     event_destroy(&sh);
+     jobs_destroy(&sh.jobs);
+     path_cache_destroy(&sh.paths);
+}
+
+void test_parallel_cmd(void)
+{
+     struct shell sh = {0};
+     jobs_init(&sh.jobs);
+     TEST_ASSERT_EQUAL_INT(0, event_init(&sh));
+
+     // {} as the command, the status counts the failed jobs
+     char *fails[] = {"parallel", "-q", "-j", "2", "{}", ":::", "true", "false", "true",
+                      "false", "false", NULL};
+     TEST_ASSERT_EQUAL_INT(3, parallel_cmd(&sh, fails));
+     TEST_ASSERT_EQUAL_INT(0, sh.jobs.count);
+
+     // Never more than two in flight, so four sleeps take two rounds
+     struct timespec t0, t1;
+     char *sleeps[] = {"parallel", "-q", "-k", "-j2", "sleep", ":::", "0.1", "0.1", "0.1",
+                       "0.1", NULL};
+     clock_gettime(CLOCK_MONOTONIC, &t0);
+     TEST_ASSERT_EQUAL_INT(0, parallel_cmd(&sh, sleeps));
+     clock_gettime(CLOCK_MONOTONIC, &t1);
+     double elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+     TEST_ASSERT_TRUE(elapsed >= 0.19);
+     TEST_ASSERT_TRUE(elapsed < 0.39);
+
+     char *missing[] = {"parallel", "-q", "no-such-command-xyz", ":::", "a", NULL};
+     TEST_ASSERT_EQUAL_INT(1, parallel_cmd(&sh, missing));
+     char *usage[] = {"parallel", "-j", "0", "true", NULL};
+     TEST_ASSERT_EQUAL_INT(2, parallel_cmd(&sh, usage));
+
+     event_destroy(&sh);
+     jobs_destroy(&sh.jobs);
+     path_cache_destroy(&sh.paths);
+}
+
+void test_parallel_keep_order(void)
+{
+     struct shell sh = {0};
+     jobs_init(&sh.jobs);
+     TEST_ASSERT_EQUAL_INT(0, event_init(&sh));
+
+     // Later jobs finish first, their output still comes out in input order
+     char path[] = "/tmp/test-lab-XXXXXX";
+     int fd = mkstemp(path);
+     int saved = dup(STDOUT_FILENO);
+     fflush(stdout);
+     dup2(fd, STDOUT_FILENO);
+     char *argv[] = {"parallel", "-q", "-k", "-j", "3", "sh", "-c", "sleep 0.0{}; echo {}",
+                     ":::", "5", "3", "1", "4", "2", NULL};
+     int rval = parallel_cmd(&sh, argv);
+     dup2(saved, STDOUT_FILENO);
+     close(saved);
+     TEST_ASSERT_EQUAL_INT(0, rval);
+     char buf[64] = {0};
+     TEST_ASSERT_TRUE(pread(fd, buf, sizeof(buf) - 1, 0) > 0);
+     TEST_ASSERT_EQUAL_STRING("5\n3\n1\n4\n2\n", buf);
+     close(fd);
+     unlink(path);
+
+     event_destroy(&sh);
+     jobs_destroy(&sh.jobs);
+     path_cache_destroy(&sh.paths);
+}
+
+void test_dag_cmd(void)
+{
+     struct shell sh = {0};
+     jobs_init(&sh.jobs);
+     TEST_ASSERT_EQUAL_INT(0, event_init(&sh));
+     char path[] = "/tmp/test-lab-XXXXXX";
+     int fd = mkstemp(path);
+     const char *graph =
+          "# lint is listed first but the long chain starts first\n"
+          "lint : true\n"
+          "fetch@2 : true\n"
+          "build@3 fetch : true\n"
+          "test build : false\n"
+          "package build : true\n"
+          "publish test package : true\n";
+     TEST_ASSERT_EQUAL_INT(strlen(graph), write(fd, graph, strlen(graph)));
+
+     // The plan goes to stdout, point it at a file
+     char out[] = "/tmp/test-lab-XXXXXX";
+     int ofd = mkstemp(out);
+     int saved = dup(STDOUT_FILENO);
+     fflush(stdout);
+     dup2(ofd, STDOUT_FILENO);
+     char *plan[] = {"dag", "-n", path, NULL};
+     int rval = dag_cmd(&sh, plan);
+     dup2(saved, STDOUT_FILENO);
+     close(saved);
+     TEST_ASSERT_EQUAL_INT(0, rval);
+     char buf[512] = {0};
+     TEST_ASSERT_TRUE(pread(ofd, buf, sizeof(buf) - 1, 0) > 0);
+     TEST_ASSERT_EQUAL_PTR(buf, strstr(buf, "fetch "));
+     TEST_ASSERT_TRUE(strstr(buf, "build ") < strstr(buf, "lint "));
+     TEST_ASSERT_NOT_NULL(strstr(buf, "critical path 7.00: fetch build test publish"));
+     close(ofd);
+     unlink(out);
+
+     // test fails so publish never runs, -k still runs package
+     char *fast[] = {"dag", "-q", "-j", "1", path, NULL};
+     TEST_ASSERT_EQUAL_INT(1, dag_cmd(&sh, fast));
+     char *keep[] = {"dag", "-q", "-k", path, NULL};
+     TEST_ASSERT_EQUAL_INT(1, dag_cmd(&sh, keep));
+     TEST_ASSERT_EQUAL_INT(0, sh.jobs.count);
+
+     // A cycle is rejected before anything runs
+     const char *cycle = "a b : true\nb a : true\n";
+     TEST_ASSERT_EQUAL_INT(0, ftruncate(fd, 0));
+     TEST_ASSERT_EQUAL_INT(strlen(cycle), pwrite(fd, cycle, strlen(cycle), 0));
+     char *run[] = {"dag", path, NULL};
+     TEST_ASSERT_EQUAL_INT(2, dag_cmd(&sh, run));
+
+     // A pipeline stage that cannot launch fails its task, so b never runs
+     char marker[] = "/tmp/test-lab-XXXXXX";
+     close(mkstemp(marker));
+     unlink(marker);
+     char partial[128];
+     snprintf(partial, sizeof(partial), "a : seq 3 | no-such-cmd-xyz\nb a : touch %s\n", marker);
+     TEST_ASSERT_EQUAL_INT(0, ftruncate(fd, 0));
+     TEST_ASSERT_EQUAL_INT(strlen(partial), pwrite(fd, partial, strlen(partial), 0));
+     TEST_ASSERT_EQUAL_INT(1, dag_cmd(&sh, fast));
+     TEST_ASSERT_EQUAL_INT(-1, access(marker, F_OK));
+     TEST_ASSERT_EQUAL_INT(0, sh.jobs.count);
+     close(fd);
+     unlink(path);
+
+     event_destroy(&sh);
+     jobs_destroy(&sh.jobs);
+     path_cache_destroy(&sh.paths);
+}
+
+void test_hist_store(void)
+{
+     char path[] = "/tmp/test-lab-XXXXXX";
+     close(mkstemp(path));
+     struct hist_store a, b;
+     TEST_ASSERT_EQUAL_INT(0, hist_open(&a, path));
+     TEST_ASSERT_EQUAL_INT(0, hist_open(&b, path));
+     TEST_ASSERT_EQUAL_INT(0, hist_refresh(&a));
+
+     // Two shells appending to one file see each other's records
+     TEST_ASSERT_EQUAL_INT(0, hist_append(&a, "make", "/src", 1000, 250, 0));
+     TEST_ASSERT_EQUAL_INT(0, hist_append(&b, "make check", "/src/tests", 2000, 5, 2));
+     TEST_ASSERT_EQUAL_INT(0, hist_append(&a, "ls", "/", 3000, 1, 0));
+     TEST_ASSERT_EQUAL_INT(3, hist_refresh(&b));
+     struct hist_entry e;
+     TEST_ASSERT_TRUE(hist_get(&b, 1, &e));
+     TEST_ASSERT_EQUAL_STRING("make check", e.cmd);
+     TEST_ASSERT_EQUAL_STRING("/src/tests", e.cwd);
+     TEST_ASSERT_EQUAL_INT(2000, e.time);
+     TEST_ASSERT_EQUAL_INT(5, e.duration);
+     TEST_ASSERT_EQUAL_INT(2, e.status);
+     TEST_ASSERT_FALSE(hist_get(&b, 3, &e));
+
+     // A torn record is skipped once later records follow it
+     int fd = open(path, O_WRONLY | O_APPEND);
+     TEST_ASSERT_EQUAL_INT(12, write(fd, "HST1\x40\0\0\0garb", 12));
+     close(fd);
+     TEST_ASSERT_EQUAL_INT(3, hist_refresh(&a));
+     char long_cmd[2000];
+     memset(long_cmd, 'x', sizeof(long_cmd) - 1);
+     long_cmd[sizeof(long_cmd) - 1] = '\0';
+     TEST_ASSERT_EQUAL_INT(0, hist_append(&b, long_cmd, "/", 4000, 1, 0));
+     TEST_ASSERT_EQUAL_INT(4, hist_refresh(&a));
+     TEST_ASSERT_TRUE(hist_get(&a, 3, &e));
+     TEST_ASSERT_EQUAL_STRING(long_cmd, e.cmd);
+
+     hist_close(&a);
+     hist_close(&b);
+     unlink(path);
+}
+
+void test_hist_search(void)
+{
+     char path[] = "/tmp/test-lab-XXXXXX";
+     close(mkstemp(path));
+     struct hist_store h;
+     TEST_ASSERT_EQUAL_INT(0, hist_open(&h, path));
+     char cmd[64];
+     for (int i = 0; i < 3000; i++) {
+          sprintf(cmd, "%s %d", i % 3 ? "make target" : "git commit -m", i * 7 % 1000);
+          TEST_ASSERT_EQUAL_INT(0, hist_append(&h, cmd, "/", i, 0, 0));
+     }
+
+     // Every match, newest first, agrees with a plain scan
+     const char *queries[] = {"commit -m 49", "get 7", "99", "target", "rge", "nothing", "m"};
+     for (size_t q = 0; q < sizeof(queries) / sizeof(queries[0]); q++) {
+          size_t ids[3000];
+          size_t n = hist_search(&h, queries[q], SIZE_MAX, ids, 3000);
+          size_t expected = 0;
+          for (size_t id = 3000; id-- > 0;) {
+               struct hist_entry e;
+               TEST_ASSERT_TRUE(hist_get(&h, id, &e));
+               if (strstr(e.cmd, queries[q]) != NULL) {
+                    TEST_ASSERT_TRUE(expected < n);
+                    TEST_ASSERT_EQUAL_INT(id, ids[expected++]);
+               }
+          }
+          TEST_ASSERT_EQUAL_INT(expected, n);
+     }
+
+     // New commands are found without rebuilding, before pages back
+     TEST_ASSERT_EQUAL_INT(0, hist_append(&h, "ssh build-host", "/", 3000, 0, 0));
+     size_t ids[2];
+     TEST_ASSERT_EQUAL_INT(1, hist_search(&h, "build-h", SIZE_MAX, ids, 2));
+     TEST_ASSERT_EQUAL_INT(3000, ids[0]);
+     TEST_ASSERT_EQUAL_INT(3001, h.index.indexed);
+     TEST_ASSERT_EQUAL_INT(2, hist_search(&h, "commit -m 1", SIZE_MAX, ids, 2));
+     size_t older = ids[1];
+     TEST_ASSERT_EQUAL_INT(2, hist_search(&h, "commit -m 1", older, ids, 2));
+     TEST_ASSERT_TRUE(ids[0] < older);
+
+     hist_close(&h);
+     unlink(path);
+}
+
+/**
+ * Runs history with args and returns what it printed, which the caller
+ * frees.
+ */
+static char *history_output(struct shell *sh, char **argv, int *status)
+{
+     char path[] = "/tmp/test-lab-XXXXXX";
+     int fd = mkstemp(path);
+     unlink(path);
+     fflush(stdout);
+     int saved = dup(STDOUT_FILENO);
+     dup2(fd, STDOUT_FILENO);
+     *status = history_cmd(sh, argv);
+     dup2(saved, STDOUT_FILENO);
+     close(saved);
+     off_t size = lseek(fd, 0, SEEK_END);
+     char *out = calloc(1, size + 1);
+     pread(fd, out, size, 0);
+     close(fd);
+     return out;
+}
+
+void test_history_output(void)
+{
+     char path[] = "/tmp/test-lab-XXXXXX";
+     close(mkstemp(path));
+     struct shell sh;
+     memset(&sh, 0, sizeof(sh));
+     TEST_ASSERT_EQUAL_INT(0, hist_open(&sh.history, path));
+     const char *cmds[] = {"ls", "make", "git status", "make check", "vi lab.c", "make"};
+     for (int i = 0; i < 6; i++) {
+          TEST_ASSERT_EQUAL_INT(0, hist_append(&sh.history, cmds[i], "/", i, 0, 0));
+     }
+     int status;
+
+     // The last N entries keep their numbers
+     char *last[] = {"history", "2", NULL};
+     char *out = history_output(&sh, last, &status);
+     TEST_ASSERT_EQUAL_INT(0, status);
+     TEST_ASSERT_EQUAL_STRING("    5  vi lab.c\n    6  make\n", out);
+     free(out);
+
+     // Ranges are inclusive and either end may be open
+     char *range[] = {"history", "-r", "2:3", NULL};
+     out = history_output(&sh, range, &status);
+     TEST_ASSERT_EQUAL_STRING("    2  make\n    3  git status\n", out);
+     free(out);
+     char *open_end[] = {"history", "-r", "5:", NULL};
+     out = history_output(&sh, open_end, &status);
+     TEST_ASSERT_EQUAL_STRING("    5  vi lab.c\n    6  make\n", out);
+     free(out);
+
+     // Searches stay inside the range and N keeps the latest matches
+     char *search[] = {"history", "-s", "make", "-r", ":5", "1", NULL};
+     out = history_output(&sh, search, &status);
+     TEST_ASSERT_EQUAL_INT(0, status);
+     TEST_ASSERT_EQUAL_STRING("    4  make check\n", out);
+     free(out);
+
+     // -0 gives bare commands ending in NUL
+     char *nul[] = {"history", "-0", "-r", "3:4", NULL};
+     out = history_output(&sh, nul, &status);
+     TEST_ASSERT_EQUAL_MEMORY("git status\0make check\0", out, 22);
+     free(out);
+
+     char *bad[] = {"history", "-r", "4:2", NULL};
+     out = history_output(&sh, bad, &status);
+     TEST_ASSERT_EQUAL_INT(2, status);
+     free(out);
+
+     // More entries than one writev takes come out whole and in order
+     char cmd[300];
+     memset(cmd, 'x', sizeof(cmd) - 1);
+     cmd[sizeof(cmd) - 1] = '\0';
+     for (int i = 0; i < 3000; i++) {
+          TEST_ASSERT_EQUAL_INT(0, hist_append(&sh.history, i % 2 ? cmd : "ls", "/", i, 0, 0));
+     }
+     char *all[] = {"history", "-0", NULL};
+     out = history_output(&sh, all, &status);
+     size_t pos = 0;
+     for (int i = 0; i < 3006; i++) {
+          const char *expected = i < 6 ? cmds[i] : (i - 6) % 2 ? cmd : "ls";
+          TEST_ASSERT_EQUAL_STRING(expected, out + pos);
+          pos += strlen(expected) + 1;
+     }
+     free(out);
+
+     hist_close(&sh.history);
+     unlink(path);
+}
+
+/**
+ * Returns the live entries of a ring joined by spaces, oldest first.
+ */
+static const char *ring_contents(struct hist_ring *r)
+{
+     static char buf[4096];
+     buf[0] = '\0';
+     for (size_t i = 0; i < r->count; i++) {
+          const char *line = hist_ring_get(r, i);
+          if (line != NULL) {
+               strcat(strcat(buf, *buf ? " " : ""), line);
+          }
+     }
+     return buf;
+}
+
+void test_hist_ring(void)
+{
+     struct hist_ring r;
+     const char *cmds[] = {"ls", "make", "make", "ls", "vi", "make"};
+
+     // A full ring drops its oldest entry
+     TEST_ASSERT_EQUAL_INT(0, hist_ring_init(&r, 4, HIST_DUPS_KEEP));
+     for (int i = 0; i < 6; i++) {
+          TEST_ASSERT_TRUE(hist_ring_add(&r, cmds[i]));
+     }
+     TEST_ASSERT_EQUAL_STRING("make ls vi make", ring_contents(&r));
+     TEST_ASSERT_EQUAL_INT(4, r.count);
+     hist_ring_destroy(&r);
+
+     // ignoredups only drops repeats of the newest entry
+     TEST_ASSERT_EQUAL_INT(0, hist_ring_init(&r, 10, HIST_DUPS_IGNORE));
+     for (int i = 0; i < 6; i++) {
+          hist_ring_add(&r, cmds[i]);
+     }
+     TEST_ASSERT_EQUAL_STRING("ls make ls vi make", ring_contents(&r));
+     hist_ring_destroy(&r);
+
+     // erasedups keeps only the latest copy of each command
+     TEST_ASSERT_EQUAL_INT(0, hist_ring_init(&r, 10, HIST_DUPS_ERASE));
+     for (int i = 0; i < 6; i++) {
+          TEST_ASSERT_TRUE(hist_ring_add(&r, cmds[i]));
+     }
+     TEST_ASSERT_EQUAL_STRING("ls vi make", ring_contents(&r));
+     TEST_ASSERT_NULL(hist_ring_get(&r, 0));
+     hist_ring_destroy(&r);
+
+     // Random commands through a small ring: every live entry is unique,
+     // they are in the order they were last added and the holes get
+     // compacted so the ring does not fill with them
+     TEST_ASSERT_EQUAL_INT(0, hist_ring_init(&r, 64, HIST_DUPS_ERASE));
+     int last_added[50] = {0};
+     char line[16];
+     srand(7);
+     for (int n = 1; n <= 5000; n++) {
+          int c = rand() % 50;
+          sprintf(line, "cmd %d", c);
+          TEST_ASSERT_TRUE(hist_ring_add(&r, line));
+          last_added[c] = n;
+          int seen[50] = {0};
+          int prev = 0;
+          size_t live = 0;
+          for (size_t i = 0; i < r.count; i++) {
+               const char *e = hist_ring_get(&r, i);
+               if (e == NULL) {
+                    continue;
+               }
+               int k = atoi(e + 4);
+               TEST_ASSERT_EQUAL_INT(0, seen[k]++);
+               TEST_ASSERT_TRUE(last_added[k] > prev);
+               prev = last_added[k];
+               live++;
+          }
+          TEST_ASSERT_EQUAL_INT(n, prev);
+          TEST_ASSERT_EQUAL_INT(r.count - r.holes, live);
+          TEST_ASSERT_TRUE(r.holes <= 16 || r.holes * 2 <= r.count);
+     }
+     hist_ring_destroy(&r);
+
+     // A size of 0 keeps nothing
+     TEST_ASSERT_EQUAL_INT(0, hist_ring_init(&r, 0, HIST_DUPS_KEEP));
+     TEST_ASSERT_FALSE(hist_ring_add(&r, "ls"));
+     hist_ring_destroy(&r);
+}
+
+void test_hist_expand(void)
+{
+     struct shell sh;
+     memset(&sh, 0, sizeof(sh));
+     sh.history.fd = -1;
+     arena_init(&sh.arena, 0);
+     TEST_ASSERT_EQUAL_INT(0, hist_ring_init(&sh.recent, 10, HIST_DUPS_KEEP));
+     const char *cmds[] = {"make -j8 check", "git status", "ls -l | wc -l"};
+     for (int i = 0; i < 3; i++) {
+          hist_ring_add(&sh.recent, cmds[i]);
+     }
+     char **argv;
+
+     char plain[] = "echo a != b!";
+     TEST_ASSERT_EQUAL_PTR(plain, hist_expand(&sh, plain, &argv));
+     char inner[] = "sudo !! && !-3 x";
+     TEST_ASSERT_EQUAL_STRING("sudo ls -l | wc -l && make -j8 check x",
+                              hist_expand(&sh, inner, &argv));
+     TEST_ASSERT_NULL(argv);
+     char numbered[] = "!2";
+     TEST_ASSERT_EQUAL_STRING("git status", hist_expand(&sh, numbered, &argv));
+     char missing[] = "!nothing";
+     TEST_ASSERT_NULL(hist_expand(&sh, missing, &argv));
+
+     // A whole line reference comes back parsed, the second time from the
+     // cache, and callers may change what they get
+     char prefix[] = "!ls";
+     TEST_ASSERT_EQUAL_STRING("ls -l | wc -l", hist_expand(&sh, prefix, &argv));
+     TEST_ASSERT_NOT_NULL(argv);
+     TEST_ASSERT_EQUAL_STRING("wc", argv[3]);
+     argv[3][0] = 'X';
+     hist_ring_add(&sh.recent, "ls -l | wc -l");
+     unsigned long allocs = sh.arena.allocs;
+     char again[] = "!!";
+     hist_expand(&sh, again, &argv);
+     TEST_ASSERT_EQUAL_INT(2, sh.arena.allocs - allocs);
+     const char *expected[] = {"ls", "-l", "|", "wc", "-l", NULL};
+     for (int i = 0; i < 6; i++) {
+          TEST_ASSERT_EQUAL_STRING(expected[i], argv[i]);
+     }
+
+     // Expansions are built in the arena, once it has grown to fit a line
+     // expanding it again mallocs nothing
+     char big[] = "!! !! !! !! !! !! !! !! !! !! !! !! !! !! !! !! !! !! !! !! !! !! !!";
+     arena_reset(&sh.arena);
+     hist_expand(&sh, big, &argv);
+     arena_reset(&sh.arena);
+     unsigned long mallocs = sh.arena.mallocs;
+     char *out = hist_expand(&sh, big, &argv);
+     TEST_ASSERT_EQUAL_UINT(23 * 14 - 1, strlen(out));
+     TEST_ASSERT_EQUAL_UINT(mallocs, sh.arena.mallocs);
+
+     hist_ring_destroy(&sh.recent);
+     arena_destroy(&sh.arena);
+}
+
+void test_builtin_table(void)
+{
+     // Every shell builtin is found with its handler, other names are not
+     TEST_ASSERT_TRUE(is_builtin("history"));
+     TEST_ASSERT_EQUAL_PTR(cd_cmd, builtin_find("cd")->run);
+     TEST_ASSERT_TRUE(builtin_find("parallel")->flags & BUILTIN_FORKS);
+     TEST_ASSERT_FALSE(is_builtin("ls"));
+     TEST_ASSERT_FALSE(is_builtin("c"));
+     TEST_ASSERT_FALSE(is_builtin("cdx"));
+     TEST_ASSERT_FALSE(is_builtin(""));
+
+     // A table of 300 names still gives every name a slot of its own
+     static struct builtin list[300];
+     static char names[300][16];
+     for (int i = 0; i < 300; i++) {
+          sprintf(names[i], "cmd%d", i);
+          list[i].name = names[i];
+     }
+     struct builtin_table t;
+     TEST_ASSERT_EQUAL_INT(0, builtin_table_build(&t, list, 300));
+     for (int i = 0; i < 300; i++) {
+          TEST_ASSERT_EQUAL_PTR(&list[i], builtin_table_find(&t, names[i]));
+     }
+     TEST_ASSERT_NULL(builtin_table_find(&t, "cmd300"));
+     builtin_table_destroy(&t);
+}
+
+/* Runs exit in a child shell and returns the status it exited with. */
+static int exit_status(int last, char **argv)
+{
+     fflush(stdout);
+     pid_t pid = fork();
+     if (pid == 0) {
+          struct shell sh = {0};
+          sh.last_status = last;
+          sh.history.fd = -1;
+          exit_cmd(&sh, argv);
+          _exit(99);
+     }
+     int status;
+     waitpid(pid, &status, 0);
+     return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+void test_exit_cmd(void)
+{
+     // Without an argument the last command's status is kept
+     char *plain[] = {"exit", NULL};
+     TEST_ASSERT_EQUAL_INT(0, exit_status(0, plain));
+     TEST_ASSERT_EQUAL_INT(127, exit_status(127, plain));
+     char *code[] = {"exit", "3", NULL};
+     TEST_ASSERT_EQUAL_INT(3, exit_status(1, code));
+     char *wrap[] = {"exit", "300", NULL};
+     TEST_ASSERT_EQUAL_INT(44, exit_status(0, wrap));
+     char *bad[] = {"exit", "x", NULL};
+     TEST_ASSERT_EQUAL_INT(2, exit_status(0, bad));
+
+     // Too many arguments is an error and the shell keeps going
+     struct shell sh = {0};
+     char *many[] = {"exit", "1", "2", NULL};
+     TEST_ASSERT_EQUAL_INT(1, exit_cmd(&sh, many));
+}
+
+/* Runs a line through do_builtin and returns its status. */
+static int run_util(struct shell *sh, const char *line)
+{
+     char **argv = cmd_parse(line);
+     TEST_ASSERT_TRUE(do_builtin(sh, argv));
+     cmd_free(argv);
+     return sh->last_status;
+}
+
+void test_utils(void)
+{
+     char path[] = "/tmp/test-lab-XXXXXX";
+     int fd = mkstemp(path);
+     unlink(path);
+     struct shell sh;
+     memset(&sh, 0, sizeof(sh));
+     sh.out = malloc(sizeof(*sh.out));
+     writer_init(sh.out, fd);
+
+     // Output is queued on the shell's writer until sh_flush
+     TEST_ASSERT_EQUAL_INT(0, run_util(&sh, "echo a  b"));
+     TEST_ASSERT_EQUAL_INT(0, run_util(&sh, "echo -n -x"));
+     TEST_ASSERT_EQUAL_INT(0, run_util(&sh, "echo -ne \\tc\\0101\\cgone"));
+     TEST_ASSERT_EQUAL_INT(0, lseek(fd, 0, SEEK_END));
+     TEST_ASSERT_EQUAL_INT(0, run_util(&sh, "printf [%s=%03d]\\n a 7 b"));
+     TEST_ASSERT_EQUAL_INT(0, run_util(&sh, "printf %-3s|%x|%c|%b|%%\\n ab 255 xyz x\\ty"));
+     TEST_ASSERT_EQUAL_INT(1, run_util(&sh, "printf %d. 1x"));
+     sh_flush(&sh);
+     char out[256] = "";
+     TEST_ASSERT_TRUE(pread(fd, out, sizeof(out) - 1, 0) > 0);
+     TEST_ASSERT_EQUAL_STRING("a b\n-x\tcA[a=007]\n[b=000]\nab |ff|x|x\ty|%\n1.", out);
+
+     // test and [ report through the status only
+     TEST_ASSERT_EQUAL_INT(0, run_util(&sh, "true"));
+     TEST_ASSERT_EQUAL_INT(1, run_util(&sh, "false"));
+     TEST_ASSERT_EQUAL_INT(1, run_util(&sh, "test"));
+     TEST_ASSERT_EQUAL_INT(0, run_util(&sh, "test -n"));
+     TEST_ASSERT_EQUAL_INT(0, run_util(&sh, "test -d /tmp -a ! -f /tmp"));
+     TEST_ASSERT_EQUAL_INT(0, run_util(&sh, "[ 2 -gt 10 -o ( a = a ) ]"));
+     TEST_ASSERT_EQUAL_INT(1, run_util(&sh, "[ 10 -le 2 ]"));
+     TEST_ASSERT_EQUAL_INT(0, run_util(&sh, "test ( = ("));
+     TEST_ASSERT_EQUAL_INT(2, run_util(&sh, "test 1 -eq x"));
+     TEST_ASSERT_EQUAL_INT(2, run_util(&sh, "[ 1 = 1"));
+     TEST_ASSERT_EQUAL_INT(2, run_util(&sh, "test a b"));
+
+     free(sh.out);
+     close(fd);
+}
+
+void test_time_cmd(void)
+{
+     struct shell sh = {0};
+     jobs_init(&sh.jobs);
+     TEST_ASSERT_EQUAL_INT(0, event_init(&sh));
+
+     // wait4 charges what each finished process used to its job
+     char **cmd = cmd_parse("dd if=/dev/zero of=/dev/null bs=1M count=100 status=none");
+     pid_t pid = launch_cmd(&sh, cmd);
+     struct job *job = job_add(&sh.jobs, pid, &pid, 1, "dd", false);
+     while (job->nlive > 0)
+          TEST_ASSERT_EQUAL_INT(0, jobs_block(&sh));
+     TEST_ASSERT_TRUE(job->usage.ru_maxrss > 0);
+     TEST_ASSERT_TRUE(job->usage.ru_utime.tv_sec + job->usage.ru_utime.tv_usec +
+                      job->usage.ru_stime.tv_sec + job->usage.ru_stime.tv_usec > 0);
+     TEST_ASSERT_EQUAL_INT(0, job_wait(&sh, job));
+     cmd_free(cmd);
+
+     // time passes on the status of what it ran, builtin or not
+     char *external[] = {"time", "sh", "-c", "exit 3", NULL};
+     TEST_ASSERT_EQUAL_INT(3, time_cmd(&sh, external));
+     char *pipeline[] = {"time", "true", "|", "/bin/false", NULL};
+     TEST_ASSERT_EQUAL_INT(1, time_cmd(&sh, pipeline));
+     char *builtin[] = {"time", "false", NULL};
+     TEST_ASSERT_EQUAL_INT(1, time_cmd(&sh, builtin));
+     char *missing[] = {"time", "no-such-command-here", NULL};
+     TEST_ASSERT_EQUAL_INT(127, time_cmd(&sh, missing));
+     char *syntax[] = {"time", "true", "|", NULL};
+     TEST_ASSERT_EQUAL_INT(2, time_cmd(&sh, syntax));
+     TEST_ASSERT_EQUAL_INT(0, sh.jobs.count);
+
+     event_destroy(&sh);
+     jobs_destroy(&sh.jobs);
+     path_cache_destroy(&sh.paths);
+     arena_destroy(&sh.arena);
+}
+
+void test_stats(void)
+{
+     static struct stats st;
+     stats_reset(&st);
+
+     // Small values are exact, larger ones within a bucket of 3%
+     for (int64_t v = 1; v <= 1000; v++)
+          stats_record(&st, STATS_PARSE, v * 1000);
+     const struct stats_hist *h = &st.stages[STATS_PARSE];
+     TEST_ASSERT_EQUAL_UINT64(1000, h->count);
+     TEST_ASSERT_EQUAL_UINT64(1000, h->min);
+     TEST_ASSERT_EQUAL_UINT64(1000000, h->max);
+     TEST_ASSERT_EQUAL_UINT64(500500000, h->sum);
+     uint64_t p50 = stats_percentile(h, 0.5);
+     uint64_t p99 = stats_percentile(h, 0.99);
+     TEST_ASSERT_TRUE(p50 >= 500000 && p50 <= 515000);
+     TEST_ASSERT_TRUE(p99 >= 990000 && p99 <= 1000000);
+     TEST_ASSERT_EQUAL_UINT64(1000000, stats_percentile(h, 1));
+     stats_record(&st, STATS_WAIT, 17);
+     TEST_ASSERT_EQUAL_UINT64(17, stats_percentile(&st.stages[STATS_WAIT], 0.5));
+     stats_record(&st, STATS_WAIT, INT64_MAX);
+     TEST_ASSERT_EQUAL_UINT64(INT64_MAX, stats_percentile(&st.stages[STATS_WAIT], 1));
+     TEST_ASSERT_EQUAL_UINT64(0, stats_percentile(&st.stages[STATS_READ], 0.5));
+
+     // Nothing is recorded without statistics
+     stats_record(NULL, STATS_READ, 5);
+     stats_count(NULL, STATS_LINES);
+
+     // The JSON report, then a reset
+     char path[] = "/tmp/test-lab-XXXXXX";
+     int fd = mkstemp(path);
+     unlink(path);
+     struct shell sh;
+     memset(&sh, 0, sizeof(sh));
+     sh.out = malloc(sizeof(*sh.out));
+     writer_init(sh.out, fd);
+     sh.stats = &st;
+     stats_count(&st, STATS_FAILURES);
+     char *json[] = {"stats", "-j", "-r", NULL};
+     TEST_ASSERT_EQUAL_INT(0, stats_cmd(&sh, json));
+     sh_flush(&sh);
+     char out[4096] = "";
+     TEST_ASSERT_TRUE(pread(fd, out, sizeof(out) - 1, 0) > 0);
+     TEST_ASSERT_NOT_NULL(strstr(out, "\"failures\":1}"));
+     TEST_ASSERT_NOT_NULL(strstr(out, "\"parse\":{\"count\":1000,\"sum_ns\":500500000,"
+                                      "\"min_ns\":1000,"));
+     TEST_ASSERT_EQUAL_UINT64(0, st.stages[STATS_PARSE].count);
+     TEST_ASSERT_EQUAL_UINT64(0, st.counters[STATS_FAILURES]);
+     char *bad[] = {"stats", "-x", NULL};
+     TEST_ASSERT_EQUAL_INT(2, stats_cmd(&sh, bad));
+
+     free(sh.out);
+     close(fd);
+}
+
+void test_trace(void)
+{
+     char path[] = "/tmp/test-lab-XXXXXX";
+     int fd = mkstemp(path);
+     close(fd);
+     struct trace *t = trace_open(path);
+     TEST_ASSERT_NOT_NULL(t);
+
+     // A command line, a process on its own track and a builtin span
+     trace_begin(t, TRACE_COMMAND, 0, "say \"hi\"\tthere");
+     trace_begin(t, TRACE_PROCESS, 4242, "cat");
+     trace_end(t, TRACE_PROCESS, 4242, 3);
+     trace_span(t, TRACE_BUILTIN, "echo", time_now_ns() - 1500, time_now_ns());
+     trace_end(t, TRACE_COMMAND, 0, 3);
+
+     // trace flushes on demand, nothing is left for the next flush
+     struct shell sh;
+     memset(&sh, 0, sizeof(sh));
+     char *flush[] = {"trace", NULL};
+     TEST_ASSERT_EQUAL_INT(1, trace_cmd(&sh, flush));
+     sh.trace = t;
+     TEST_ASSERT_EQUAL_INT(0, trace_cmd(&sh, flush));
+     TEST_ASSERT_EQUAL_INT(0, trace_flush(t));
+     char *bad[] = {"trace", "-x", NULL};
+     TEST_ASSERT_EQUAL_INT(2, trace_cmd(&sh, bad));
+
+     // MY_TRACE is not passed on to nested shells
+     char nested[] = "/tmp/test-lab-XXXXXX";
+     close(mkstemp(nested));
+     setenv("MY_TRACE", nested, true);
+     struct trace *env = trace_start(NULL, "MY_TRACE");
+     TEST_ASSERT_NOT_NULL(env);
+     TEST_ASSERT_NULL(getenv("MY_TRACE"));
+     trace_close(env);
+     unlink(nested);
+     setenv("MY_TRACE", "/nonexistent/dir/trace.json", true);
+     TEST_ASSERT_NULL(trace_start(NULL, "MY_TRACE"));
+     TEST_ASSERT_NULL(getenv("MY_TRACE"));
+     TEST_ASSERT_NULL(trace_start(NULL, "MY_TRACE"));
+
+     // More events than the ring holds drain it on the way
+     for (int i = 0; i < 10000; i++)
+          trace_span(t, TRACE_LAUNCH, "x", 0, 1);
+     trace_close(t);
+     trace_begin(NULL, TRACE_COMMAND, 0, "nothing");
+     trace_close(NULL);
+
+     static char out[1 << 21];
+     fd = open(path, O_RDONLY);
+     unlink(path);
+     ssize_t n = read(fd, out, sizeof(out) - 1);
+     close(fd);
+     TEST_ASSERT_TRUE(n > 0);
+     out[n] = '\0';
+     TEST_ASSERT_EQUAL_INT(0, strncmp(out, "[\n{", 3));
+     TEST_ASSERT_EQUAL_STRING("}\n]\n", out + n - 4);
+     TEST_ASSERT_NOT_NULL(strstr(out, "{\"name\":\"say \\\"hi\\\"\\u0009there\","
+                                      "\"cat\":\"command\",\"ph\":\"B\","));
+     TEST_ASSERT_NOT_NULL(strstr(out, "\"ph\":\"M\",\"pid\":"));
+     TEST_ASSERT_NOT_NULL(strstr(out, "\"tid\":4242,\"args\":{\"name\":\"cat\"}}"));
+     TEST_ASSERT_NOT_NULL(strstr(out, "\"cat\":\"process\",\"ph\":\"E\","));
+     TEST_ASSERT_NOT_NULL(strstr(out, "\"tid\":4242,\"args\":{\"status\":3}}"));
+     TEST_ASSERT_NOT_NULL(strstr(out, "\"cat\":\"builtin\",\"ph\":\"X\","));
+     int spans = 0;
+     for (char *p = out; (p = strstr(p, "\"cat\":\"launch\"")) != NULL; p++)
+          spans++;
+     TEST_ASSERT_EQUAL_INT(10000, spans);
+}
+
 int main(void) {
   UNITY_BEGIN();
   RUN_TEST(test_cmd_parse);
   RUN_TEST(test_cmd_parse2);
+  RUN_TEST(test_cmd_parse_delimiters);
+  RUN_TEST(test_cmd_parse_empty);
+  RUN_TEST(test_cmd_parse_many);
   RUN_TEST(test_trim_white_no_whitespace);
   RUN_TEST(test_trim_white_start_whitespace);
   RUN_TEST(test_trim_white_end_whitespace);
@@ -173,6 +1614,51 @@ int main(void) {
   RUN_TEST(test_get_prompt_custom);
   RUN_TEST(test_ch_dir_home);
   RUN_TEST(test_ch_dir_root);
+  RUN_TEST(test_launch_cmd_spawn);
+  RUN_TEST(test_launch_cmd_fork);
+  RUN_TEST(test_launch_cmd_not_found);
+  RUN_TEST(test_get_launch_engine);
+  RUN_TEST(test_path_lookup_caches);
+  RUN_TEST(test_path_lookup_path_change);
+  RUN_TEST(test_path_cache_remove);
+  RUN_TEST(test_path_lookup_negative_cache);
+  RUN_TEST(test_arena_alloc_aligned);
+  RUN_TEST(test_arena_reset_merges_chunks);
+  RUN_TEST(test_arena_steady_state_no_malloc);
+  RUN_TEST(test_trim_white_arena_all_whitespace);
+  RUN_TEST(test_scan_kernels_agree);
+  RUN_TEST(test_scan_split);
+  RUN_TEST(test_trim_white_long_line);
+  RUN_TEST(test_reader_string);
+  RUN_TEST(test_reader_file_mapped);
+  RUN_TEST(test_reader_pipe_long_line);
+  RUN_TEST(test_reader_shared_fd);
+  RUN_TEST(test_exec_cmd_replaces_process);
+  RUN_TEST(test_exec_cmd_not_found);
+  RUN_TEST(test_launch_not_found_flushes);
+  RUN_TEST(test_pipeline_split);
+  RUN_TEST(test_pipeline_split_syntax_error);
+  RUN_TEST(test_launch_pipeline);
+  RUN_TEST(test_launch_no_job_control);
+  RUN_TEST(test_cmd_background);
+  RUN_TEST(test_job_table_lookup);
+  RUN_TEST(test_jobs_reap_background);
+  RUN_TEST(test_job_stop_bg_wait);
+  RUN_TEST(test_event_loop_pidfd_reap);
+  RUN_TEST(test_parallel_cmd);
+  RUN_TEST(test_parallel_keep_order);
+  RUN_TEST(test_dag_cmd);
+  RUN_TEST(test_hist_store);
+  RUN_TEST(test_hist_search);
+  RUN_TEST(test_history_output);
+  RUN_TEST(test_hist_ring);
+  RUN_TEST(test_hist_expand);
+  RUN_TEST(test_builtin_table);
+  RUN_TEST(test_exit_cmd);
+  RUN_TEST(test_utils);
+  RUN_TEST(test_time_cmd);
+  RUN_TEST(test_stats);
+  RUN_TEST(test_trace);
 
   return UNITY_END();
 }